@@ -0,0 +1,98 @@
+/**
+ * =====================================================================================
+ *
+ *   @file checksum_bench.c
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  06/06/2013 02:40:19 PM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Checksum throughput benchmark.
+ *
+ *       Sums the same data with SuperFastHash, the portable CRC32C and the
+ *       CRC32C picked for this CPU, in frames of several sizes, from command
+ *       arguments to firmware images:
+ *
+ *         ./checksum_bench 64
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include "main.h"
+#include "superfasthash.h"
+#include "checksum.h"
+
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#define BENCH_ROUNDS 3
+
+static double s_now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/*  Sum len bytes as frames of the given size, chained like message frames; best round */
+static double s_run(int algorithm, bool portable, const uint8_t *data, size_t len, size_t frame, uint32_t *sum)
+{
+  double best = 0;
+  int round;
+
+  for (round = 0; round < BENCH_ROUNDS; round++) {
+    double start = s_now();
+    size_t offset;
+
+    *sum = 0;
+    for (offset = 0; offset + frame <= len; offset += frame) {
+      if (portable)
+        *sum = checksum_crc32c_table(*sum, data + offset, frame);
+      else
+        *sum = checksum_update(algorithm, *sum, data + offset, frame);
+    }
+
+    double elapsed = s_now() - start;
+    if (round == 0 || elapsed < best)
+      best = elapsed;
+  }
+  return best;
+}
+
+int main(int argc, char *argv[])
+{
+  size_t len = (argc > 1 ? atoi(argv[1]) : 64) * 1024 * 1024;
+  const size_t frames[] = { 64, 1024, 64 * 1024, len };
+  uint8_t *data = malloc(len);
+  size_t i, f;
+
+  assert(data);
+  for (i = 0; i < len; i++)
+    data[i] = i * 2654435761u >> 24;
+
+  checksum_init();
+  printf("%zu MB, CRC32C by %s\n", len >> 20, checksum_crc32c_backend());
+  printf("%-10s %14s %14s %14s\n", "frame", "superfasthash", "crc32c table", "crc32c");
+
+  for (f = 0; f < sizeof(frames) / sizeof(frames[0]); f++) {
+    uint32_t sfh, table, crc;
+    double sfh_time = s_run(CHECKSUM_SFH, false, data, len, frames[f], &sfh);
+    double table_time = s_run(CHECKSUM_CRC32C, true, data, len, frames[f], &table);
+    double crc_time = s_run(CHECKSUM_CRC32C, false, data, len, frames[f], &crc);
+    assert(table == crc);
+
+    printf("%-10zu %9.2f GB/s %9.2f GB/s %9.2f GB/s\n", frames[f],
+        len / sfh_time / 1e9, len / table_time / 1e9, len / crc_time / 1e9);
+  }
+
+  free(data);
+  return 0;
+}
@@ -0,0 +1,180 @@
+/**
+ * =====================================================================================
+ *
+ *   @file client_bench.c
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  06/21/2013 03:48:09 PM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Client library benchmark.
+ *
+ *       Starts a swarm of daemons on the local machine, then sends them TASKS
+ *       commands in turn through libsatan-client, keeping a window of them in
+ *       flight, and reports the commands completed per second and their
+ *       round trip:
+ *
+ *         ./client_bench ../src/satan
+ *         ./client_bench ../src/satan 16 100000 4000
+ *
+ *       The arguments are the daemon binary, the number of daemons, of
+ *       commands and of commands in flight.
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include "main.h"
+#include "client.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#define BENCH_COMMANDS_BIND   "tcp://127.0.0.1:10090"
+#define BENCH_ANSWERS_BIND    "tcp://127.0.0.1:10091"
+#define BENCH_READY_TIMEOUT   200   // ms, per TASKS sent until a daemon answers
+#define BENCH_DAEMONS_MAX     256
+
+typedef struct {
+  double *started;
+  double *latency;
+  int completed;
+  int failed;
+  int timeouts;
+} bench_t;
+
+static bench_t s_bench;
+static bool s_ready[BENCH_DAEMONS_MAX];
+
+static double s_now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int s_compare(const void *a, const void *b)
+{
+  double x = *(const double*)a, y = *(const double*)b;
+  return x < y ? -1 : x > y;
+}
+
+static void s_on_ready(client_t *client, const char *msgid, int status, zmsg_t *answer, void *arg)
+{
+  if (status == MSG_ANSWER_COMPLETED)
+    s_ready[(intptr_t)arg] = true;
+}
+
+static void s_on_answer(client_t *client, const char *msgid, int status, zmsg_t *answer, void *arg)
+{
+  intptr_t i = (intptr_t)arg;
+
+  if (!client_final(status))
+    return;
+  if (status == CLIENT_TIMEOUT)
+    s_bench.timeouts++;
+  else if (status != MSG_ANSWER_COMPLETED)
+    s_bench.failed++;
+  s_bench.latency[s_bench.completed++] = s_now() - s_bench.started[i];
+}
+
+static pid_t s_spawn(const char *binary, const char *uuid)
+{
+  pid_t pid = fork();
+
+  if (pid == 0) {
+    freopen("/dev/null", "w", stdout);
+    execl(binary, binary, "-s", BENCH_COMMANDS_BIND, "-p", BENCH_ANSWERS_BIND, "-u", uuid,
+        "-l", "", "-S", "/dev/null", (char*)NULL);
+    _exit(127);
+  }
+  return pid;
+}
+
+int main(int argc, char *argv[])
+{
+  const char *binary = argc > 1 ? argv[1] : "../src/satan";
+  int daemons = argc > 2 ? atoi(argv[2]) : 4;
+  int commands = argc > 3 ? atoi(argv[3]) : 10000;
+  int window = argc > 4 ? atoi(argv[4]) : 1000;
+  char uuid[BENCH_DAEMONS_MAX][MAX_STRING_LEN];
+  pid_t pids[BENCH_DAEMONS_MAX];
+  int i, ready = 0, sent = 0;
+
+  if (daemons < 1 || daemons > BENCH_DAEMONS_MAX || commands < 1 || window < 1) {
+    errorLog("Usage: client_bench [SATAN_BINARY] [DAEMONS <= %d] [COMMANDS] [WINDOW]", BENCH_DAEMONS_MAX);
+    return 1;
+  }
+
+  client_t *client = client_new(BENCH_COMMANDS_BIND, BENCH_ANSWERS_BIND);
+  if (client == NULL)
+    return 1;
+
+  for (i = 0; i < daemons; i++) {
+    snprintf(uuid[i], MAX_STRING_LEN, "bench%d", i);
+    pids[i] = s_spawn(binary, uuid[i]);
+  }
+
+  /*  Commands sent before a daemon subscribes are lost: ping until all answer */
+  client_set_timeout(client, BENCH_READY_TIMEOUT);
+  while (ready < daemons && !zctx_interrupted) {
+    for (i = 0; i < daemons; i++) {
+      if (!s_ready[i])
+        client_send(client, uuid[i], MSG_COMMAND_STR_TASKS, NULL, s_on_ready, (void*)(intptr_t)i);
+    }
+    while (client_process(client, BENCH_READY_TIMEOUT) > 0)
+      ;
+    for (ready = 0, i = 0; i < daemons; i++)
+      ready += s_ready[i];
+  }
+
+  s_bench.started = calloc(commands, sizeof(double));
+  s_bench.latency = calloc(commands, sizeof(double));
+  assert(s_bench.started && s_bench.latency);
+  client_set_timeout(client, CLIENT_DEFAULT_TIMEOUT);
+
+  double start = s_now();
+  while (s_bench.completed < commands && !zctx_interrupted) {
+    while (sent < commands && sent - s_bench.completed < window) {
+      s_bench.started[sent] = s_now();
+      if (client_send(client, uuid[sent % daemons], MSG_COMMAND_STR_TASKS, NULL, s_on_answer,
+            (void*)(intptr_t)sent) == NULL)
+        break;
+      sent++;
+    }
+    if (client_process(client, 100) == -1)
+      break;
+  }
+  double elapsed = s_now() - start;
+
+  for (i = 0; i < daemons; i++)
+    kill(pids[i], SIGTERM);
+  for (i = 0; i < daemons; i++)
+    waitpid(pids[i], NULL, 0);
+  client_destroy(&client);
+
+  if (s_bench.completed > 0) {
+    double sum = 0;
+    for (i = 0; i < s_bench.completed; i++)
+      sum += s_bench.latency[i];
+    qsort(s_bench.latency, s_bench.completed, sizeof(double), s_compare);
+
+    printf("%d daemons, %d TASKS commands, %d in flight\n", daemons, s_bench.completed, window);
+    printf("  %-12s %10.0f commands/s\n", "throughput", s_bench.completed / elapsed);
+    printf("  %-12s %10.2f ms\n", "mean", sum / s_bench.completed * 1000);
+    printf("  %-12s %10.2f ms\n", "p99", s_bench.latency[s_bench.completed * 99 / 100] * 1000);
+    printf("  %-12s %10d failed, %d timed out\n", "errors", s_bench.failed, s_bench.timeouts);
+  }
+
+  free(s_bench.started);
+  free(s_bench.latency);
+  return 0;
+}
@@ -0,0 +1,145 @@
+#! /usr/bin/python
+
+import os
+import sys
+import time
+import uuid
+import struct
+import subprocess
+import zmq
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "test"))
+from superfasthash import SuperFastHash
+
+"""
+Latency of control messages while bulk transfers saturate the link.
+Victor Perron <victor@iso3103.net>
+
+    python bench/control_latency.py src/satan [samples]
+
+satan is started twice: with a single pair of sockets, then with the control
+lane. Each time, 1MB PUSH payloads and PULLs of a 16MB file are kept in flight
+while a TASKS command is sent every 100ms; the time until its MSGTASKS answer
+is reported, idle and under load.
+
+"""
+
+device_id = "latency"
+pub_endpoint = "tcp://localhost:10080"
+pull_endpoint = "tcp://localhost:10081"
+control_endpoint = "tcp://localhost:10082"
+control_answer_endpoint = "tcp://localhost:10083"
+bulk_file = "/tmp/control_latency.bin"
+payload = os.urandom(1024 * 1024)
+in_flight = 4
+
+def send_msg(socket, msg):
+    _sum = 0
+    for part in msg:
+        _sum = SuperFastHash(part, _sum)
+    msg.append(struct.pack('I', _sum))
+    socket.send_multipart(msg)
+
+def percentile(samples, p):
+    samples = sorted(samples)
+    return samples[min(len(samples) - 1, int(len(samples) * p / 100))]
+
+class Bench:
+
+    def __init__(self, binary, lanes):
+        self.context = zmq.Context()
+        self.pub = self.context.socket(zmq.XPUB) # to see the subscription come
+        self.pub.bind("tcp://*:10080")
+        self.pull = self.context.socket(zmq.PULL)
+        self.pull.bind("tcp://*:10081")
+        self.control = self.pub
+        self.control_answers = self.pull
+        args = [binary, "-s", pub_endpoint, "-p", pull_endpoint, "-u", device_id, "-S", "/tmp/latency.schedule"]
+        if lanes:
+            self.control = self.context.socket(zmq.XPUB)
+            self.control.bind("tcp://*:10082")
+            self.control_answers = self.context.socket(zmq.PULL)
+            self.control_answers.bind("tcp://*:10083")
+            args += ["-c", control_endpoint, "-C", control_answer_endpoint]
+        self.satan = subprocess.Popen(args, stdout=open(os.devnull, "w"))
+        for socket in set([self.pub, self.control]):
+            while socket.recv() != "\x01" + device_id:
+                pass
+        time.sleep(0.5) # Let the subscriptions settle
+        self.bulk = set()
+        self.sent = 0
+
+    def close(self):
+        self.satan.terminate()
+        self.satan.wait()
+        self.context.destroy(linger=0)
+
+    def feed(self):
+        while len(self.bulk) < in_flight:
+            msgid = uuid.uuid4().hex
+            if self.sent % 2:
+                send_msg(self.pub, [device_id, msgid, "PUSH", payload, "/tmp/control_latency.%d" % (self.sent % 4)])
+            else:
+                send_msg(self.pub, [device_id, msgid, "PULL", bulk_file])
+            self.bulk.add(msgid)
+            self.sent += 1
+
+    def drain(self, socket, msgid):
+        ans = socket.recv_multipart()
+        if ans[2] in ('MSGCOMPLETED', 'MSGEXECERROR') and ans[1] in self.bulk:
+            self.bulk.discard(ans[1])
+            return False
+        return ans[1] == msgid and ans[2] == 'MSGTASKS'
+
+    def sample(self, loaded):
+        msgid = uuid.uuid4().hex
+        start = time.time()
+        send_msg(self.control, [device_id, msgid, "TASKS"])
+        poller = zmq.Poller()
+        poller.register(self.pull, zmq.POLLIN)
+        if self.control_answers != self.pull:
+            poller.register(self.control_answers, zmq.POLLIN)
+        while True:
+            if loaded:
+                self.feed()
+            events = dict(poller.poll(1000))
+            done = False
+            for socket in events:
+                done = self.drain(socket, msgid) or done
+            if done:
+                return (time.time() - start) * 1000
+
+    def run(self, samples):
+        results = []
+        for loaded in (False, True):
+            latencies = []
+            for i in xrange(samples):
+                latencies.append(self.sample(loaded))
+                time.sleep(0.1)
+            results.append(latencies)
+        return results
+
+def main():
+    if len(sys.argv) < 2:
+        print "Usage: %s SATAN_BINARY [samples]" % sys.argv[0]
+        sys.exit(1)
+    binary = sys.argv[1]
+    samples = int(sys.argv[2]) if len(sys.argv) > 2 else 50
+
+    with open(bulk_file, "w") as f:
+        f.write(os.urandom(16 * 1024 * 1024))
+
+    print "%-14s %10s %10s %10s %10s" % ("TASKS, ms", "idle p50", "idle p99", "load p50", "load p99")
+    for lanes in (False, True):
+        bench = Bench(binary, lanes)
+        try:
+            idle, loaded = bench.run(samples)
+        finally:
+            bench.close()
+        print "%-14s %10.1f %10.1f %10.1f %10.1f" % ("control lane" if lanes else "single lane",
+            percentile(idle, 50), percentile(idle, 99), percentile(loaded, 50), percentile(loaded, 99))
+
+    os.remove(bulk_file)
+
+if __name__ == '__main__':
+    main()
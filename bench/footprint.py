@@ -0,0 +1,110 @@
+#! /usr/bin/python
+
+import os
+import sys
+import time
+import uuid
+import struct
+import subprocess
+import zmq
+
+sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "test"))
+from superfasthash import SuperFastHash
+
+"""
+Footprint of a satan build: binary size, startup time and memory under load.
+Victor Perron <victor@iso3103.net>
+
+Compare the default and the tiny (./configure --enable-tiny) profiles:
+
+    python bench/footprint.py src/satan [messages]
+
+The standard load is the given number (200 by default) of EXEC and 4KB PUSH
+messages, at most 16 of them in flight.
+
+"""
+
+device_id = "footprint"
+pub_endpoint = "tcp://localhost:10080"
+pull_endpoint = "tcp://localhost:10081"
+in_flight = 16
+payload = os.urandom(4096)
+
+def send_msg(socket, msg):
+    _sum = 0
+    for part in msg:
+        _sum = SuperFastHash(part, _sum)
+    msg.append(struct.pack('I', _sum))
+    socket.send_multipart(msg)
+
+def proc_status(pid, key):
+    with open("/proc/%d/status" % pid) as f:
+        for line in f:
+            if line.startswith(key + ":"):
+                return int(line.split()[1])
+    return 0
+
+def binary_size(path):
+    print "binary:        %d bytes" % os.path.getsize(path)
+    try:
+        out = subprocess.check_output(["size", path]).splitlines()[1].split()
+        print "text/data/bss: %s / %s / %s bytes" % (out[0], out[1], out[2])
+    except (OSError, subprocess.CalledProcessError):
+        pass
+
+def load(pub_socket, pull_socket, pid, count):
+    pending = set()
+    sent = 0
+    peak = 0
+    start = time.time()
+    while sent < count or pending:
+        while sent < count and len(pending) < in_flight:
+            msgid = uuid.uuid4().hex
+            if sent % 2:
+                send_msg(pub_socket, [device_id, msgid, "PUSH", payload, "/tmp/footprint.%d" % (sent % 8)])
+            else:
+                send_msg(pub_socket, [device_id, msgid, "EXEC", "echo %d" % sent])
+            pending.add(msgid)
+            sent += 1
+        ans = pull_socket.recv_multipart()
+        if ans[2] in ('MSGCOMPLETED', 'MSGEXECERROR', 'MSGBADCRC', 'MSGPARSEERROR'):
+            pending.discard(ans[1])
+        peak = max(peak, proc_status(pid, "VmRSS"))
+    return time.time() - start, peak
+
+def main():
+    if len(sys.argv) < 2:
+        print "Usage: %s SATAN_BINARY [messages]" % sys.argv[0]
+        sys.exit(1)
+    binary = sys.argv[1]
+    count = int(sys.argv[2]) if len(sys.argv) > 2 else 200
+
+    binary_size(binary)
+
+    context = zmq.Context()
+    pub_socket = context.socket(zmq.XPUB) # to see the subscription come
+    pub_socket.bind("tcp://*:10080")
+    pull_socket = context.socket(zmq.PULL)
+    pull_socket.bind("tcp://*:10081")
+
+    start = time.time()
+    satan = subprocess.Popen([binary, "-s", pub_endpoint, "-p", pull_endpoint, "-u", device_id,
+        "-S", "/tmp/footprint.schedule"], stdout=open(os.devnull, "w"))
+    try:
+        while True:
+            event = pub_socket.recv()
+            if event == "\x01" + device_id:
+                break
+        print "startup:       %.1f ms to the first subscription" % ((time.time() - start) * 1000)
+        time.sleep(0.5) # Let the subscription settle
+        print "idle RSS:      %d KB" % proc_status(satan.pid, "VmRSS")
+
+        elapsed, peak = load(pub_socket, pull_socket, satan.pid, count)
+        print "load:          %d messages in %.2f s" % (count, elapsed)
+        print "loaded RSS:    %d KB, high water mark %d KB" % (peak, proc_status(satan.pid, "VmHWM"))
+    finally:
+        satan.terminate()
+        satan.wait()
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,181 @@
+/**
+ * =====================================================================================
+ *
+ *   @file ioengine_bench.c
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  05/24/2013 03:17:50 PM
+ *
+ *   @section DESCRIPTION
+ *
+ *       I/O engine throughput benchmark.
+ *
+ *       Writes then reads back a file in the given directory, with a plain
+ *       write()/read() loop and with every available engine backend.
+ *       Run it once on a tmpfs and once on the flash filesystem:
+ *
+ *         ./ioengine_bench /tmp 64
+ *         ./ioengine_bench /overlay 16
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include "main.h"
+#include "ioengine.h"
+
+#include <errno.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+
+#define BENCH_ROUNDS 5
+
+static double s_now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int s_plain_write(const char *file_name, const uint8_t *data, size_t len)
+{
+  int fd = open(file_name, O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
+  if (fd < 0)
+    return STATUS_ERROR;
+
+  size_t done = 0;
+  while (done < len) {
+    ssize_t ret = write(fd, data + done, len - done);
+    if (ret <= 0)
+      break;
+    done += ret;
+  }
+  fdatasync(fd);
+  close(fd);
+  return done == len ? STATUS_OK : STATUS_ERROR;
+}
+
+static size_t s_plain_read(const char *file_name, uint8_t *buffer)
+{
+  size_t total = 0;
+  ssize_t ret;
+  int fd = open(file_name, O_RDONLY);
+
+  while ((ret = read(fd, buffer, IOENGINE_CHUNK_SIZE)) > 0)
+    total += ret;
+  close(fd);
+  return total;
+}
+
+static int s_engine_write(ioengine_t *engine, const char *file_name, const uint8_t *data, size_t len)
+{
+  int ret = ioengine_write_file(engine, file_name, data, len);
+  int fd = open(file_name, O_WRONLY);
+  fdatasync(fd);
+  close(fd);
+  return ret;
+}
+
+/*  Reads through the registered buffers, a whole batch per submission */
+static size_t s_engine_read(ioengine_t *engine, const char *file_name)
+{
+  ioengine_req reqs[IOENGINE_QUEUE_DEPTH];
+  uint64_t offset = 0;
+  size_t total = 0;
+  bool eof = false;
+  int i;
+
+  int fd = open(file_name, O_RDONLY);
+  while (!eof) {
+    for (i = 0; i < IOENGINE_QUEUE_DEPTH; i++) {
+      reqs[i].fd = fd;
+      reqs[i].buffer = ioengine_buffer(engine, i);
+      reqs[i].len = IOENGINE_CHUNK_SIZE;
+      reqs[i].offset = offset;
+      reqs[i].buffer_index = i;
+      offset += IOENGINE_CHUNK_SIZE;
+    }
+    ioengine_submit(engine, IOENGINE_OP_READ, reqs, IOENGINE_QUEUE_DEPTH);
+    for (i = 0; i < IOENGINE_QUEUE_DEPTH; i++) {
+      if (reqs[i].result <= 0) {
+        eof = true;
+        break;
+      }
+      total += reqs[i].result;
+    }
+  }
+  close(fd);
+  return total;
+}
+
+static void s_report(const char *name, const char *op, double seconds, size_t len)
+{
+  printf("%-8s %-6s %8.1f MB/s\n", name, op, len / seconds / (1024 * 1024));
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc < 2) {
+    errorLog("Usage: ioengine_bench DIRECTORY [SIZE_MB]");
+    return 1;
+  }
+
+  size_t len = (argc > 2 ? atoi(argv[2]) : 64) * 1024 * 1024;
+  char file_name[MAX_STRING_LEN];
+  snprintf(file_name, MAX_STRING_LEN, "%s/ioengine_bench.%d", argv[1], getpid());
+
+  uint8_t *data = malloc(len);
+  uint8_t *buffer = malloc(IOENGINE_CHUNK_SIZE);
+  size_t i;
+  for (i = 0; i < len; i++)
+    data[i] = i * 2654435761u >> 24;
+
+  const char *backends[] = { "plain", IOENGINE_THREADS, IOENGINE_URING };
+  int b, round;
+
+  printf("%zu MB in %s, %d rounds\n", len >> 20, argv[1], BENCH_ROUNDS);
+  for (b = 0; b < 3; b++) {
+    ioengine_t *engine = NULL;
+    if (b > 0) {
+      engine = ioengine_new(backends[b]);
+      if (engine == NULL || !str_equals(engine->name, backends[b])) {
+        printf("%-8s unavailable\n", backends[b]);
+        ioengine_destroy(&engine);
+        continue;
+      }
+    }
+
+    double write_time = 0, read_time = 0;
+    for (round = 0; round < BENCH_ROUNDS; round++) {
+      unlink(file_name);
+      double start = s_now();
+      int ret = engine ? s_engine_write(engine, file_name, data, len)
+        : s_plain_write(file_name, data, len);
+      write_time += s_now() - start;
+      assert(ret == STATUS_OK);
+
+      start = s_now();
+      size_t total = engine ? s_engine_read(engine, file_name)
+        : s_plain_read(file_name, buffer);
+      read_time += s_now() - start;
+      assert(total == len);
+    }
+    s_report(backends[b], "write", write_time / BENCH_ROUNDS, len);
+    s_report(backends[b], "read", read_time / BENCH_ROUNDS, len);
+
+    ioengine_destroy(&engine);
+  }
+
+  unlink(file_name);
+  free(buffer);
+  free(data);
+  return 0;
+}
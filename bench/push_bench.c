@@ -0,0 +1,181 @@
+/**
+ * =====================================================================================
+ *
+ *   @file push_bench.c
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  06/20/2013 04:12:37 PM
+ *
+ *   @section DESCRIPTION
+ *
+ *       PUSH payload benchmark.
+ *
+ *       Times, for a payload of the given size written into the given
+ *       directory: its checksum alone, its write alone, then a whole PUSH
+ *       summed first and written afterwards, as small payloads still are,
+ *       and a whole PUSH summed while written, as large ones are, with each
+ *       engine backend. The latter should take about the longest of the
+ *       first two rather than their sum, as long as writes wait on the device
+ *       or another core runs them; on a tmpfs and a single core both cost the
+ *       same:
+ *
+ *         ./push_bench /tmp 64
+ *         ./push_bench /overlay 16 crc32c
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include "main.h"
+#include "messages.h"
+#include "checksum.h"
+#include "utils.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#define BENCH_ROUNDS 5
+#define BENCH_MSGID  "push_bench"
+
+static double s_now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/*  The arguments of a PUSH into file_name, as the validators leave them */
+static zmsg_t *s_arguments(int algorithm, const uint8_t *data, size_t len, const char *file_name, bool deferred)
+{
+  uint8_t verify[MSG_PUSH_VERIFY_SIZE];
+  uint32_t sum = checksum_update(algorithm, 0, data, len);
+
+  verify[0] = algorithm;
+  utils_put32(verify + 1, 0);
+  utils_put32(verify + 5, checksum_update(algorithm, sum, (uint8_t*)file_name, strlen(file_name)));
+
+  zmsg_t *arguments = zmsg_new();
+  zmsg_addmem(arguments, verify, deferred ? sizeof(verify) : 0);
+  zmsg_addmem(arguments, data, len);
+  zmsg_addstr(arguments, "%s", file_name);
+  return arguments;
+}
+
+/*  Best of BENCH_ROUNDS, in seconds */
+static double s_push(ioengine_t *engine, int algorithm, const uint8_t *data, size_t len,
+    const char *file_name, bool deferred)
+{
+  double best = 0;
+  int round;
+
+  for (round = 0; round < BENCH_ROUNDS; round++) {
+    zmsg_t *arguments = s_arguments(algorithm, data, len, file_name, deferred);
+    unlink(file_name);
+
+    double start = s_now();
+    if (!deferred)
+      checksum_update(algorithm, 0, data, len); // by a validator
+    int ret = messages_push(engine, BENCH_MSGID, arguments);
+    double elapsed = s_now() - start;
+
+    assert(ret == MSG_ANSWER_COMPLETED);
+    zmsg_destroy(&arguments);
+    if (round == 0 || elapsed < best)
+      best = elapsed;
+  }
+  return best;
+}
+
+static double s_hash(int algorithm, const uint8_t *data, size_t len)
+{
+  double best = 0;
+  int round;
+
+  for (round = 0; round < BENCH_ROUNDS; round++) {
+    double start = s_now();
+    checksum_update(algorithm, 0, data, len);
+    double elapsed = s_now() - start;
+    if (round == 0 || elapsed < best)
+      best = elapsed;
+  }
+  return best;
+}
+
+static double s_write(ioengine_t *engine, const uint8_t *data, size_t len, const char *file_name)
+{
+  double best = 0;
+  int round;
+
+  for (round = 0; round < BENCH_ROUNDS; round++) {
+    unlink(file_name);
+    double start = s_now();
+    int ret = ioengine_write_file(engine, file_name, data, len);
+    double elapsed = s_now() - start;
+    assert(ret == STATUS_OK);
+    if (round == 0 || elapsed < best)
+      best = elapsed;
+  }
+  return best;
+}
+
+static void s_report(const char *name, double seconds)
+{
+  printf("  %-22s %10.1f ms\n", name, seconds * 1000);
+}
+
+int main(int argc, char *argv[])
+{
+  if (argc < 2) {
+    errorLog("Usage: push_bench DIRECTORY [SIZE_MB] [sfh|crc32c]");
+    return 1;
+  }
+
+  size_t len = (size_t)(argc > 2 ? atoi(argv[2]) : 64) * 1024 * 1024;
+  int algorithm = argc > 3 && str_equals(argv[3], "crc32c") ? CHECKSUM_CRC32C : CHECKSUM_SFH;
+  const char *backends[] = { IOENGINE_THREADS, IOENGINE_URING };
+  char file_name[MAX_STRING_LEN];
+  size_t i;
+  int b;
+
+  snprintf(file_name, MAX_STRING_LEN, "%s/push_bench.%d", argv[1], getpid());
+  checksum_init();
+
+  uint8_t *data = malloc(len);
+  assert(data);
+  for (i = 0; i < len; i++)
+    data[i] = i * 2654435761u >> 24;
+
+  printf("%zu MB PUSH in %s, %s checksum, best of %d rounds\n", len >> 20, argv[1],
+      algorithm == CHECKSUM_CRC32C ? "crc32c" : "superfasthash", BENCH_ROUNDS);
+  double hash_time = s_hash(algorithm, data, len);
+
+  for (b = 0; b < 2; b++) {
+    ioengine_t *engine = ioengine_new(backends[b]);
+    if (engine == NULL || !str_equals(engine->name, backends[b])) {
+      printf("%s: unavailable\n", backends[b]);
+      ioengine_destroy(&engine);
+      continue;
+    }
+
+    double write_time = s_write(engine, data, len, file_name);
+    printf("%s:\n", backends[b]);
+    s_report("checksum", hash_time);
+    s_report("write", write_time);
+    printf("  %-22s %10.1f ms, their sum %.1f ms\n", "longest of both",
+        (hash_time > write_time ? hash_time : write_time) * 1000, (hash_time + write_time) * 1000);
+    s_report("PUSH, summed first", s_push(engine, algorithm, data, len, file_name, false));
+    s_report("PUSH, summed in write", s_push(engine, algorithm, data, len, file_name, true));
+
+    ioengine_destroy(&engine);
+  }
+
+  unlink(file_name);
+  free(data);
+  return 0;
+}
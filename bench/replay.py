@@ -0,0 +1,199 @@
+#! /usr/bin/python
+
+import sys
+import time
+import struct
+import optparse
+import zmq
+
+"""
+Replay of a traffic capture against a running satan.
+Victor Perron <victor@iso3103.net>
+
+Record real traffic with satan -r FILE (or the satan.capture.file option),
+then play its commands again, at the recorded pace, N times faster or as fast
+as possible:
+
+    python bench/replay.py capture.bin             # 1x
+    python bench/replay.py --speed 10 capture.bin
+    python bench/replay.py --max capture.bin
+
+satan must be started with the uuid (and groups) of the recorded device:
+
+    satan -s tcp://localhost:10080 -p tcp://localhost:10081 -u <uuid>
+
+The answers are then compared to the recorded ones, message id by message id:
+the sequence of answer types must match, consecutive outputs and chunks
+counting as one since they are coalesced differently from one run to the
+other. The time from each command to its last answer is reported for both.
+
+"""
+
+pub_endpoint = "tcp://*:10080"
+pull_endpoint = "tcp://*:10081"
+final_answers = ('MSGCOMPLETED', 'MSGEXECERROR', 'MSGUNDEFERROR', 'MSGBADCRC', 'MSGPARSEERROR', 'MSGTASKS')
+stream_answers = ('MSGCMDOUTPUT', 'MSGCHUNK')
+CAPTURE_IN = 0
+CAPTURE_OUT = 1
+
+def read_capture(path):
+    """ (direction, seconds since start, frames) records; a truncated last one is ignored """
+    records = []
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:8] != "SATANCAP" or ord(data[8]) != 1:
+        raise ValueError("%s is not a satan capture" % path)
+    offset = 17
+    try:
+        while offset < len(data):
+            direction, when, count = struct.unpack_from('<BQI', data, offset)
+            offset += 13
+            frames = []
+            for i in xrange(count):
+                size, = struct.unpack_from('<I', data, offset)
+                offset += 4
+                if offset + size > len(data):
+                    raise struct.error("truncated")
+                frames.append(data[offset:offset + size])
+                offset += size
+            records.append((direction, when / 1e6, frames))
+    except struct.error:
+        pass
+    return records
+
+def answer_types(answers):
+    types = []
+    for frames in answers:
+        kind = frames[2] if len(frames) > 2 else '?'
+        if kind in stream_answers and types and types[-1] == kind:
+            continue
+        types.append(kind)
+    return types
+
+def percentile(samples, p):
+    if not samples:
+        return 0
+    samples = sorted(samples)
+    return samples[min(len(samples) - 1, int(len(samples) * p / 100))]
+
+def latencies(sent, answered):
+    return [(answered[msgid] - sent[msgid]) * 1000 for msgid in sent if msgid in answered]
+
+class Stream:
+    """ Answers and timings, by message id """
+
+    def __init__(self):
+        self.sent = {}
+        self.last = {}
+        self.answers = {}
+
+    def command(self, when, frames):
+        if len(frames) > 1:
+            self.sent.setdefault(frames[1], when)
+
+    def answer(self, when, frames):
+        if len(frames) < 3 or frames[1] == '':
+            return # heartbeats, batches and local events
+        self.answers.setdefault(frames[1], []).append(frames)
+        self.last[frames[1]] = when
+
+    def done(self):
+        for msgid in self.sent:
+            answers = self.answers.get(msgid)
+            if not answers or answers[-1][2] not in final_answers:
+                return False
+        return True
+
+def recorded_stream(records):
+    stream = Stream()
+    for direction, when, frames in records:
+        if direction == CAPTURE_IN:
+            stream.command(when, frames)
+        else:
+            stream.answer(when, frames)
+    return stream
+
+def replay(records, speed, timeout):
+    context = zmq.Context()
+    pub_socket = context.socket(zmq.XPUB) # to see the subscription come
+    pub_socket.setsockopt(zmq.SNDHWM, 0)
+    pub_socket.bind(pub_endpoint)
+    pull_socket = context.socket(zmq.PULL)
+    pull_socket.bind(pull_endpoint)
+
+    print "Waiting for satan to subscribe..."
+    while not pub_socket.recv().startswith("\x01"):
+        pass
+    time.sleep(0.5) # Let the subscription settle
+
+    stream = Stream()
+    commands = [(when, frames) for direction, when, frames in records if direction == CAPTURE_IN]
+    poller = zmq.Poller()
+    poller.register(pull_socket, zmq.POLLIN)
+    start = time.time()
+    first = commands[0][0] if commands else 0
+    index = 0
+    idle_since = time.time()
+
+    while index < len(commands) or not stream.done():
+        now = time.time()
+        while index < len(commands) and (speed == 0 or (commands[index][0] - first) / speed <= now - start):
+            stream.command(now - start, commands[index][1])
+            pub_socket.send_multipart(commands[index][1])
+            index += 1
+        wait = 100
+        if index < len(commands) and speed > 0:
+            wait = max(0, min(wait, int(((commands[index][0] - first) / speed - (now - start)) * 1000)))
+        if poller.poll(wait):
+            stream.answer(time.time() - start, pull_socket.recv_multipart())
+            idle_since = time.time()
+        elif index >= len(commands) and time.time() - idle_since > timeout:
+            print "No answer for %d s, giving up" % timeout
+            break
+
+    elapsed = time.time() - start
+    context.destroy(linger=0)
+    return stream, elapsed
+
+def compare(recorded, replayed, verbose):
+    differences = 0
+    for msgid in sorted(recorded.sent, key=lambda m: recorded.sent[m]):
+        before = answer_types(recorded.answers.get(msgid, []))
+        after = answer_types(replayed.answers.get(msgid, []))
+        if before != after:
+            differences += 1
+            if differences <= verbose:
+                print "  %s: %s -> %s" % (msgid, " ".join(before), " ".join(after))
+    return differences
+
+def main():
+    parser = optparse.OptionParser(usage="%prog [--speed N | --max] CAPTURE_FILE")
+    parser.add_option("--speed", type="float", default=1.0, help="pace of the replay, 1 for the recorded one")
+    parser.add_option("--max", action="store_true", help="send the commands as fast as possible")
+    parser.add_option("--timeout", type="int", default=10, help="seconds to wait for missing answers")
+    parser.add_option("--show", type="int", default=10, help="differences to print")
+    options, args = parser.parse_args()
+    if len(args) != 1:
+        parser.print_help()
+        sys.exit(1)
+
+    records = read_capture(args[0])
+    recorded = recorded_stream(records)
+    span = records[-1][1] - records[0][1] if records else 0
+    print "%d records, %d commands over %.1f s" % (len(records), len(recorded.sent), span)
+
+    replayed, elapsed = replay(records, 0 if options.max else options.speed, options.timeout)
+    differences = compare(recorded, replayed, options.show)
+
+    before = latencies(recorded.sent, recorded.last)
+    after = latencies(replayed.sent, replayed.last)
+    print "%-10s %10s %10s %10s %12s" % ("", "duration", "p50 ms", "p99 ms", "commands/s")
+    print "%-10s %9.1fs %10.1f %10.1f %12.1f" % ("recorded", span, percentile(before, 50), percentile(before, 99),
+        len(recorded.sent) / span if span > 0 else 0)
+    print "%-10s %9.1fs %10.1f %10.1f %12.1f" % ("replayed", elapsed, percentile(after, 50), percentile(after, 99),
+        len(replayed.sent) / elapsed if elapsed > 0 else 0)
+    print "%d of %d commands answered differently" % (differences, len(recorded.sent))
+    sys.exit(1 if differences else 0)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,139 @@
+/**
+ * =====================================================================================
+ *
+ *   @file spawn_bench.c
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  06/17/2013 02:20:06 PM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Task spawning benchmark.
+ *
+ *       Runs the same short command N times, one after the other, forked from
+ *       this process as satan did before the spawn helper, then through the
+ *       helper with and without a shell. The process first grows to the given
+ *       number of MB, touched, as the daemon does with its buffers; the helper
+ *       is started before that. Reports the time taken by the spawn call
+ *       itself (mean and 99th percentile) and tasks per second, output read
+ *       and exit status collected:
+ *
+ *         ./spawn_bench 1000 64
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include "main.h"
+#include "spawner.h"
+#include "utils.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#define BENCH_COMMAND "true"
+
+#define MODE_FORK     0
+#define MODE_SHELL    1
+#define MODE_DIRECT   2
+
+static double s_now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int s_compare(const void *a, const void *b)
+{
+  double x = *(const double*)a, y = *(const double*)b;
+  return x < y ? -1 : x > y;
+}
+
+/*  Until EOF, as tasks_read_output() would */
+static void s_drain(int fd)
+{
+  struct pollfd item = { fd, POLLIN, 0 };
+  char buffer[256];
+
+  while (poll(&item, 1, -1) >= 0 && read(fd, buffer, sizeof(buffer)) > 0)
+    ;
+  close(fd);
+}
+
+static void s_wait(spawner_t *spawner, int mode, pid_t pid)
+{
+  struct rusage usage;
+  pid_t done;
+  int status;
+
+  if (mode == MODE_FORK) {
+    waitpid(pid, &status, 0);
+    return;
+  }
+  do {
+    while (!spawner_reap(spawner, &done, &status, &usage))
+      usleep(10);
+  } while (done != pid);
+}
+
+static void s_run(spawner_t *spawner, int mode, int rounds)
+{
+  double *latencies = malloc(rounds * sizeof(double));
+  double total = 0, start = s_now();
+  int i;
+
+  assert(latencies);
+  for (i = 0; i < rounds; i++) {
+    int output_fd = -1;
+    uint32_t cgroup = 0;
+    double before = s_now();
+    pid_t pid = mode == MODE_FORK
+      ? utils_execute_task(BENCH_COMMAND, true, NULL, &output_fd, NULL)
+      : spawner_exec(spawner, BENCH_COMMAND, mode == MODE_SHELL, NULL, &output_fd, NULL, &cgroup);
+    latencies[i] = (s_now() - before) * 1e6;
+    total += latencies[i];
+    assert(pid > 0);
+
+    s_drain(output_fd);
+    s_wait(spawner, mode, pid);
+  }
+  double elapsed = s_now() - start;
+
+  qsort(latencies, rounds, sizeof(double), s_compare);
+  printf("%-22s %12.1f %12.1f %12.1f\n",
+      mode == MODE_FORK ? "fork, shell" : mode == MODE_SHELL ? "helper, shell" : "helper, no shell",
+      total / rounds, latencies[rounds * 99 / 100], rounds / elapsed);
+  free(latencies);
+}
+
+int main(int argc, char *argv[])
+{
+  int rounds = argc > 1 ? atoi(argv[1]) : 1000;
+  size_t rss = (size_t)(argc > 2 ? atoi(argv[2]) : 64) * 1024 * 1024;
+
+  spawner_t *spawner = spawner_new();
+  assert(spawner);
+
+  char *ballast = malloc(rss);
+  assert(ballast);
+  memset(ballast, 1, rss);
+
+  printf("%d spawns of '%s', %zu MB resident\n", rounds, BENCH_COMMAND, rss / (1024 * 1024));
+  printf("%-22s %12s %12s %12s\n", "", "spawn us", "p99 us", "tasks/s");
+  s_run(spawner, MODE_FORK, rounds);
+  s_run(spawner, MODE_SHELL, rounds);
+  s_run(spawner, MODE_DIRECT, rounds);
+
+  free(ballast);
+  spawner_destroy(&spawner);
+  return 0;
+}
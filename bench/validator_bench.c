@@ -0,0 +1,129 @@
+/**
+ * =====================================================================================
+ *
+ *   @file validator_bench.c
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  06/07/2013 04:18:05 PM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Validation threads scaling benchmark.
+ *
+ *       Pushes PUSH-like messages of the given payload size through 1 to
+ *       VALIDATOR_MAX validation threads, each message checksummed the way
+ *       the parser does it, and reports the messages per second for each
+ *       thread count. On a 4 cores box the rate should grow close to linearly
+ *       up to 4 threads:
+ *
+ *         ./validator_bench 64 20000
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include "main.h"
+#include "messages.h"
+#include "checksum.h"
+#include "validator.h"
+
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#define BENCH_DEPTH 64
+
+static double s_now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/*  Checksum every frame, like the message parser */
+static int s_parse(zmsg_t *message, char **msgid, uint8_t *command, zmsg_t **arguments)
+{
+  uint32_t sum = 0;
+  zframe_t *frame = zmsg_first(message);
+
+  while (frame != NULL) {
+    sum = checksum_update(CHECKSUM_SFH, sum, zframe_data(frame), zframe_size(frame));
+    frame = zmsg_next(message);
+  }
+
+  *msgid = NULL;
+  *command = MSG_COMMAND_PUSH;
+  *arguments = NULL;
+  return sum != 0 ? MSG_ANSWER_ACCEPTED : MSG_ANSWER_BADCRC;
+}
+
+static double s_run(int threads, const uint8_t *payload, size_t len, int count)
+{
+  validator_pool *pool = validator_new(threads, BENCH_DEPTH, s_parse);
+  int submitted = 0, collected = 0, in_flight = 0;
+  double start = s_now();
+
+  while (collected < count) {
+    while (submitted < count && in_flight < BENCH_DEPTH) {
+      zmsg_t *message = zmsg_new();
+      zmsg_addstr(message, "%s", "bench-device");
+      zmsg_addstr(message, "%08d", submitted);
+      zmsg_addstr(message, "%s", MSG_COMMAND_STR_PUSH);
+      zmsg_addmem(message, payload, len);
+      zmsg_addstr(message, "%s", "/tmp/bench");
+      if (!validator_submit(pool, &message)) {
+        zmsg_destroy(&message);
+        break;
+      }
+      submitted++;
+      in_flight++;
+    }
+
+    validated_t *validated = validator_next(pool, false);
+    if (validated == NULL) {
+      usleep(10);
+      continue;
+    }
+    validated_destroy(&validated);
+    collected++;
+    in_flight--;
+  }
+
+  double elapsed = s_now() - start;
+  validator_destroy(&pool);
+  return count / elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+  size_t len = (argc > 1 ? atoi(argv[1]) : 64) * 1024;
+  int count = argc > 2 ? atoi(argv[2]) : 20000;
+  uint8_t *payload = malloc(len);
+  double single = 0;
+  size_t i;
+  int threads;
+
+  assert(payload);
+  for (i = 0; i < len; i++)
+    payload[i] = i * 2654435761u >> 24;
+
+  checksum_init();
+  printf("%d messages, %zu KB payloads, %ld cores\n", count, len >> 10, sysconf(_SC_NPROCESSORS_ONLN));
+  printf("%-8s %14s %8s\n", "threads", "messages/s", "speedup");
+
+  for (threads = 1; threads <= VALIDATOR_MAX; threads *= 2) {
+    double rate = s_run(threads, payload, len, count);
+    if (threads == 1)
+      single = rate;
+    printf("%-8d %14.0f %7.2fx\n", threads, rate, rate / single);
+  }
+
+  free(payload);
+  return 0;
+}
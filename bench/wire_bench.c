@@ -0,0 +1,241 @@
+/**
+ * =====================================================================================
+ *
+ *   @file wire_bench.c
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  06/14/2013 03:47:12 PM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Wire formats benchmark.
+ *
+ *       For a few typical commands and answers, reports the bytes they take
+ *       on the wire (ZMTP framing included) in v1 and v2, and the time it
+ *       takes to decode the envelope of a command (message id, command and
+ *       checksum, as s_parse_message() does) or to encode an answer:
+ *
+ *         ./wire_bench 1000000
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include "main.h"
+#include "messages.h"
+#include "checksum.h"
+#include "superfasthash.h"
+#include "wire.h"
+
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+#define BENCH_UUID  "0123456789abcdef"
+#define BENCH_MSGID "0123456789abcdef0123456789abcdef"
+
+static const uint8_t s_msgid[WIRE_MSGID_SIZE] = {
+  0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef, 0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef
+};
+
+static double s_now(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+/*  Frames and their ZMTP headers: 2 bytes up to 255 bytes of data, 9 beyond */
+static size_t s_wire_size(zmsg_t *msg)
+{
+  size_t size = 0;
+  zframe_t *frame = zmsg_first(msg);
+  while (frame != NULL) {
+    size += zframe_size(frame) + (zframe_size(frame) < 256 ? 2 : 9);
+    frame = zmsg_next(msg);
+  }
+  return size;
+}
+
+static zmsg_t *s_command_v1(const char *command, const char *argument)
+{
+  zmsg_t *msg = zmsg_new();
+  uint32_t sum = 0;
+
+  zmsg_addstr(msg, "%s", BENCH_UUID);
+  zmsg_addstr(msg, "%s", BENCH_MSGID);
+  zmsg_addstr(msg, "%s", command);
+  zmsg_addstr(msg, "%s", argument);
+
+  zframe_t *frame = zmsg_first(msg);
+  while (frame != NULL) {
+    sum = checksum_update(CHECKSUM_SFH, sum, zframe_data(frame), zframe_size(frame));
+    frame = zmsg_next(msg);
+  }
+  zmsg_addmem(msg, &sum, sizeof(sum));
+  return msg;
+}
+
+static zmsg_t *s_command_v2(uint8_t opcode, const char *argument)
+{
+  zmsg_t *msg = zmsg_new();
+  uint8_t header[WIRE_HEADER_SIZE];
+
+  memset(header, 0, sizeof(header));
+  header[0] = WIRE_MAGIC;
+  header[1] = WIRE_VERSION;
+  header[WIRE_OPCODE] = opcode;
+  memcpy(header + WIRE_MSGID, s_msgid, WIRE_MSGID_SIZE);
+
+  uint32_t sum = checksum_update(CHECKSUM_SFH, 0, (uint8_t*)BENCH_UUID, strlen(BENCH_UUID));
+  sum = checksum_update(CHECKSUM_SFH, sum, header, WIRE_CHECKSUM);
+  sum = checksum_update(CHECKSUM_SFH, sum, (uint8_t*)argument, strlen(argument));
+  memcpy(header + WIRE_CHECKSUM, &sum, sizeof(sum));
+
+  zmsg_addstr(msg, "%s", BENCH_UUID);
+  zmsg_addmem(msg, header, sizeof(header));
+  zmsg_addstr(msg, "%s", argument);
+  return msg;
+}
+
+/*  Envelope of a v1 command, as parsed by s_parse_message() */
+static bool s_decode_v1(zmsg_t *msg)
+{
+  zmsg_t *copy = zmsg_dup(msg);
+  char *uuid = zmsg_popstr(copy);
+  char *msgid = zmsg_popstr(copy);
+  char *command = zmsg_popstr(copy);
+  uint32_t sum = checksum_update(CHECKSUM_SFH, 0, (uint8_t*)uuid, strlen(uuid));
+  sum = checksum_update(CHECKSUM_SFH, sum, (uint8_t*)msgid, strlen(msgid));
+  sum = checksum_update(CHECKSUM_SFH, sum, (uint8_t*)command, strlen(command));
+  uint8_t opcode = wire_command(command);
+
+  zframe_t *argument = zmsg_pop(copy);
+  sum = checksum_update(CHECKSUM_SFH, sum, zframe_data(argument), zframe_size(argument));
+  zframe_t *checksum = zmsg_pop(copy);
+  bool valid = opcode != 0 && strlen(msgid) >= 4 && get32bits(zframe_data(checksum)) == sum;
+
+  zframe_destroy(&checksum);
+  zframe_destroy(&argument);
+  free(command);
+  free(msgid);
+  free(uuid);
+  zmsg_destroy(&copy);
+  return valid;
+}
+
+/*  Same for v2 */
+static bool s_decode_v2(zmsg_t *msg)
+{
+  zmsg_t *copy = zmsg_dup(msg);
+  char *uuid = zmsg_popstr(copy);
+  zframe_t *header = zmsg_pop(copy);
+  bool valid = wire_header_valid(header);
+  const uint8_t *data = zframe_data(header);
+  char *msgid = wire_msgid(data + WIRE_MSGID);
+  uint32_t sum = checksum_update(CHECKSUM_SFH, 0, (uint8_t*)uuid, strlen(uuid));
+  sum = checksum_update(CHECKSUM_SFH, sum, data, WIRE_CHECKSUM);
+
+  zframe_t *argument = zmsg_pop(copy);
+  sum = checksum_update(CHECKSUM_SFH, sum, zframe_data(argument), zframe_size(argument));
+  valid = valid && data[WIRE_OPCODE] != 0 && get32bits(data + WIRE_CHECKSUM) == sum;
+
+  zframe_destroy(&argument);
+  free(msgid);
+  zframe_destroy(&header);
+  free(uuid);
+  zmsg_destroy(&copy);
+  return valid;
+}
+
+static zmsg_t *s_answer(const char *msgid, const char *answer, const char *data)
+{
+  zmsg_t *msg = zmsg_new();
+  zmsg_addstr(msg, "%s", BENCH_UUID);
+  zmsg_addstr(msg, "%s", msgid);
+  zmsg_addstr(msg, "%s", answer);
+  if (data != NULL)
+    zmsg_addstr(msg, "%s", data);
+  return msg;
+}
+
+static double s_decode_ns(bool (*decode)(zmsg_t*), zmsg_t *msg, int rounds)
+{
+  double start = s_now();
+  int i, valid = 0;
+  for (i = 0; i < rounds; i++)
+    valid += decode(msg);
+  assert(valid == rounds);
+  return (s_now() - start) * 1e9 / rounds;
+}
+
+int main(int argc, char *argv[])
+{
+  int rounds = argc > 1 ? atoi(argv[1]) : 1000000;
+  char output[101];
+  int i;
+
+  checksum_init();
+  memset(output, 'x', 100);
+  output[100] = 0;
+
+  printf("%-22s %10s %10s %12s %12s\n", "command", "v1 bytes", "v2 bytes", "v1 ns/op", "v2 ns/op");
+
+  const struct { const char *name; uint8_t opcode; const char *argument; } commands[] = {
+    { MSG_COMMAND_STR_EXEC, MSG_COMMAND_EXEC, "uptime" },
+    { MSG_COMMAND_STR_PULL, MSG_COMMAND_PULL, "/etc/config/network" },
+    { MSG_COMMAND_STR_STDIN, MSG_COMMAND_STDIN, output },
+  };
+  for (i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+    zmsg_t *v1 = s_command_v1(commands[i].name, commands[i].argument);
+    zmsg_t *v2 = s_command_v2(commands[i].opcode, commands[i].argument);
+    printf("%-22s %10zu %10zu %12.1f %12.1f\n", commands[i].name, s_wire_size(v1), s_wire_size(v2),
+        s_decode_ns(s_decode_v1, v1, rounds), s_decode_ns(s_decode_v2, v2, rounds));
+    zmsg_destroy(&v2);
+    zmsg_destroy(&v1);
+  }
+
+  printf("\n%-22s %10s %10s %12s\n", "answer", "v1 bytes", "v2 bytes", "encode ns/op");
+
+  char *msgid = wire_msgid(s_msgid);
+  const struct { const char *name; const char *data; } answers[] = {
+    { MSG_ANSWER_STR_ACCEPTED, NULL },
+    { MSG_ANSWER_STR_COMPLETED, NULL },
+    { MSG_ANSWER_STR_CMDOUTPUT, output },
+  };
+  for (i = 0; i < sizeof(answers) / sizeof(answers[0]); i++) {
+    zmsg_t *v1 = s_answer(BENCH_MSGID, answers[i].name, answers[i].data);
+    zmsg_t *v2 = s_answer(msgid, answers[i].name, answers[i].data);
+    wire_encode(v2);
+    zmsg_first(v2);
+    assert(wire_header_valid(zmsg_next(v2)));
+
+    double start = s_now();
+    int round;
+    for (round = 0; round < rounds; round++) {
+      zmsg_t *answer = s_answer(msgid, answers[i].name, answers[i].data);
+      wire_encode(answer);
+      zmsg_destroy(&answer);
+    }
+    double encode = (s_now() - start) * 1e9 / rounds;
+
+    start = s_now();
+    for (round = 0; round < rounds; round++) {
+      zmsg_t *answer = s_answer(msgid, answers[i].name, answers[i].data);
+      zmsg_destroy(&answer);
+    }
+    encode -= (s_now() - start) * 1e9 / rounds; // building it is not encoding
+
+    printf("%-22s %10zu %10zu %12.1f\n", answers[i].name, s_wire_size(v1), s_wire_size(v2), encode);
+    zmsg_destroy(&v2);
+    zmsg_destroy(&v1);
+  }
+  free(msgid);
+
+  return 0;
+}
@@ -0,0 +1,44 @@
+#!/usr/bin/env python
+
+import zmq
+import sys
+import uuid
+import struct
+from superfasthash import SuperFastHash
+from time import sleep
+
+"""
+Tiny sample controller for satan daemons running in dealer mode
+(satan -t dealer): commands are routed to a single device by its uuid,
+answers come back on the same socket.
+
+Example:
+
+    ./satan_router.py my_uid EXEC 'ps'
+
+"""
+
+def hash_msg(msg):
+    _sum = 0
+    for part in msg:
+        _sum = SuperFastHash(part, _sum)
+    return struct.pack('I', _sum)
+
+def gen_uuid():
+    return uuid.uuid4().hex
+
+context = zmq.Context()
+socket = context.socket(zmq.ROUTER)
+socket.bind ("tcp://*:10080")
+sleep(1) # Let the devices connect
+
+msgid = gen_uuid()
+msg = [ sys.argv[1], msgid ] + sys.argv[2:]
+msg.append(hash_msg(msg))
+socket.send_multipart([ sys.argv[1] ] + msg)
+
+while True:
+    ans = socket.recv_multipart()
+    print ans[1:]
+    if ans[3] in ('MSGCOMPLETED', 'MSGEXECERROR', 'MSGPARSEERROR', 'MSGBADCRC'):
+        break
@@ -0,0 +1,352 @@
+/**
+ * =====================================================================================
+ *
+ *   @file archive.c
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  05/28/2013 05:14:20 PM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Streamed tar archives of directory trees.
+ *
+ *       The tree is walked lazily while the archive is read: only the open
+ *       directories of the current path, the current file and one tar block
+ *       are kept in memory, whatever the size of the tree. The stream is a
+ *       POSIX ustar archive, optionally gzip-compressed through zlib.
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include "platform.h"
+#include "main.h"
+#include "archive.h"
+
+#include <errno.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <libgen.h>
+#include <sys/stat.h>
+
+#ifdef SATAN_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#define ARCHIVE_BLOCK_SIZE 512
+#define ARCHIVE_ZBUFFER    (16*1024)
+
+typedef struct s_archive_dir_t {
+  DIR *dir;
+  char *path;               // on the filesystem
+  char *name;               // in the archive
+} archive_dir;
+
+struct s_archive_t {
+  archive_dir stack[ARCHIVE_MAX_DEPTH];
+  int depth;
+  char *root_path;
+  char *root_name;
+  bool started;             // the root entry has been emitted
+  bool ended;               // the trailer has been emitted
+  uint8_t block[ARCHIVE_BLOCK_SIZE];
+  size_t block_pos;         // ARCHIVE_BLOCK_SIZE when the block is consumed
+  int fd;                   // current file
+  uint64_t remaining;       // bytes of the current file still to copy
+  uint64_t zeros;           // padding to emit after the file data
+#ifdef SATAN_HAVE_ZLIB
+  bool compress;
+  bool raw_ended;
+  bool zlib_ended;
+  z_stream zs;
+  uint8_t *zbuffer;
+#endif
+};
+
+static void s_octal(char *field, size_t len, uint64_t value)
+{
+  snprintf(field, len, "%0*llo", (int)len - 1, (unsigned long long)value);
+}
+
+/*  Fill the ustar header block, STATUS_ERROR if the name does not fit */
+static int s_header(archive_t *self, const char *name, struct stat *st, char type, const char *link)
+{
+  char *block = (char*)self->block;
+  size_t len = strlen(name);
+  unsigned int sum = 0;
+  int i;
+
+  memset(block, 0, ARCHIVE_BLOCK_SIZE);
+
+  if (len <= 100) {
+    memcpy(block, name, len);
+  } else {
+    /*  Split at a slash into the 155 bytes prefix and the 100 bytes name */
+    const char *slash = name + len - 101;
+    while (*slash != 0 && *slash != '/')
+      slash++;
+    if (*slash == 0 || slash - name > 155 || slash[1] == 0)
+      return STATUS_ERROR;
+    memcpy(block + 345, name, slash - name);
+    memcpy(block, slash + 1, len - (slash - name) - 1);
+  }
+
+  if (link != NULL && strlen(link) > 100)
+    return STATUS_ERROR;
+
+  s_octal(block + 100, 8, st->st_mode & 07777);
+  s_octal(block + 108, 8, st->st_uid);
+  s_octal(block + 116, 8, st->st_gid);
+  s_octal(block + 124, 12, type == '0' ? st->st_size : 0);
+  s_octal(block + 136, 12, st->st_mtime);
+  block[156] = type;
+  if (link != NULL)
+    memcpy(block + 157, link, strlen(link));
+  memcpy(block + 257, "ustar", 6);
+  memcpy(block + 263, "00", 2);
+
+  memset(block + 148, ' ', 8);
+  for (i = 0; i < ARCHIVE_BLOCK_SIZE; i++)
+    sum += self->block[i];
+  snprintf(block + 148, 8, "%06o", sum);
+
+  self->block_pos = 0;
+  return STATUS_OK;
+}
+
+static void s_push_dir(archive_t *self, const char *path, const char *name)
+{
+  if (self->depth == ARCHIVE_MAX_DEPTH) {
+    errorLog("%s: too deep, not archived", path);
+    return;
+  }
+
+  DIR *dir = opendir(path);
+  if (dir == NULL)
+    return;
+
+  archive_dir *frame = &self->stack[self->depth++];
+  frame->dir = dir;
+  frame->path = strdup(path);
+  frame->name = strdup(name);
+}
+
+static void s_pop_dir(archive_t *self)
+{
+  archive_dir *frame = &self->stack[--self->depth];
+  closedir(frame->dir);
+  free(frame->path);
+  free(frame->name);
+}
+
+/*  Emit the header of the next entry, or the trailer at the end of the tree */
+static void s_next_entry(archive_t *self)
+{
+  char path[PATH_MAX], name[PATH_MAX], link[PATH_MAX];
+  struct stat st;
+
+  if (!self->started) {
+    self->started = true;
+    if (lstat(self->root_path, &st) == 0) {
+      snprintf(name, PATH_MAX, "%s/", self->root_name);
+      if (s_header(self, name, &st, '5', NULL) == STATUS_OK)
+        s_push_dir(self, self->root_path, self->root_name);
+      return;
+    }
+  }
+
+  while (self->depth > 0) {
+    archive_dir *frame = &self->stack[self->depth - 1];
+    struct dirent *entry = readdir(frame->dir);
+
+    if (entry == NULL) {
+      s_pop_dir(self);
+      continue;
+    }
+    if (str_equals(entry->d_name, ".") || str_equals(entry->d_name, ".."))
+      continue;
+
+    snprintf(path, PATH_MAX, "%s/%s", frame->path, entry->d_name);
+    if (lstat(path, &st) != 0)
+      continue;
+
+    if (S_ISDIR(st.st_mode)) {
+      snprintf(name, PATH_MAX, "%s/%s/", frame->name, entry->d_name);
+      if (s_header(self, name, &st, '5', NULL) != STATUS_OK)
+        continue;
+      name[strlen(name) - 1] = 0;
+      s_push_dir(self, path, name);
+      return;
+    } else if (S_ISREG(st.st_mode)) {
+      snprintf(name, PATH_MAX, "%s/%s", frame->name, entry->d_name);
+      int fd = open(path, O_RDONLY | O_CLOEXEC);
+      if (fd < 0)
+        continue;
+      if (s_header(self, name, &st, '0', NULL) != STATUS_OK) {
+        close(fd);
+        continue;
+      }
+      self->fd = fd;
+      self->remaining = st.st_size;
+      self->zeros = (ARCHIVE_BLOCK_SIZE - st.st_size % ARCHIVE_BLOCK_SIZE) % ARCHIVE_BLOCK_SIZE;
+      return;
+    } else if (S_ISLNK(st.st_mode)) {
+      ssize_t len = readlink(path, link, PATH_MAX - 1);
+      if (len < 0)
+        continue;
+      link[len] = 0;
+      snprintf(name, PATH_MAX, "%s/%s", frame->name, entry->d_name);
+      if (s_header(self, name, &st, '2', link) != STATUS_OK)
+        continue;
+      return;
+    }
+  }
+
+  /*  End of archive: two zero blocks */
+  self->zeros = 2 * ARCHIVE_BLOCK_SIZE;
+  self->ended = true;
+}
+
+/*  Uncompressed tar stream, short only at the end of the archive */
+static ssize_t s_raw_read(archive_t *self, uint8_t *buffer, size_t len)
+{
+  size_t done = 0;
+
+  while (done < len) {
+    size_t want = len - done;
+
+    if (self->block_pos < ARCHIVE_BLOCK_SIZE) {
+      size_t size = ARCHIVE_BLOCK_SIZE - self->block_pos;
+      if (size > want)
+        size = want;
+      memcpy(buffer + done, self->block + self->block_pos, size);
+      self->block_pos += size;
+      done += size;
+    } else if (self->remaining > 0) {
+      ssize_t size = read(self->fd, buffer + done, want < self->remaining ? want : self->remaining);
+      if (size <= 0) {
+        /*  The file shrunk: pad it up to the size announced in its header */
+        self->zeros += self->remaining;
+        self->remaining = 0;
+      } else {
+        self->remaining -= size;
+        done += size;
+      }
+      if (self->remaining == 0) {
+        close(self->fd);
+        self->fd = -1;
+      }
+    } else if (self->zeros > 0) {
+      size_t size = want < self->zeros ? want : self->zeros;
+      memset(buffer + done, 0, size);
+      self->zeros -= size;
+      done += size;
+    } else if (self->ended) {
+      break;
+    } else {
+      s_next_entry(self);
+    }
+  }
+
+  return done;
+}
+
+archive_t *archive_new(const char *path, bool compress)
+{
+  assert(path);
+
+#ifndef SATAN_HAVE_ZLIB
+  if (compress) {
+    errorLog("Compression is not available");
+    return NULL;
+  }
+#endif
+
+  archive_t *self = calloc(1, sizeof(archive_t));
+  assert(self);
+
+  char *copy = strdup(path);
+  self->root_path = strdup(path);
+  self->root_name = strdup(basename(copy));
+  free(copy);
+  self->block_pos = ARCHIVE_BLOCK_SIZE;
+  self->fd = -1;
+
+#ifdef SATAN_HAVE_ZLIB
+  self->compress = compress;
+  if (compress) {
+    self->zbuffer = malloc(ARCHIVE_ZBUFFER);
+    /*  15 bits window, +16 for a gzip wrapper; small memLevel for small routers */
+    if (self->zbuffer == NULL ||
+        deflateInit2(&self->zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 6, Z_DEFAULT_STRATEGY) != Z_OK) {
+      free(self->zbuffer);
+      self->compress = false;
+      archive_destroy(&self);
+      return NULL;
+    }
+  }
+#endif
+
+  return self;
+}
+
+void archive_destroy(archive_t **self)
+{
+  assert(self);
+
+  if (*self) {
+    while ((*self)->depth > 0)
+      s_pop_dir(*self);
+    if ((*self)->fd != -1)
+      close((*self)->fd);
+#ifdef SATAN_HAVE_ZLIB
+    if ((*self)->compress) {
+      deflateEnd(&(*self)->zs);
+      free((*self)->zbuffer);
+    }
+#endif
+    free((*self)->root_path);
+    free((*self)->root_name);
+    free(*self);
+    *self = NULL;
+  }
+}
+
+ssize_t archive_read(archive_t *self, uint8_t *buffer, size_t len)
+{
+  assert(self);
+  assert(buffer);
+
+#ifdef SATAN_HAVE_ZLIB
+  if (self->compress) {
+    self->zs.next_out = buffer;
+    self->zs.avail_out = len;
+
+    while (self->zs.avail_out > 0 && !self->zlib_ended) {
+      if (self->zs.avail_in == 0 && !self->raw_ended) {
+        ssize_t size = s_raw_read(self, self->zbuffer, ARCHIVE_ZBUFFER);
+        self->zs.next_in = self->zbuffer;
+        self->zs.avail_in = size;
+        self->raw_ended = size < ARCHIVE_ZBUFFER;
+      }
+
+      int ret = deflate(&self->zs, self->raw_ended ? Z_FINISH : Z_NO_FLUSH);
+      if (ret == Z_STREAM_END)
+        self->zlib_ended = true;
+      else if (ret != Z_OK && ret != Z_BUF_ERROR)
+        return -1;
+    }
+
+    return len - self->zs.avail_out;
+  }
+#endif
+
+  return s_raw_read(self, buffer, len);
+}
@@ -0,0 +1,43 @@
+/**
+ * =====================================================================================
+ *
+ *   @file archive.h
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  05/28/2013 05:06:41 PM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Streamed tar archives of directory trees
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#ifndef _SATAN_ARCHIVE_H_
+#define _SATAN_ARCHIVE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct s_archive_t archive_t;
+
+archive_t *archive_new(const char *path, bool compress);
+void archive_destroy(archive_t **self);
+
+ssize_t archive_read(archive_t *self, uint8_t *buffer, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _SATAN_ARCHIVE_H_
@@ -0,0 +1,205 @@
+/**
+ * =====================================================================================
+ *
+ *   @file cache.c
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  06/04/2013 03:30:46 PM
+ *
+ *   @section DESCRIPTION
+ *
+ *       EXEC results cache.
+ *
+ *       An EXEC with a TTL first looks its command up here. A fresh result is
+ *       replayed without forking anything. A command still running for
+ *       another message gets the message id queued as a waiter; the waiters
+ *       get the output of that single run when it is over. Otherwise the
+ *       command runs with its output captured, and a successful result is
+ *       kept for its TTL, as long as it fits in the memory budget: the oldest
+ *       results are evicted first.
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include "main.h"
+#include "cache.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+
+static cache_entry *s_find(result_cache *self, const char *command)
+{
+  return zhash_lookup(self->index, command);
+}
+
+static void s_remove(result_cache *self, cache_entry *entry)
+{
+  char *msgid = NULL;
+
+  zlist_remove(self->entries, entry);
+  zhash_delete(self->index, entry->command);
+  self->bytes -= entry->len;
+  while ((msgid = zlist_pop(entry->waiters)) != NULL)
+    free(msgid);
+  zlist_destroy(&entry->waiters);
+  free(entry->output);
+  free(entry->command);
+  free(entry);
+}
+
+/*  Make room for len more bytes, expired entries first, then the oldest ones */
+static void s_evict(result_cache *self, size_t len)
+{
+  int64_t now = zclock_time();
+  bool expired_only = true;
+
+  while (self->bytes + len > self->budget) {
+    cache_entry *victim = zlist_first(self->entries);
+    while (victim != NULL && (victim->running || (expired_only && victim->expires > now)))
+      victim = zlist_next(self->entries);
+
+    if (victim != NULL)
+      s_remove(self, victim);
+    else if (expired_only)
+      expired_only = false;
+    else
+      break;
+  }
+}
+
+result_cache *cache_new(size_t budget)
+{
+  result_cache *self = malloc(sizeof(result_cache));
+  assert(self);
+
+  self->entries = zlist_new();
+  self->index = zhash_new();
+  self->bytes = 0;
+  self->budget = budget;
+
+  return self;
+}
+
+void cache_destroy(result_cache **self)
+{
+  assert(self);
+
+  if (*self) {
+    cache_entry *entry = NULL;
+    while ((entry = zlist_first((*self)->entries)) != NULL)
+      s_remove(*self, entry);
+    zlist_destroy(&(*self)->entries);
+    zhash_destroy(&(*self)->index);
+    free(*self);
+    *self = NULL;
+  }
+}
+
+/*  Running or fresh entry for the command, NULL if it has to be run */
+cache_entry *cache_lookup(result_cache *self, const char *command)
+{
+  assert(self);
+  assert(command);
+
+  cache_entry *entry = s_find(self, command);
+  if (entry != NULL && !entry->running && zclock_time() >= entry->expires) {
+    s_remove(self, entry);
+    return NULL;
+  }
+  return entry;
+}
+
+/*  The command is about to run, with its output captured */
+void cache_start(result_cache *self, const char *command, int64_t ttl)
+{
+  assert(self);
+  assert(command);
+
+  cache_entry *entry = calloc(1, sizeof(cache_entry));
+  assert(entry);
+
+  entry->command = strdup(command);
+  entry->ttl = ttl;
+  entry->running = true;
+  entry->waiters = zlist_new();
+  zlist_append(self->entries, entry);
+  zhash_insert(self->index, entry->command, entry);
+}
+
+void cache_wait(cache_entry *entry, const char *msgid)
+{
+  assert(entry);
+  assert(msgid);
+
+  zlist_append(entry->waiters, strdup(msgid));
+}
+
+/*  A waiter gets the status and accounting of the run it shared. Without the
+ *  whole output, it is only told that the run failed. */
+static void s_share(process_item *replay, process_item *run)
+{
+  replay->status = run->status;
+  replay->usage = run->usage;
+  replay->started_at = run->started_at;
+  replay->exited_at = run->exited_at;
+  replay->timed_out = run->timed_out;
+  replay->failed = run->failed || run->capture_overflow;
+  replay->accounted = true;
+}
+
+/*  Share the output of the captured commands that are over, and keep it */
+void cache_collect(result_cache *self, task_table *tasks, const char *device_id)
+{
+  assert(self);
+  assert(tasks);
+
+  /*  Replays add tasks to the table, do not walk it meanwhile */
+  zlist_t *done = zlist_new();
+  process_item *item = zlist_first(tasks->items);
+  while (item != NULL) {
+    if (item->capture != NULL && item->exited && item->output_fd == -1 && !item->finished)
+      zlist_append(done, item);
+    item = zlist_next(tasks->items);
+  }
+
+  while ((item = zlist_pop(done)) != NULL) {
+    cache_entry *entry = s_find(self, item->command);
+    char *msgid = NULL;
+
+    if (entry != NULL && entry->running) {
+      while ((msgid = zlist_pop(entry->waiters)) != NULL) {
+        tasks->reserved--;
+        process_item *replay = tasks_replay(tasks, msgid, item->command, item->capture,
+            item->capture_overflow ? 0 : item->capture_len, device_id);
+        if (replay != NULL)
+          s_share(replay, item);
+        free(msgid);
+      }
+
+      bool success = !item->capture_overflow && !item->failed
+        && WIFEXITED(item->status) && WEXITSTATUS(item->status) == 0;
+
+      if (success && item->capture_len <= self->budget) {
+        s_evict(self, item->capture_len);
+        entry->output = item->capture;
+        entry->len = item->capture_len;
+        entry->expires = zclock_time() + entry->ttl;
+        entry->running = false;
+        self->bytes += entry->len;
+        item->capture = NULL;
+      } else {
+        s_remove(self, entry);
+      }
+    }
+
+    free(item->capture);
+    item->capture = NULL;
+  }
+  zlist_destroy(&done);
+}
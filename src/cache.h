@@ -0,0 +1,60 @@
+/**
+ * =====================================================================================
+ *
+ *   @file cache.h
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  06/04/2013 03:22:18 PM
+ *
+ *   @section DESCRIPTION
+ *
+ *       EXEC results cache, with in-flight requests coalescing
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include <czmq.h>
+#include "tasks.h"
+
+#ifndef _SATAN_CACHE_H_
+#define _SATAN_CACHE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct s_cache_entry_t {
+  char *command;
+  uint8_t *output;
+  size_t len;
+  int64_t ttl;              // ms
+  int64_t expires;          // valid once the command is over
+  bool running;             // the result is still being produced
+  zlist_t *waiters;         // message ids sharing the running command
+} cache_entry;
+
+typedef struct s_result_cache_t {
+  zlist_t *entries;         // oldest first
+  zhash_t *index;           // command -> entry
+  size_t bytes;             // cached output, all entries included
+  size_t budget;
+} result_cache;
+
+result_cache *cache_new(size_t budget);
+void cache_destroy(result_cache **self);
+
+cache_entry *cache_lookup(result_cache *self, const char *command);
+void cache_start(result_cache *self, const char *command, int64_t ttl);
+void cache_wait(cache_entry *entry, const char *msgid);
+void cache_collect(result_cache *self, task_table *tasks, const char *device_id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _SATAN_CACHE_H_
@@ -0,0 +1,120 @@
+/**
+ * =====================================================================================
+ *
+ *   @file capture.c
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  06/13/2013 09:31:47 AM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Traffic capture.
+ *
+ *       Every command received and every answer sent is appended to a capture
+ *       file, with its frames and a timestamp, for bench/replay.py to play the
+ *       same command mix against another build. All integers are little-endian:
+ *
+ *         header: 'SATANCAP', version (1 byte), start time (8 bytes, UNIX us)
+ *         record: direction (1 byte), time since start (8 bytes, us),
+ *                 frame count (4 bytes), then every frame as its size
+ *                 (4 bytes) and data
+ *
+ *       Records are buffered; the file may end with a truncated one.
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include "main.h"
+#include "capture.h"
+#include "utils.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <sys/time.h>
+
+static int64_t s_now_us(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+capture_t *capture_new(const char *path, uint64_t max)
+{
+  assert(path);
+
+  FILE *file = fopen(path, "w");
+  if (file == NULL) {
+    errorLog("Cannot open capture file %s", path);
+    return NULL;
+  }
+
+  capture_t *self = calloc(1, sizeof(capture_t));
+  assert(self);
+
+  self->file = file;
+  self->start = s_now_us();
+  self->max = max;
+  pthread_mutex_init(&self->lock, NULL);
+
+  uint8_t header[17];
+  memcpy(header, CAPTURE_MAGIC, 8);
+  header[8] = CAPTURE_VERSION;
+  utils_put64(header + 9, (uint64_t)self->start);
+  fwrite(header, 1, sizeof(header), self->file);
+  self->bytes = sizeof(header);
+
+  debugLog("Capturing traffic to %s", path);
+  return self;
+}
+
+void capture_destroy(capture_t **self)
+{
+  assert(self);
+
+  if (*self) {
+    fclose((*self)->file);
+    pthread_mutex_destroy(&(*self)->lock);
+    free(*self);
+    *self = NULL;
+  }
+}
+
+void capture_record(capture_t *self, int direction, zmsg_t *msg)
+{
+  assert(self);
+  assert(msg);
+
+  uint8_t header[13];
+  uint64_t size = sizeof(header) + 4 * zmsg_size(msg) + zmsg_content_size(msg);
+
+  header[0] = direction;
+  utils_put64(header + 1, (uint64_t)(s_now_us() - self->start));
+  utils_put32(header + 9, (uint32_t)zmsg_size(msg));
+
+  pthread_mutex_lock(&self->lock);
+
+  if (self->max == 0 || self->bytes + size <= self->max) {
+    fwrite(header, 1, sizeof(header), self->file);
+
+    zframe_t *frame = zmsg_first(msg);
+    while (frame != NULL) {
+      uint8_t len[4];
+      utils_put32(len, (uint32_t)zframe_size(frame));
+      fwrite(len, 1, sizeof(len), self->file);
+      fwrite(zframe_data(frame), 1, zframe_size(frame), self->file);
+      frame = zmsg_next(msg);
+    }
+    self->bytes += size;
+  } else if (self->bytes < self->max) {
+    errorLog("Capture file full, recording stopped");
+    self->bytes = self->max;
+  }
+
+  pthread_mutex_unlock(&self->lock);
+}
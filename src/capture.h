@@ -0,0 +1,54 @@
+/**
+ * =====================================================================================
+ *
+ *   @file capture.h
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  06/13/2013 09:31:47 AM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Traffic capture, for replays
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include <czmq.h>
+#include <pthread.h>
+
+#ifndef _SATAN_CAPTURE_H_
+#define _SATAN_CAPTURE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CAPTURE_MAGIC   "SATANCAP"
+#define CAPTURE_VERSION 1
+
+#define CAPTURE_IN      0x00  // command received
+#define CAPTURE_OUT     0x01  // answer sent
+
+typedef struct s_capture_t {
+  FILE *file;
+  pthread_mutex_t lock;     // commands are received on two threads
+  int64_t start;            // us, UNIX time
+  uint64_t bytes;           // written so far
+  uint64_t max;             // recording stops beyond it, 0 for unlimited
+} capture_t;
+
+capture_t *capture_new(const char *path, uint64_t max);
+void capture_destroy(capture_t **self);
+
+void capture_record(capture_t *self, int direction, zmsg_t *msg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _SATAN_CAPTURE_H_
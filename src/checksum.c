@@ -0,0 +1,238 @@
+/**
+ * =====================================================================================
+ *
+ *   @file checksum.c
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  06/06/2013 09:55:21 AM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Message checksums.
+ *
+ *       SuperFastHash stays the default. CRC32C (Castagnoli) is the negotiated
+ *       alternative: it is computed by the SSE4.2 crc32 instruction on x86, by
+ *       the ARMv8 CRC extension on arm64, and by a portable slicing-by-8 table
+ *       otherwise. The implementation is picked once, at checksum_init(),
+ *       from the features of the CPU we run on rather than the one we were
+ *       built for.
+ *
+ *       Both are chained over the message frames the same way: the sum of
+ *       the previous frames is passed along with the next one. A frame may
+ *       also be summed in pieces, as it arrives, with a checksum_stream.
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include "platform.h"
+#include "main.h"
+#include "superfasthash.h"
+#include "checksum.h"
+
+#include <assert.h>
+#include <string.h>
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define CHECKSUM_HAVE_SSE42
+#elif defined(__aarch64__) && defined(__GNUC__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define CHECKSUM_HAVE_ARMV8
+#endif
+
+#define CRC32C_POLY 0x82f63b78 // reversed Castagnoli polynomial
+
+typedef uint32_t (*crc32c_fn)(uint32_t crc, const uint8_t *data, size_t len);
+
+static uint32_t s_table[8][256];
+static crc32c_fn s_crc32c = NULL;
+static const char *s_backend = "table";
+
+uint32_t checksum_crc32c_table(uint32_t crc, const uint8_t *data, size_t len)
+{
+  crc = ~crc;
+
+  while (len > 0 && ((uintptr_t)data & 7) != 0) {
+    crc = s_table[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+    len--;
+  }
+
+  while (len >= 8) {
+    uint32_t low = crc ^ ((uint32_t)data[0] | (uint32_t)data[1] << 8
+        | (uint32_t)data[2] << 16 | (uint32_t)data[3] << 24);
+    uint32_t high = (uint32_t)data[4] | (uint32_t)data[5] << 8
+      | (uint32_t)data[6] << 16 | (uint32_t)data[7] << 24;
+    crc = s_table[7][low & 0xff] ^ s_table[6][(low >> 8) & 0xff]
+      ^ s_table[5][(low >> 16) & 0xff] ^ s_table[4][low >> 24]
+      ^ s_table[3][high & 0xff] ^ s_table[2][(high >> 8) & 0xff]
+      ^ s_table[1][(high >> 16) & 0xff] ^ s_table[0][high >> 24];
+    data += 8;
+    len -= 8;
+  }
+
+  while (len-- > 0)
+    crc = s_table[0][(crc ^ *data++) & 0xff] ^ (crc >> 8);
+
+  return ~crc;
+}
+
+#ifdef CHECKSUM_HAVE_SSE42
+__attribute__((target("sse4.2")))
+static uint32_t s_crc32c_sse42(uint32_t crc, const uint8_t *data, size_t len)
+{
+  uint64_t crc64;
+
+  crc = ~crc;
+  while (len > 0 && ((uintptr_t)data & 7) != 0) {
+    crc = _mm_crc32_u8(crc, *data++);
+    len--;
+  }
+
+  crc64 = crc;
+  while (len >= 8) {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    crc64 = _mm_crc32_u64(crc64, word);
+    data += 8;
+    len -= 8;
+  }
+  crc = (uint32_t)crc64;
+
+  while (len-- > 0)
+    crc = _mm_crc32_u8(crc, *data++);
+
+  return ~crc;
+}
+#endif
+
+#ifdef CHECKSUM_HAVE_ARMV8
+__attribute__((target("+crc")))
+static uint32_t s_crc32c_armv8(uint32_t crc, const uint8_t *data, size_t len)
+{
+  crc = ~crc;
+  while (len > 0 && ((uintptr_t)data & 7) != 0) {
+    crc = __crc32cb(crc, *data++);
+    len--;
+  }
+
+  while (len >= 8) {
+    uint64_t word;
+    memcpy(&word, data, sizeof(word));
+    crc = __crc32cd(crc, word);
+    data += 8;
+    len -= 8;
+  }
+
+  while (len-- > 0)
+    crc = __crc32cb(crc, *data++);
+
+  return ~crc;
+}
+#endif
+
+/*  Once, before any thread uses the checksums */
+void checksum_init(void)
+{
+  int i, j;
+
+  for (i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for (j = 0; j < 8; j++)
+      crc = (crc >> 1) ^ (CRC32C_POLY & (0 - (crc & 1)));
+    s_table[0][i] = crc;
+  }
+  for (i = 0; i < 256; i++) {
+    for (j = 1; j < 8; j++)
+      s_table[j][i] = s_table[0][s_table[j - 1][i] & 0xff] ^ (s_table[j - 1][i] >> 8);
+  }
+
+  s_crc32c = checksum_crc32c_table;
+  s_backend = "table";
+
+#ifdef CHECKSUM_HAVE_SSE42
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.2")) {
+    s_crc32c = s_crc32c_sse42;
+    s_backend = "sse4.2";
+  }
+#endif
+#ifdef CHECKSUM_HAVE_ARMV8
+  if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+    s_crc32c = s_crc32c_armv8;
+    s_backend = "armv8";
+  }
+#endif
+
+  debugLog("CRC32C checksums computed by: %s", s_backend);
+}
+
+bool checksum_valid(int algorithm)
+{
+  return algorithm == CHECKSUM_SFH || algorithm == CHECKSUM_CRC32C;
+}
+
+uint32_t checksum_update(int algorithm, uint32_t sum, const uint8_t *data, size_t len)
+{
+  if (algorithm == CHECKSUM_CRC32C) {
+    assert(s_crc32c);
+    return s_crc32c(sum, data, len);
+  }
+  return SuperFastHash((uint8_t*)data, len, sum);
+}
+
+void checksum_stream_init(checksum_stream *self, int algorithm, uint32_t sum)
+{
+  assert(self);
+
+  self->algorithm = algorithm;
+  self->sum = sum;
+  self->done = 0;
+}
+
+/*  Sum the frame up to 'end'; its last bytes are only summed once 'end'
+ *  reaches its length, SuperFastHash finishing each frame differently */
+void checksum_stream_update(checksum_stream *self, const uint8_t *frame, size_t end, size_t len)
+{
+  assert(self);
+  assert(end <= len);
+
+  if (len > 0 && self->done == len)
+    return; // complete already
+
+  if (self->algorithm == CHECKSUM_CRC32C) {
+    if (end > self->done)
+      self->sum = checksum_update(CHECKSUM_CRC32C, self->sum, frame + self->done, end - self->done);
+    self->done = end;
+    return;
+  }
+
+  if (end == len) {
+    self->sum = SuperFastHash((uint8_t*)frame + self->done, len - self->done, self->sum);
+    self->done = len;
+    return;
+  }
+
+  /*  Whole blocks, and always some left for the last call */
+  size_t blocks = (end < len - 1 ? end : len - 1) & ~(size_t)3;
+  if (blocks > self->done) {
+    self->sum = SuperFastHashBlocks(frame + self->done, blocks - self->done, self->sum);
+    self->done = blocks;
+  }
+}
+
+const char *checksum_crc32c_backend(void)
+{
+  return s_backend;
+}
+
+bool checksum_crc32c_accelerated(void)
+{
+  return s_crc32c != checksum_crc32c_table;
+}
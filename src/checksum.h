@@ -0,0 +1,60 @@
+/**
+ * =====================================================================================
+ *
+ *   @file checksum.h
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  06/06/2013 09:48:03 AM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Message checksums: SuperFastHash, or CRC32C picked at runtime
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifndef _SATAN_CHECKSUM_H_
+#define _SATAN_CHECKSUM_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CHECKSUM_SFH    0x00 // 4 bytes checksum frame, the default
+#define CHECKSUM_CRC32C 0x01 // 5 bytes checksum frame: algorithm, then the sum
+
+#define CHECKSUM_SIZE          4
+#define CHECKSUM_EXTENDED_SIZE 5
+
+typedef struct {
+  int algorithm;
+  uint32_t sum;
+  size_t done;              // bytes of the frame summed so far
+} checksum_stream;
+
+void checksum_init(void);
+
+bool checksum_valid(int algorithm);
+uint32_t checksum_update(int algorithm, uint32_t sum, const uint8_t *data, size_t len);
+
+void checksum_stream_init(checksum_stream *self, int algorithm, uint32_t sum);
+void checksum_stream_update(checksum_stream *self, const uint8_t *frame, size_t end, size_t len);
+
+const char *checksum_crc32c_backend(void);
+bool checksum_crc32c_accelerated(void);
+uint32_t checksum_crc32c_table(uint32_t crc, const uint8_t *data, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _SATAN_CHECKSUM_H_
@@ -0,0 +1,348 @@
+/**
+ * =====================================================================================
+ *
+ *   @file client.c
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  06/21/2013 10:15:42 AM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Client library: sends commands to the satan daemons from the server
+ *       side, keeps as many in flight as wanted and hands each answer to the
+ *       handler of its command, matched by message id.
+ *
+ *       Commands go out in the v1 format, summed with SuperFastHash. A
+ *       command sent to a group of devices completes on the first final
+ *       answer; the others reach the default handler.
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include "main.h"
+#include "client.h"
+#include "superfasthash.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+
+typedef struct {
+  char msgid[CLIENT_MSGID_LEN + 1];
+  int64_t deadline;
+  client_fn *handler;
+  void *arg;
+  bool done;  // final answer handled, freed on the next expiry
+} s_request_t;
+
+struct s_client_t {
+  zctx_t *ctx;
+  void *commands;         // PUB, to the daemons' SUB
+  void *answers;          // PULL, from the daemons' PUSH
+  zhash_t *requests;      // msgid -> pending request
+  zlist_t *queue;         // all requests, done or not
+  int timeout;
+  int64_t deadline;       // the nearest of the pending requests
+  client_fn *handler;     // answers matching no pending request
+  void *arg;
+  uint64_t prefix;        // random, so that two clients never share a msgid
+  uint64_t counter;
+};
+
+static const struct {
+  const char *name;
+  int status;
+} s_answers[] = {
+  { MSG_ANSWER_STR_ACCEPTED, MSG_ANSWER_ACCEPTED },
+  { MSG_ANSWER_STR_CMDOUTPUT, MSG_ANSWER_CMDOUTPUT },
+  { MSG_ANSWER_STR_COMPLETED, MSG_ANSWER_COMPLETED },
+  { MSG_ANSWER_STR_BADCRC, MSG_ANSWER_BADCRC },
+  { MSG_ANSWER_STR_PARSEERROR, MSG_ANSWER_PARSEERROR },
+  { MSG_ANSWER_STR_UNREADABLE, MSG_ANSWER_UNREADABLE },
+  { MSG_ANSWER_STR_EXECERROR, MSG_ANSWER_EXECERROR },
+  { MSG_ANSWER_STR_UNDEFERROR, MSG_ANSWER_UNDEFERROR },
+  { MSG_ANSWER_STR_TASK, MSG_ANSWER_TASK },
+  { MSG_ANSWER_STR_CHUNK, MSG_ANSWER_CHUNK },
+  { MSG_ANSWER_STR_CREDIT, MSG_ANSWER_CREDIT },
+  { MSG_ANSWER_STR_MANIFEST, MSG_ANSWER_MANIFEST },
+  { MSG_ANSWER_STR_TASKS, MSG_ANSWER_TASKS },
+};
+
+static int s_status(zframe_t *frame)
+{
+  size_t i;
+
+  for (i = 0; i < sizeof(s_answers) / sizeof(s_answers[0]); i++) {
+    if (zframe_streq(frame, s_answers[i].name))
+      return s_answers[i].status;
+  }
+  return 0; // heartbeats, batches, local events
+}
+
+/*  After which the daemon sends nothing more for the command */
+bool client_final(int status)
+{
+  switch (status) {
+    case MSG_ANSWER_COMPLETED:
+    case MSG_ANSWER_BADCRC:
+    case MSG_ANSWER_PARSEERROR:
+    case MSG_ANSWER_UNREADABLE:
+    case MSG_ANSWER_EXECERROR:
+    case MSG_ANSWER_UNDEFERROR:
+    case CLIENT_TIMEOUT:
+      return true;
+    default:
+      return false;
+  }
+}
+
+static uint64_t s_prefix(void)
+{
+  uint64_t prefix = 0;
+  int fd = open("/dev/urandom", O_RDONLY);
+
+  if (fd < 0 || read(fd, &prefix, sizeof(prefix)) != sizeof(prefix))
+    prefix = (uint64_t)zclock_time() << 16 ^ getpid();
+  if (fd >= 0)
+    close(fd);
+  return prefix;
+}
+
+client_t *client_new(const char *command_endpoint, const char *answer_endpoint)
+{
+  assert(command_endpoint);
+  assert(answer_endpoint);
+
+  client_t *self = malloc(sizeof(client_t));
+  assert(self);
+
+  self->ctx = zctx_new();
+  assert(self->ctx);
+  zctx_set_linger(self->ctx, 0);
+
+  /*  Queue all that is sent and received: the window is the caller's */
+  self->commands = zsocket_new(self->ctx, ZMQ_PUB);
+  zsocket_set_sndhwm(self->commands, 0);
+  self->answers = zsocket_new(self->ctx, ZMQ_PULL);
+  zsocket_set_rcvhwm(self->answers, 0);
+
+  if (zsocket_bind(self->commands, "%s", command_endpoint) == -1
+      || zsocket_bind(self->answers, "%s", answer_endpoint) == -1) {
+    errorLog("Could not bind %s or %s", command_endpoint, answer_endpoint);
+    zctx_destroy(&self->ctx);
+    free(self);
+    return NULL;
+  }
+
+  self->requests = zhash_new();
+  self->queue = zlist_new();
+  self->timeout = CLIENT_DEFAULT_TIMEOUT;
+  self->deadline = 0;
+  self->handler = NULL;
+  self->arg = NULL;
+  self->prefix = s_prefix();
+  self->counter = 0;
+
+  return self;
+}
+
+/*  Pending requests get no callback */
+void client_destroy(client_t **self)
+{
+  assert(self);
+
+  if (*self) {
+    s_request_t *request;
+    while ((request = zlist_pop((*self)->queue)) != NULL)
+      free(request);
+    zlist_destroy(&(*self)->queue);
+    zhash_destroy(&(*self)->requests);
+    zctx_destroy(&(*self)->ctx);
+    free(*self);
+    *self = NULL;
+  }
+}
+
+/*  For the commands sent from then on */
+void client_set_timeout(client_t *self, int msecs)
+{
+  assert(self);
+  assert(msecs > 0);
+
+  self->timeout = msecs;
+}
+
+void client_set_handler(client_t *self, client_fn *handler, void *arg)
+{
+  assert(self);
+
+  self->handler = handler;
+  self->arg = arg;
+}
+
+/*  To poll along with other sockets, calling client_process(self, 0) when readable */
+void *client_socket(client_t *self)
+{
+  assert(self);
+
+  return self->answers;
+}
+
+/*  Sends the command with its arguments, if any, and takes them over.
+ *  Returns its message id, valid until its final callback returns, or NULL. */
+const char *client_send(client_t *self, const char *device, const char *command, zmsg_t **arguments,
+    client_fn *handler, void *arg)
+{
+  assert(self);
+  assert(device);
+  assert(command);
+
+  s_request_t *request = malloc(sizeof(s_request_t));
+  assert(request);
+  snprintf(request->msgid, sizeof(request->msgid), "%016llx%016llx",
+      (unsigned long long)self->prefix, (unsigned long long)++self->counter);
+  request->deadline = zclock_time() + self->timeout;
+  request->handler = handler;
+  request->arg = arg;
+  request->done = false;
+
+  zmsg_t *msg = NULL;
+  if (arguments && *arguments) {
+    msg = *arguments;
+    *arguments = NULL;
+  } else
+    msg = zmsg_new();
+  zmsg_pushstr(msg, "%s", command);
+  zmsg_pushstr(msg, "%s", request->msgid);
+  zmsg_pushstr(msg, "%s", device);
+
+  uint32_t sum = 0;
+  uint8_t checksum[4];
+  zframe_t *frame = zmsg_first(msg);
+  while (frame) {
+    sum = SuperFastHash(zframe_data(frame), zframe_size(frame), sum);
+    frame = zmsg_next(msg);
+  }
+  checksum[0] = sum;
+  checksum[1] = sum >> 8;
+  checksum[2] = sum >> 16;
+  checksum[3] = sum >> 24;
+  zmsg_addmem(msg, checksum, sizeof(checksum));
+
+  if (zmsg_send(&msg, self->commands) == -1) {
+    zmsg_destroy(&msg);
+    free(request);
+    return NULL;
+  }
+
+  if (zhash_size(self->requests) == 0 || self->deadline == 0 || request->deadline < self->deadline)
+    self->deadline = request->deadline;
+  zhash_insert(self->requests, request->msgid, request);
+  zlist_append(self->queue, request);
+  return request->msgid;
+}
+
+const char *client_exec(client_t *self, const char *device, const char *cmd, client_fn *handler, void *arg)
+{
+  assert(cmd);
+
+  zmsg_t *arguments = zmsg_new();
+  zmsg_addstr(arguments, "%s", cmd);
+  return client_send(self, device, MSG_COMMAND_STR_EXEC, &arguments, handler, arg);
+}
+
+static void s_dispatch(client_t *self, zmsg_t *answer)
+{
+  s_request_t *request = NULL;
+  char *msgid = NULL;
+  int status = 0;
+
+  if (zmsg_size(answer) >= 3) {
+    zmsg_first(answer); // the device uuid
+    msgid = zframe_strdup(zmsg_next(answer));
+    status = s_status(zmsg_next(answer));
+    request = zhash_lookup(self->requests, msgid);
+  }
+
+  if (request == NULL) {
+    if (self->handler)
+      self->handler(self, msgid, status, answer, self->arg);
+  } else {
+    if (client_final(status)) {
+      zhash_delete(self->requests, request->msgid);
+      request->done = true;
+    }
+    if (request->handler)
+      request->handler(self, request->msgid, status, answer, request->arg);
+  }
+  free(msgid);
+}
+
+/*  Frees the requests done and times out the overdue ones; the queue is
+ *  walked once, requests sent from the callbacks being appended behind */
+static void s_expire(client_t *self)
+{
+  int64_t now = zclock_time();
+  size_t count = zlist_size(self->queue);
+
+  self->deadline = 0;
+  while (count--) {
+    s_request_t *request = zlist_pop(self->queue);
+    if (!request->done && request->deadline <= now) {
+      zhash_delete(self->requests, request->msgid);
+      request->done = true;
+      if (request->handler)
+        request->handler(self, request->msgid, CLIENT_TIMEOUT, NULL, request->arg);
+    }
+    if (request->done) {
+      free(request);
+      continue;
+    }
+    if (self->deadline == 0 || request->deadline < self->deadline)
+      self->deadline = request->deadline;
+    zlist_append(self->queue, request);
+  }
+}
+
+/*  Handles the answers received within msecs, or at once if some already
+ *  were, and the timeouts. A negative msecs waits for an answer or the
+ *  nearest timeout, forever if no command is pending. Callbacks may send
+ *  commands but not process. Returns the number of commands left pending,
+ *  -1 if interrupted. */
+int client_process(client_t *self, int msecs)
+{
+  assert(self);
+
+  if (zhash_size(self->requests) > 0) {
+    int64_t left = self->deadline - zclock_time();
+    if (msecs < 0 || left < msecs)
+      msecs = left > 0 ? left : 0;
+  }
+
+  zmq_pollitem_t items[] = { { self->answers, 0, ZMQ_POLLIN, 0 } };
+  if (zmq_poll(items, 1, msecs * ZMQ_POLL_MSEC) == -1)
+    return -1;
+
+  while (zsocket_events(self->answers) & ZMQ_POLLIN) {
+    zmsg_t *answer = zmsg_recv(self->answers);
+    if (answer == NULL)
+      return -1;
+    s_dispatch(self, answer);
+    zmsg_destroy(&answer);
+  }
+
+  s_expire(self);
+  return zhash_size(self->requests);
+}
+
+size_t client_pending(client_t *self)
+{
+  assert(self);
+
+  return zhash_size(self->requests);
+}
@@ -0,0 +1,62 @@
+/**
+ * =====================================================================================
+ *
+ *   @file client.h
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  06/21/2013 10:15:42 AM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Client library headers
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include <czmq.h>
+#include "protocol.h"
+
+#ifndef _SATAN_CLIENT_H_
+#define _SATAN_CLIENT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CLIENT_MSGID_LEN          32      // hex chars
+#define CLIENT_DEFAULT_TIMEOUT    30000   // ms until the final answer of a command
+#define CLIENT_TIMEOUT            0xFF    // status of a command without a final answer in time
+
+typedef struct s_client_t client_t;
+
+/*  Called for every answer to a command, with the whole answer message
+ *  (uuid, msgid, answer, then its frames), which stays owned by the client.
+ *  The last call comes with a final status: MSG_ANSWER_COMPLETED, an error,
+ *  or CLIENT_TIMEOUT with a NULL answer. */
+typedef void (client_fn)(client_t *client, const char *msgid, int status, zmsg_t *answer, void *arg);
+
+client_t *client_new(const char *command_endpoint, const char *answer_endpoint);
+void client_destroy(client_t **self);
+
+void client_set_timeout(client_t *self, int msecs);
+void client_set_handler(client_t *self, client_fn *handler, void *arg);
+void *client_socket(client_t *self);
+
+const char *client_send(client_t *self, const char *device, const char *command, zmsg_t **arguments,
+    client_fn *handler, void *arg);
+const char *client_exec(client_t *self, const char *device, const char *cmd, client_fn *handler, void *arg);
+
+int client_process(client_t *self, int msecs);
+size_t client_pending(client_t *self);
+bool client_final(int status);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _SATAN_CLIENT_H_
@@ -0,0 +1,130 @@
+/**
+ * =====================================================================================
+ *
+ *   @file dedup.c
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  05/14/2013 04:11:53 PM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Bounded cache of the recently accepted message ids.
+ *
+ *       Entries live in a fixed-size ring indexed by a hash table: the oldest
+ *       entry gets evicted when the ring is full, and entries older than the
+ *       ttl are ignored.
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include "main.h"
+#include "dedup.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+#ifdef SATAN_TINY
+static dedup_entry s_ring[DEDUP_MAX]; // a single cache, owned by the worker
+#endif
+
+dedup_cache *dedup_new(int size, int64_t ttl)
+{
+  assert(size > 0);
+
+  if (size > DEDUP_MAX)
+    size = DEDUP_MAX;
+
+  dedup_cache *self = malloc(sizeof(dedup_cache));
+  assert(self);
+
+  self->index = zhash_new();
+#ifdef SATAN_TINY
+  self->ring = s_ring;
+  memset(s_ring, 0, sizeof(s_ring));
+#else
+  self->ring = calloc(size, sizeof(dedup_entry));
+  assert(self->ring);
+#endif
+  self->size = size;
+  self->next = 0;
+  self->ttl = ttl;
+
+  return self;
+}
+
+void dedup_destroy(dedup_cache **self)
+{
+  assert(self);
+
+  if (*self) {
+    int i;
+    for (i = 0; i < (*self)->size; i++)
+      free((*self)->ring[i].message_id);
+#ifndef SATAN_TINY
+    free((*self)->ring);
+#endif
+    zhash_destroy(&(*self)->index);
+    free(*self);
+    *self = NULL;
+  }
+}
+
+dedup_entry *dedup_lookup(dedup_cache *self, const char *msgid)
+{
+  assert(self);
+
+  if (msgid == NULL)
+    return NULL;
+
+  dedup_entry *entry = zhash_lookup(self->index, msgid);
+  if (entry == NULL || zclock_time() - entry->time > self->ttl)
+    return NULL;
+
+  return entry;
+}
+
+void dedup_insert(dedup_cache *self, const char *msgid, int status)
+{
+  assert(self);
+  assert(msgid);
+
+  dedup_entry *entry = zhash_lookup(self->index, msgid);
+  if (entry != NULL) {
+    if (zclock_time() - entry->time > self->ttl)
+      entry->time = zclock_time();
+    entry->status = status;
+    return;
+  }
+
+  /*  Evict the oldest entry */
+  entry = &self->ring[self->next];
+  if (entry->message_id) {
+    zhash_delete(self->index, entry->message_id);
+    free(entry->message_id);
+  }
+  self->next = (self->next + 1) % self->size;
+
+  entry->message_id = strdup(msgid);
+  entry->time = zclock_time();
+  entry->status = status;
+  zhash_insert(self->index, entry->message_id, entry);
+}
+
+/*  A message whose answer must not be replayed, and may run again */
+void dedup_forget(dedup_cache *self, const char *msgid)
+{
+  assert(self);
+  assert(msgid);
+
+  dedup_entry *entry = zhash_lookup(self->index, msgid);
+  if (entry != NULL) {
+    zhash_delete(self->index, msgid);
+    free(entry->message_id);
+    entry->message_id = NULL;
+  }
+}
@@ -0,0 +1,55 @@
+/**
+ * =====================================================================================
+ *
+ *   @file dedup.h
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  05/14/2013 04:02:19 PM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Recently seen message ids, to suppress retransmitted commands
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include <czmq.h>
+
+#ifndef _SATAN_DEDUP_H_
+#define _SATAN_DEDUP_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct s_dedup_entry_t {
+  char *message_id;
+  int64_t time;             // zclock_time() of the first reception
+  int status;               // last answer code sent for this message
+} dedup_entry;
+
+typedef struct s_dedup_cache_t {
+  zhash_t *index;           // message id -> entry
+  dedup_entry *ring;        // entries, oldest one overwritten first
+  int size;
+  int next;
+  int64_t ttl;              // msecs after which an entry is forgotten
+} dedup_cache;
+
+dedup_cache *dedup_new(int size, int64_t ttl);
+void dedup_destroy(dedup_cache **self);
+
+dedup_entry *dedup_lookup(dedup_cache *self, const char *msgid);
+void dedup_insert(dedup_cache *self, const char *msgid, int status);
+void dedup_forget(dedup_cache *self, const char *msgid);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _SATAN_DEDUP_H_
@@ -0,0 +1,141 @@
+/**
+ * =====================================================================================
+ *
+ *   @file fileio.c
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  05/20/2013 02:53:10 PM
+ *
+ *   @section DESCRIPTION
+ *
+ *       File I/O stage.
+ *
+ *       Runs in its own thread so that slow flash writes and reads never stall
+ *       the worker: jobs are received as [msgid][command][arguments...] on the
+ *       pipe, and answered with [msgid][command][answer code] once done,
+ *       followed by the manifest frames of a SYNC or the chunks of a PULL
+ *       read. The I/O engine backend name is given as thread argument.
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include "main.h"
+#include "messages.h"
+#include "fileio.h"
+#include "sync.h"
+
+#include <errno.h>
+#include <string.h>
+
+/*  As many chunks as asked for, in one batch; MSG_ANSWER_CHUNK while more is left */
+static uint8_t s_read_file(ioengine_t *engine, fileio_read *read, zmsg_t *result)
+{
+  ioengine_req reqs[IOENGINE_QUEUE_DEPTH];
+  int count = read->count < IOENGINE_QUEUE_DEPTH ? read->count : IOENGINE_QUEUE_DEPTH;
+  int i;
+
+  for (i = 0; i < count; i++) {
+    reqs[i].fd = read->fd;
+    reqs[i].buffer = ioengine_buffer(engine, i);
+    reqs[i].len = IOENGINE_CHUNK_SIZE;
+    reqs[i].offset = read->offset + (uint64_t)i * IOENGINE_CHUNK_SIZE;
+    reqs[i].buffer_index = i;
+    reqs[i].result = 0;
+  }
+
+  if (ioengine_submit(engine, IOENGINE_OP_READ, reqs, count) != STATUS_OK)
+    return MSG_ANSWER_EXECERROR;
+
+  for (i = 0; i < count; i++) {
+    if (reqs[i].result == -EAGAIN && i > 0)
+      break; // not submitted, read again next time
+    if (reqs[i].result < 0)
+      return MSG_ANSWER_EXECERROR;
+    if (reqs[i].result == 0)
+      return MSG_ANSWER_COMPLETED;
+    zmsg_addmem(result, reqs[i].buffer, reqs[i].result);
+
+    /*  Next chunks were read from the wrong offset */
+    if ((size_t)reqs[i].result < reqs[i].len)
+      break;
+  }
+  return MSG_ANSWER_CHUNK;
+}
+
+/*  Same for archives, the tar stream being produced on the fly */
+static uint8_t s_read_archive(ioengine_t *engine, fileio_read *read, zmsg_t *result)
+{
+  int count = read->count < IOENGINE_QUEUE_DEPTH ? read->count : IOENGINE_QUEUE_DEPTH;
+  uint8_t *buffer = ioengine_buffer(engine, 0);
+  int i;
+
+  for (i = 0; i < count; i++) {
+    ssize_t len = archive_read(read->archive, buffer, IOENGINE_CHUNK_SIZE);
+    if (len < 0)
+      return MSG_ANSWER_EXECERROR;
+    if (len > 0)
+      zmsg_addmem(result, buffer, len);
+    if (len < IOENGINE_CHUNK_SIZE)
+      return MSG_ANSWER_COMPLETED;
+  }
+  return MSG_ANSWER_CHUNK;
+}
+
+void fileio_loop(void *user_args, zctx_t *ctx, void *pipe)
+{
+  ioengine_t *engine = ioengine_new((const char*)user_args);
+  sync_cache *hashes = sync_new(SYNC_CACHE_MAX);
+  assert(engine);
+
+  while (!zctx_interrupted) {
+    zmsg_t *job = zmsg_recv (pipe);
+    if (job == NULL)
+      break; // Interrupted
+
+    char *msgid = zmsg_popstr(job);
+    zframe_t *command = zmsg_pop(job);
+    zmsg_t *result = zmsg_new();
+    uint8_t ret = MSG_ANSWER_EXECERROR;
+
+    switch (zframe_data(command)[0]) {
+      case MSG_COMMAND_PUSH:
+        ret = messages_push(engine, msgid, job);
+        break;
+      case MSG_COMMAND_SYNC:
+        {
+          char *root = zmsg_popstr(job);
+          ret = sync_manifest(hashes, root, result);
+          free(root);
+        } break;
+      case MSG_COMMAND_SYNCAPPLY:
+        ret = sync_apply(hashes, engine, job);
+        break;
+      case MSG_COMMAND_PULL:
+        {
+          zframe_t *frame = zmsg_pop(job);
+          fileio_read read;
+          if (frame != NULL && zframe_size(frame) == sizeof(read)) {
+            memcpy(&read, zframe_data(frame), sizeof(read));
+            ret = read.archive != NULL ? s_read_archive(engine, &read, result) : s_read_file(engine, &read, result);
+          }
+          zframe_destroy(&frame);
+        } break;
+    }
+
+    zmsg_push(result, zframe_new(&ret, sizeof(ret)));
+    zmsg_push(result, command);
+    zmsg_pushstr(result, "%s", msgid);
+    zmsg_send(&result, pipe);
+
+    free(msgid);
+    zmsg_destroy(&job);
+  }
+
+  sync_destroy(&hashes);
+  ioengine_destroy(&engine);
+}
@@ -0,0 +1,45 @@
+/**
+ * =====================================================================================
+ *
+ *   @file fileio.h
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  05/20/2013 02:48:33 PM
+ *
+ *   @section DESCRIPTION
+ *
+ *       File I/O stage definitions
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include <czmq.h>
+#include "archive.h"
+
+#ifndef _SATAN_FILEIO_H_
+#define _SATAN_FILEIO_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*  A PULL read, done on behalf of the worker which keeps the source open */
+typedef struct {
+  int fd;                   // file read from offset on, -1 for an archive
+  archive_t *archive;       // tar stream, read on from where it is
+  uint64_t offset;
+  int count;                // chunks to read at most
+} fileio_read;
+
+void fileio_loop(void *user_args, zctx_t *ctx, void *pipe);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _SATAN_FILEIO_H_
@@ -0,0 +1,114 @@
+/**
+ * =====================================================================================
+ *
+ *   @file heartbeat.c
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  05/16/2013 11:42:51 AM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Periodic telemetry heartbeat.
+ *
+ *       System figures are read straight from /proc, no process is forked.
+ *       The heartbeat is sent as a fixed-size little-endian frame:
+ *
+ *         0  version          1 flags             2  running tasks
+ *         4  uptime (s)       8 total mem (kB)    12 free mem (kB)
+ *         16 load1 x100      18 load5 x100        20 load15 x100
+ *         22 queued answers  24 queued bytes      28 queued commands
+ *         30 queued file jobs
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include "main.h"
+#include "messages.h"
+#include "utils.h"
+#include "heartbeat.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+
+#define PROC_BUFFER_LEN 2048
+
+static int s_read_proc(const char *path, char *buffer, int len)
+{
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return STATUS_ERROR;
+
+  int size = read(fd, buffer, len - 1);
+  close(fd);
+  if (size < 0)
+    return STATUS_ERROR;
+
+  buffer[size] = 0;
+  return STATUS_OK;
+}
+
+static uint32_t s_meminfo_field(const char *meminfo, const char *field)
+{
+  const char *line = strstr(meminfo, field);
+  if (line == NULL)
+    return 0;
+  return strtoul(line + strlen(field), NULL, 10);
+}
+
+void heartbeat_sample(heartbeat_t *self)
+{
+  assert(self);
+
+  char buffer[PROC_BUFFER_LEN];
+  double uptime = 0, load[3] = { 0, 0, 0 };
+  int i;
+
+  if (s_read_proc("/proc/uptime", buffer, PROC_BUFFER_LEN) == STATUS_OK)
+    sscanf(buffer, "%lf", &uptime);
+  self->uptime = (uint32_t)uptime;
+
+  if (s_read_proc("/proc/loadavg", buffer, PROC_BUFFER_LEN) == STATUS_OK)
+    sscanf(buffer, "%lf %lf %lf", &load[0], &load[1], &load[2]);
+  for (i = 0; i < 3; i++)
+    self->load[i] = (uint16_t)(load[i] * 100);
+
+  self->mem_total = 0;
+  self->mem_free = 0;
+  if (s_read_proc("/proc/meminfo", buffer, PROC_BUFFER_LEN) == STATUS_OK) {
+    self->mem_total = s_meminfo_field(buffer, "MemTotal:");
+    self->mem_free = s_meminfo_field(buffer, "MemAvailable:");
+    if (self->mem_free == 0)
+      self->mem_free = s_meminfo_field(buffer, "MemFree:");
+  }
+}
+
+zmsg_t *heartbeat_msg(const char *device_id, heartbeat_t *self)
+{
+  assert(device_id);
+  assert(self);
+
+  uint8_t frame[HEARTBEAT_SIZE];
+  memset(frame, 0, HEARTBEAT_SIZE);
+
+  frame[0] = HEARTBEAT_VERSION;
+  frame[1] = self->flags;
+  utils_put16(frame + 2, self->tasks);
+  utils_put32(frame + 4, self->uptime);
+  utils_put32(frame + 8, self->mem_total);
+  utils_put32(frame + 12, self->mem_free);
+  utils_put16(frame + 16, self->load[0]);
+  utils_put16(frame + 18, self->load[1]);
+  utils_put16(frame + 20, self->load[2]);
+  utils_put16(frame + 22, self->queued_messages);
+  utils_put32(frame + 24, self->queued_bytes);
+  utils_put16(frame + 28, self->queued_commands);
+  utils_put16(frame + 30, self->queued_files);
+
+  return utils_gen_msg(device_id, "", MSG_ANSWER_STR_HEARTBEAT, (char*)frame, HEARTBEAT_SIZE);
+}
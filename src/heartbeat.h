@@ -0,0 +1,56 @@
+/**
+ * =====================================================================================
+ *
+ *   @file heartbeat.h
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  05/16/2013 11:37:08 AM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Periodic telemetry heartbeat definitions
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include <czmq.h>
+
+#ifndef _SATAN_HEARTBEAT_H_
+#define _SATAN_HEARTBEAT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HEARTBEAT_VERSION 0x01
+#define HEARTBEAT_SIZE    32
+
+#define HEARTBEAT_FLAG_CRC32C    0x01 // CRC32C checksums are accepted
+#define HEARTBEAT_FLAG_CRC32C_HW 0x02 // and computed by the CPU
+
+typedef struct s_heartbeat_t {
+  uint8_t flags;            // HEARTBEAT_FLAG_*
+  uint32_t uptime;          // seconds
+  uint16_t load[3];         // 1, 5 and 15 minutes load average, x100
+  uint32_t mem_total;       // kB
+  uint32_t mem_free;        // kB, available memory when the kernel knows it
+  uint16_t tasks;           // running tasks
+  uint16_t queued_messages; // answers waiting for the answer socket
+  uint32_t queued_bytes;
+  uint16_t queued_commands; // commands waiting for the worker
+  uint16_t queued_files;    // jobs waiting for the file I/O stage
+} heartbeat_t;
+
+void heartbeat_sample(heartbeat_t *self);
+zmsg_t *heartbeat_msg(const char *device_id, heartbeat_t *self);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _SATAN_HEARTBEAT_H_
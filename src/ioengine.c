@@ -0,0 +1,208 @@
+/**
+ * =====================================================================================
+ *
+ *   @file ioengine.c
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  05/23/2013 09:25:02 AM
+ *
+ *   @section DESCRIPTION
+ *
+ *       File I/O engine.
+ *
+ *       Requests are submitted by batches of IOENGINE_QUEUE_DEPTH chunks, and
+ *       the call returns once all of them are complete. A batch may also be
+ *       started, and waited for later: a single one is in flight at a time. The backend is picked
+ *       at runtime: io_uring when the kernel supports every operation we need,
+ *       a small pool of pread/pwrite threads otherwise.
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include "main.h"
+#include "ioengine.h"
+
+#include <errno.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+ioengine_t *ioengine_new(const char *backend)
+{
+  int ret = STATUS_ERROR;
+  ioengine_t *self = calloc(1, sizeof(ioengine_t));
+  assert(self);
+
+  /*  Page-aligned, so that the buffers can be registered */
+  if (posix_memalign((void**)&self->buffers, 4096,
+        IOENGINE_QUEUE_DEPTH * IOENGINE_CHUNK_SIZE) != 0) {
+    free(self);
+    return NULL;
+  }
+
+  if (backend == NULL)
+    backend = IOENGINE_AUTO;
+
+  if (!str_equals(backend, IOENGINE_THREADS)) {
+    ret = ioengine_uring_init(self);
+    if (ret != STATUS_OK && str_equals(backend, IOENGINE_URING))
+      errorLog("io_uring is not available, falling back to threads");
+  }
+  if (ret != STATUS_OK)
+    ret = ioengine_threads_init(self);
+
+  if (ret != STATUS_OK) {
+    free(self->buffers);
+    free(self);
+    return NULL;
+  }
+
+  debugLog("Using the %s I/O engine", self->name);
+  return self;
+}
+
+void ioengine_destroy(ioengine_t **self)
+{
+  assert(self);
+
+  if (*self) {
+    (*self)->destroy(*self);
+    free((*self)->buffers);
+    free(*self);
+    *self = NULL;
+  }
+}
+
+uint8_t *ioengine_buffer(ioengine_t *self, int index)
+{
+  assert(self);
+  assert(index >= 0 && index < IOENGINE_QUEUE_DEPTH);
+
+  return self->buffers + index * IOENGINE_CHUNK_SIZE;
+}
+
+int ioengine_submit(ioengine_t *self, int opcode, ioengine_req *reqs, int count)
+{
+  assert(self);
+  assert(reqs);
+
+  while (count > 0) {
+    int batch = count < IOENGINE_QUEUE_DEPTH ? count : IOENGINE_QUEUE_DEPTH;
+    if (ioengine_start(self, opcode, reqs, batch) != STATUS_OK
+        || ioengine_wait(self) != STATUS_OK)
+      return STATUS_ERROR;
+    reqs += batch;
+    count -= batch;
+  }
+  return STATUS_OK;
+}
+
+int ioengine_start(ioengine_t *self, int opcode, ioengine_req *reqs, int count)
+{
+  assert(self);
+  assert(reqs);
+  assert(count > 0 && count <= IOENGINE_QUEUE_DEPTH);
+
+  return self->start(self, opcode, reqs, count);
+}
+
+int ioengine_wait(ioengine_t *self)
+{
+  assert(self);
+
+  return self->wait(self);
+}
+
+int ioengine_write_file(ioengine_t *self, const char *file_name, const uint8_t *data, size_t len)
+{
+  return ioengine_write_file_overlap(self, file_name, data, len, NULL, NULL);
+}
+
+/*  Same, calling overlap() on the data of each batch while it is written */
+int ioengine_write_file_overlap(ioengine_t *self, const char *file_name, const uint8_t *data, size_t len,
+    ioengine_overlap_fn *overlap, void *arg)
+{
+  assert(self);
+  assert(file_name);
+
+  int fd = open(file_name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP);
+  if (fd < 0)
+    return STATUS_ERROR;
+
+  if (ioengine_write_fd_overlap(self, fd, data, len, overlap, arg) != STATUS_OK) {
+    close(fd);
+    unlink(file_name);
+    return STATUS_ERROR;
+  }
+  if (close(fd) != 0) {
+    unlink(file_name);
+    return STATUS_ERROR;
+  }
+  return STATUS_OK;
+}
+
+/*  Into a file already open, which is left so */
+int ioengine_write_fd_overlap(ioengine_t *self, int fd, const uint8_t *data, size_t len,
+    ioengine_overlap_fn *overlap, void *arg)
+{
+  assert(self);
+  assert(fd >= 0);
+
+  ioengine_req reqs[IOENGINE_QUEUE_DEPTH];
+  size_t done = 0;
+  int i;
+
+  /*  Reserve the space first: fail early when the flash is full */
+  if (len > 0) {
+    memset(reqs, 0, sizeof(ioengine_req));
+    reqs[0].fd = fd;
+    reqs[0].len = len;
+    reqs[0].buffer_index = -1;
+    if (ioengine_submit(self, IOENGINE_OP_FALLOCATE, reqs, 1) != STATUS_OK
+        || reqs[0].result == -ENOSPC)
+      return STATUS_ERROR;
+  }
+
+  while (done < len) {
+    int count = 0;
+    size_t offset = done;
+    while (count < IOENGINE_QUEUE_DEPTH && offset < len) {
+      size_t chunk = len - offset < IOENGINE_CHUNK_SIZE ? len - offset : IOENGINE_CHUNK_SIZE;
+      reqs[count].fd = fd;
+      reqs[count].buffer = (uint8_t*)data + offset;
+      reqs[count].len = chunk;
+      reqs[count].offset = offset;
+      reqs[count].buffer_index = -1;
+      reqs[count].result = 0;
+      offset += chunk;
+      count++;
+    }
+
+    if (ioengine_start(self, IOENGINE_OP_WRITE, reqs, count) != STATUS_OK)
+      return STATUS_ERROR;
+    if (overlap != NULL)
+      overlap(data, offset, arg);
+    if (ioengine_wait(self) != STATUS_OK)
+      return STATUS_ERROR;
+
+    /*  Resume after the first short write, or the first request not submitted */
+    for (i = 0; i < count; i++) {
+      if (reqs[i].result == -EAGAIN && i > 0)
+        break;
+      if (reqs[i].result <= 0)
+        return STATUS_ERROR;
+      done = reqs[i].offset + reqs[i].result;
+      if ((size_t)reqs[i].result < reqs[i].len)
+        break;
+    }
+  }
+
+  return STATUS_OK;
+}
@@ -0,0 +1,87 @@
+/**
+ * =====================================================================================
+ *
+ *   @file ioengine.h
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  05/23/2013 09:12:44 AM
+ *
+ *   @section DESCRIPTION
+ *
+ *       File I/O engine: batched chunk reads and writes, with several backends
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "profile.h"
+
+#ifndef _SATAN_IOENGINE_H_
+#define _SATAN_IOENGINE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define IOENGINE_AUTO    "auto"
+#define IOENGINE_URING   "uring"
+#define IOENGINE_THREADS "threads"
+
+#define IOENGINE_OP_READ      0x01
+#define IOENGINE_OP_WRITE     0x02
+#define IOENGINE_OP_FALLOCATE 0x03
+
+typedef struct s_ioengine_req_t {
+  int fd;
+  uint8_t *buffer;
+  size_t len;               // also the length to allocate, for IOENGINE_OP_FALLOCATE
+  uint64_t offset;
+  int buffer_index;         // registered buffer holding buffer, -1 if none
+  ssize_t result;           // bytes transferred, or -errno; -EAGAIN if it could not be submitted
+} ioengine_req;
+
+typedef struct s_ioengine_t ioengine_t;
+
+/*  Called while the batch writing data up to 'end' is in flight */
+typedef void (ioengine_overlap_fn)(const uint8_t *data, size_t end, void *arg);
+
+struct s_ioengine_t {
+  const char *name;
+  uint8_t *buffers;         // IOENGINE_QUEUE_DEPTH chunks, registered with the kernel if possible
+  void *backend;
+  int (*start)(ioengine_t *self, int opcode, ioengine_req *reqs, int count);
+  int (*wait)(ioengine_t *self);
+  void (*destroy)(ioengine_t *self);
+};
+
+ioengine_t *ioengine_new(const char *backend);
+void ioengine_destroy(ioengine_t **self);
+
+uint8_t *ioengine_buffer(ioengine_t *self, int index);
+
+int ioengine_submit(ioengine_t *self, int opcode, ioengine_req *reqs, int count);
+int ioengine_start(ioengine_t *self, int opcode, ioengine_req *reqs, int count);
+int ioengine_wait(ioengine_t *self);
+
+int ioengine_write_file(ioengine_t *self, const char *file_name, const uint8_t *data, size_t len);
+int ioengine_write_file_overlap(ioengine_t *self, const char *file_name, const uint8_t *data, size_t len,
+    ioengine_overlap_fn *overlap, void *arg);
+int ioengine_write_fd_overlap(ioengine_t *self, int fd, const uint8_t *data, size_t len,
+    ioengine_overlap_fn *overlap, void *arg);
+
+/*  Backends, return STATUS_ERROR when unavailable on this system */
+int ioengine_uring_init(ioengine_t *self);
+int ioengine_threads_init(ioengine_t *self);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _SATAN_IOENGINE_H_
@@ -0,0 +1,168 @@
+/**
+ * =====================================================================================
+ *
+ *   @file ioengine_threads.c
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  05/23/2013 10:41:19 AM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Portable I/O engine backend: a small pool of threads running
+ *       pread/pwrite, so that the chunks of a batch are in flight together.
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include "platform.h"
+#include "main.h"
+#include "ioengine.h"
+
+#include <errno.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#define IOENGINE_THREADS_COUNT 2
+
+typedef struct s_threadpool_t {
+  pthread_t threads[IOENGINE_THREADS_COUNT];
+  pthread_mutex_t lock;
+  pthread_cond_t work;
+  pthread_cond_t done;
+  ioengine_req *reqs;       // current batch
+  int opcode;
+  int count;
+  int next;                 // next request to pick up
+  int pending;              // requests not completed yet
+  bool terminated;
+} threadpool_t;
+
+static ssize_t s_execute(int opcode, ioengine_req *req)
+{
+  ssize_t ret = -EINVAL;
+
+  switch (opcode) {
+    case IOENGINE_OP_READ:
+      do {
+        ret = pread(req->fd, req->buffer, req->len, req->offset);
+      } while (ret < 0 && errno == EINTR);
+      break;
+    case IOENGINE_OP_WRITE:
+      do {
+        ret = pwrite(req->fd, req->buffer, req->len, req->offset);
+      } while (ret < 0 && errno == EINTR);
+      break;
+    case IOENGINE_OP_FALLOCATE:
+#ifdef SATAN_HAVE_LINUX
+      ret = fallocate(req->fd, 0, req->offset, req->len);
+#else
+      errno = EOPNOTSUPP;
+#endif
+      break;
+  }
+
+  return ret < 0 ? -errno : ret;
+}
+
+static void *s_thread(void *args)
+{
+  threadpool_t *pool = args;
+
+  pthread_mutex_lock(&pool->lock);
+  while (!pool->terminated) {
+    if (pool->next < pool->count) {
+      ioengine_req *req = &pool->reqs[pool->next++];
+      int opcode = pool->opcode;
+      pthread_mutex_unlock(&pool->lock);
+
+      req->result = s_execute(opcode, req);
+
+      pthread_mutex_lock(&pool->lock);
+      if (--pool->pending == 0)
+        pthread_cond_signal(&pool->done);
+    } else {
+      pthread_cond_wait(&pool->work, &pool->lock);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  return NULL;
+}
+
+static int s_threads_start(ioengine_t *self, int opcode, ioengine_req *reqs, int count)
+{
+  threadpool_t *pool = self->backend;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->reqs = reqs;
+  pool->opcode = opcode;
+  pool->count = count;
+  pool->next = 0;
+  pool->pending = count;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+
+  return STATUS_OK;
+}
+
+static int s_threads_wait(ioengine_t *self)
+{
+  threadpool_t *pool = self->backend;
+
+  pthread_mutex_lock(&pool->lock);
+  while (pool->pending > 0)
+    pthread_cond_wait(&pool->done, &pool->lock);
+  pool->count = 0;
+  pthread_mutex_unlock(&pool->lock);
+
+  return STATUS_OK;
+}
+
+static void s_threads_destroy(ioengine_t *self)
+{
+  threadpool_t *pool = self->backend;
+  int i;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->terminated = true;
+  pthread_cond_broadcast(&pool->work);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (i = 0; i < IOENGINE_THREADS_COUNT; i++)
+    pthread_join(pool->threads[i], NULL);
+
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->work);
+  pthread_cond_destroy(&pool->done);
+  free(pool);
+}
+
+int ioengine_threads_init(ioengine_t *self)
+{
+  int i;
+  threadpool_t *pool = calloc(1, sizeof(threadpool_t));
+  if (pool == NULL)
+    return STATUS_ERROR;
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->work, NULL);
+  pthread_cond_init(&pool->done, NULL);
+
+  for (i = 0; i < IOENGINE_THREADS_COUNT; i++)
+    pthread_create(&pool->threads[i], NULL, s_thread, pool);
+
+  self->name = IOENGINE_THREADS;
+  self->backend = pool;
+  self->start = s_threads_start;
+  self->wait = s_threads_wait;
+  self->destroy = s_threads_destroy;
+  return STATUS_OK;
+}
@@ -0,0 +1,288 @@
+/**
+ * =====================================================================================
+ *
+ *   @file ioengine_uring.c
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  05/23/2013 11:58:36 AM
+ *
+ *   @section DESCRIPTION
+ *
+ *       io_uring I/O engine backend.
+ *
+ *       Talks to the kernel through the raw syscalls, no liburing needed: a
+ *       whole batch is queued in the submission ring and handed over with a
+ *       single io_uring_enter() call, and its completions are waited for by
+ *       another one, so that the caller may work meanwhile.
+ *       The engine chunk buffers are registered, so that reads into them use
+ *       the fixed buffer operations.
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include "platform.h"
+#include "main.h"
+#include "ioengine.h"
+
+#ifdef SATAN_HAVE_IO_URING
+
+#include <errno.h>
+#include <assert.h>
+#include <string.h>
+#include <stdlib.h>
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+
+typedef struct s_uring_t {
+  int fd;
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_array;
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void *sq_ring;
+  size_t sq_ring_size;
+  void *cq_ring;
+  size_t cq_ring_size;
+  size_t sqes_size;
+  bool registered;          // the engine buffers are registered
+  ioengine_req *reqs;       // batch in flight
+  int count;                // of its requests, those submitted
+} uring_t;
+
+static int s_enter(int fd, unsigned to_submit, unsigned min_complete)
+{
+  int ret;
+  do {
+    ret = syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+        IORING_ENTER_GETEVENTS, NULL, 0);
+  } while (ret < 0 && errno == EINTR);
+  return ret;
+}
+
+/*  Older kernels have io_uring without the plain read/write/fallocate ops */
+static bool s_supported(int fd)
+{
+  size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+  struct io_uring_probe *probe = calloc(1, size);
+  bool ret = false;
+
+  if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0) {
+    ret = probe->last_op >= IORING_OP_FALLOCATE
+      && (probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED)
+      && (probe->ops[IORING_OP_WRITE].flags & IO_URING_OP_SUPPORTED)
+      && (probe->ops[IORING_OP_FALLOCATE].flags & IO_URING_OP_SUPPORTED);
+  }
+
+  free(probe);
+  return ret;
+}
+
+static void s_prepare(uring_t *ring, struct io_uring_sqe *sqe, int opcode, ioengine_req *req)
+{
+  bool fixed = ring->registered && req->buffer_index >= 0;
+
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  sqe->fd = req->fd;
+  sqe->off = req->offset;
+
+  switch (opcode) {
+    case IOENGINE_OP_READ:
+      sqe->opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+      sqe->addr = (uintptr_t)req->buffer;
+      sqe->len = req->len;
+      break;
+    case IOENGINE_OP_WRITE:
+      sqe->opcode = fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+      sqe->addr = (uintptr_t)req->buffer;
+      sqe->len = req->len;
+      break;
+    case IOENGINE_OP_FALLOCATE:
+      sqe->opcode = IORING_OP_FALLOCATE;
+      sqe->addr = req->len; // Length goes into addr, mode into len
+      sqe->len = 0;
+      break;
+  }
+
+  if (fixed)
+    sqe->buf_index = req->buffer_index;
+}
+
+/*  The kernel may take fewer entries than queued, short of memory: the
+ *  rest are taken back and fail with -EAGAIN, as a short transfer would, so
+ *  that only the submitted ones are waited for */
+static int s_uring_start(ioengine_t *self, int opcode, ioengine_req *reqs, int count)
+{
+  uring_t *ring = self->backend;
+  unsigned tail = *ring->sq_tail;
+  int i;
+
+  for (i = 0; i < count; i++) {
+    unsigned index = tail & *ring->sq_mask;
+    s_prepare(ring, &ring->sqes[index], opcode, &reqs[i]);
+    ring->sqes[index].user_data = i;
+    ring->sq_array[index] = index;
+    tail++;
+  }
+  __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+  ring->reqs = reqs;
+  ring->count = 0;
+  while (ring->count < count) {
+    int ret = s_enter(ring->fd, count - ring->count, 0);
+    if (ret <= 0)
+      break;
+    ring->count += ret;
+  }
+
+  if (ring->count < count) {
+    /*  Without SQPOLL the kernel only reads the ring from within io_uring_enter() */
+    __atomic_store_n(ring->sq_tail, __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+    for (i = ring->count; i < count; i++)
+      reqs[i].result = -EAGAIN;
+  }
+  return ring->count > 0 ? STATUS_OK : STATUS_ERROR;
+}
+
+static int s_uring_wait(ioengine_t *self)
+{
+  uring_t *ring = self->backend;
+  int completed = 0;
+
+  while (completed < ring->count) {
+    unsigned head = *ring->cq_head;
+    unsigned cq_tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != cq_tail) {
+      struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+      ring->reqs[cqe->user_data].result = cqe->res;
+      head++;
+      completed++;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+    if (completed < ring->count && s_enter(ring->fd, 0, ring->count - completed) < 0)
+      return STATUS_ERROR;
+  }
+
+  ring->count = 0;
+  return STATUS_OK;
+}
+
+static void s_uring_destroy(ioengine_t *self)
+{
+  uring_t *ring = self->backend;
+
+  munmap(ring->sqes, ring->sqes_size);
+  if (ring->cq_ring != ring->sq_ring)
+    munmap(ring->cq_ring, ring->cq_ring_size);
+  munmap(ring->sq_ring, ring->sq_ring_size);
+  close(ring->fd);
+  free(ring);
+}
+
+int ioengine_uring_init(ioengine_t *self)
+{
+  struct io_uring_params params;
+  struct iovec iovecs[IOENGINE_QUEUE_DEPTH];
+  int i;
+
+  uring_t *ring = calloc(1, sizeof(uring_t));
+  if (ring == NULL)
+    return STATUS_ERROR;
+
+  memset(&params, 0, sizeof(params));
+  ring->fd = syscall(__NR_io_uring_setup, IOENGINE_QUEUE_DEPTH, &params);
+  if (ring->fd < 0) {
+    free(ring);
+    return STATUS_ERROR;
+  }
+  if (!s_supported(ring->fd)) {
+    close(ring->fd);
+    free(ring);
+    return STATUS_ERROR;
+  }
+
+  ring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cq_ring_size > ring->sq_ring_size)
+      ring->sq_ring_size = ring->cq_ring_size;
+    ring->cq_ring_size = ring->sq_ring_size;
+  }
+
+  ring->sq_ring = mmap(NULL, ring->sq_ring_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+  if (ring->sq_ring == MAP_FAILED)
+    goto ioengine_uring_error;
+
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    ring->cq_ring = ring->sq_ring;
+  } else {
+    ring->cq_ring = mmap(NULL, ring->cq_ring_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+    if (ring->cq_ring == MAP_FAILED) {
+      munmap(ring->sq_ring, ring->sq_ring_size);
+      goto ioengine_uring_error;
+    }
+  }
+
+  ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    if (ring->cq_ring != ring->sq_ring)
+      munmap(ring->cq_ring, ring->cq_ring_size);
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    goto ioengine_uring_error;
+  }
+
+  ring->sq_head = (unsigned*)((uint8_t*)ring->sq_ring + params.sq_off.head);
+  ring->sq_tail = (unsigned*)((uint8_t*)ring->sq_ring + params.sq_off.tail);
+  ring->sq_mask = (unsigned*)((uint8_t*)ring->sq_ring + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned*)((uint8_t*)ring->sq_ring + params.sq_off.array);
+  ring->cq_head = (unsigned*)((uint8_t*)ring->cq_ring + params.cq_off.head);
+  ring->cq_tail = (unsigned*)((uint8_t*)ring->cq_ring + params.cq_off.tail);
+  ring->cq_mask = (unsigned*)((uint8_t*)ring->cq_ring + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe*)((uint8_t*)ring->cq_ring + params.cq_off.cqes);
+
+  /*  Registered buffers are an optimization only, go on without them */
+  for (i = 0; i < IOENGINE_QUEUE_DEPTH; i++) {
+    iovecs[i].iov_base = ioengine_buffer(self, i);
+    iovecs[i].iov_len = IOENGINE_CHUNK_SIZE;
+  }
+  ring->registered = syscall(__NR_io_uring_register, ring->fd,
+      IORING_REGISTER_BUFFERS, iovecs, IOENGINE_QUEUE_DEPTH) == 0;
+
+  self->name = IOENGINE_URING;
+  self->backend = ring;
+  self->start = s_uring_start;
+  self->wait = s_uring_wait;
+  self->destroy = s_uring_destroy;
+  return STATUS_OK;
+
+ioengine_uring_error:
+  close(ring->fd);
+  free(ring);
+  return STATUS_ERROR;
+}
+
+#else
+
+int ioengine_uring_init(ioengine_t *self)
+{
+  return STATUS_ERROR;
+}
+
+#endif // SATAN_HAVE_IO_URING
@@ -0,0 +1,141 @@
+/**
+ * =====================================================================================
+ *
+ *   @file local.c
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  06/12/2013 10:12:31 AM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Events submitted by local processes.
+ *
+ *       Scripts and hotplug handlers PUSH their events to a local endpoint
+ *       instead of opening their own connection to the server: a tag frame,
+ *       then an optional data frame. Events are queued, and go to the server
+ *       together on the answer socket, as a single MSGLOCAL message of tag and
+ *       data frames, once the oldest of them has waited for the linger time
+ *       or the batch is large enough.
+ *
+ *       The queue is bounded: over its budget, the local socket is not read
+ *       anymore and the submitters block on their own sends.
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include "main.h"
+#include "messages.h"
+#include "local.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+local_queue *local_new(size_t budget, int64_t linger)
+{
+  local_queue *self = calloc(1, sizeof(local_queue));
+  assert(self);
+
+  self->events = zlist_new();
+  self->budget = budget;
+  self->linger = linger;
+  return self;
+}
+
+void local_destroy(local_queue **self)
+{
+  assert(self);
+
+  if (*self) {
+    zframe_t *frame = NULL;
+    while ((frame = zlist_pop((*self)->events)) != NULL)
+      zframe_destroy(&frame);
+    zlist_destroy(&(*self)->events);
+    free(*self);
+    *self = NULL;
+  }
+}
+
+bool local_accepting(local_queue *self)
+{
+  assert(self);
+  return self->bytes < self->budget;
+}
+
+/*  Queue an event, dropped if malformed or larger than the whole budget */
+int local_push(local_queue *self, zmsg_t **event)
+{
+  assert(self);
+  assert(event);
+
+  zmsg_t *msg = *event;
+  *event = NULL;
+
+  size_t size = zmsg_content_size(msg);
+  if (zmsg_size(msg) < 1 || zmsg_size(msg) > 2 || size > self->budget
+      || zframe_size(zmsg_first(msg)) == 0 || zframe_size(zmsg_first(msg)) > MAX_STRING_LEN) {
+    errorLog("Malformed local event dropped");
+    zmsg_destroy(&msg);
+    return STATUS_ERROR;
+  }
+
+  if (zlist_size(self->events) == 0)
+    self->oldest = zclock_time();
+
+  zlist_append(self->events, zmsg_pop(msg));
+  zframe_t *data = zmsg_pop(msg);
+  zlist_append(self->events, data != NULL ? data : zframe_new(NULL, 0));
+  self->bytes += size;
+
+  zmsg_destroy(&msg);
+  return STATUS_OK;
+}
+
+/*  Milliseconds before the queued events are due, -1 when none is queued */
+int64_t local_delay(local_queue *self)
+{
+  assert(self);
+
+  if (zlist_size(self->events) == 0)
+    return -1;
+  if (self->bytes >= LOCAL_BATCH_MAX)
+    return 0;
+
+  int64_t delay = self->oldest + self->linger - zclock_time();
+  return delay > 0 ? delay : 0;
+}
+
+/*  The events to send, up to LOCAL_BATCH_MAX bytes but at least one, once due */
+zmsg_t *local_batch(local_queue *self, const char *device_id)
+{
+  assert(self);
+  assert(device_id);
+
+  if (local_delay(self) != 0)
+    return NULL;
+
+  zmsg_t *msg = zmsg_new();
+  zmsg_addstr(msg, "%s", device_id);
+  zmsg_addstr(msg, "%s", "");
+  zmsg_addstr(msg, "%s", MSG_ANSWER_STR_LOCAL);
+
+  size_t batched = 0;
+  while (zlist_size(self->events) > 0) {
+    zframe_t *tag = zlist_first(self->events);
+    zframe_t *data = zlist_next(self->events);
+    size_t size = zframe_size(tag) + zframe_size(data);
+    if (batched > 0 && batched + size > LOCAL_BATCH_MAX)
+      break;
+
+    zmsg_add(msg, zlist_pop(self->events));
+    zmsg_add(msg, zlist_pop(self->events));
+    batched += size;
+  }
+  self->bytes -= batched; // what is left is overdue already
+
+  return msg;
+}
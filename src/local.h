@@ -0,0 +1,53 @@
+/**
+ * =====================================================================================
+ *
+ *   @file local.h
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  06/12/2013 10:12:31 AM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Events submitted by local processes, batched to the server
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include <czmq.h>
+
+#ifndef _SATAN_LOCAL_H_
+#define _SATAN_LOCAL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define DEFAULT_LOCAL_ENDPOINT "ipc:///var/run/satan.sock"
+#define LOCAL_SOCKET_MODE      0660  // of an ipc endpoint: its owner and group may submit events
+
+typedef struct s_local_queue_t {
+  zlist_t *events;          // zframe_t, a tag then its data, for every event
+  size_t bytes;             // queued, tags and data
+  size_t budget;            // the local socket is not read beyond it
+  int64_t linger;           // ms an event may wait for others to share its batch
+  int64_t oldest;           // zclock_time() of the first queued event
+} local_queue;
+
+local_queue *local_new(size_t budget, int64_t linger);
+void local_destroy(local_queue **self);
+
+bool local_accepting(local_queue *self);
+int local_push(local_queue *self, zmsg_t **event);
+int64_t local_delay(local_queue *self);
+zmsg_t *local_batch(local_queue *self, const char *device_id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _SATAN_LOCAL_H_
@@ -25,15 +25,29 @@
 #include <stdlib.h>
 #include <czmq.h>
 #include <stdarg.h>
+#include <signal.h>
+#include <sys/stat.h>
 
 /* Autogenerated platform defines */
 #include "platform.h"
 
 #include "main.h"
 #include "utils.h"
+#include "tasks.h"
+#include "dedup.h"
+#include "heartbeat.h"
+#include "fileio.h"
+#include "scheduler.h"
+#include "cache.h"
+#include "validator.h"
+#include "local.h"
+#include "capture.h"
+#include "spawner.h"
+#include "wire.h"
 #include "messages.h"
 #include "zeromq.h"
 #include "superfasthash.h"
+#include "checksum.h"
 
 #ifdef SATAN_HAVE_UCI
 #include "config.h"
@@ -44,30 +58,122 @@
 #define DEFAULT_DEVICE_UUID       "satan_client"
 #define DEFAULT_COMMANDS_ENDPOINT "tcp://localhost:10080"
 #define DEFAULT_ANSWERS_ENDPOINT  "tcp://localhost:10081"
+#define DEFAULT_TRANSPORT         TRANSPORT_PUBSUB
+
+#define TRANSPORT_PUBSUB "pubsub" // SUB for commands, PUSH for answers
+#define TRANSPORT_DEALER "dealer" // A single DEALER socket, identified by uuid
 
-#define SATAN_CHECKSUM_SIZE 4
 #define MIN_UUID_LEN 4
+#define MAX_GROUPS 16
 
 #define MAIN_SLEEP_TIME 100 // 100ms
 
+#define ANSWER_SOCKET_HWM 32
+#define DEFAULT_DEDUP_TTL     600 // seconds
+#define DEFAULT_HEARTBEAT_INTERVAL 60 // seconds, 0 disables heartbeats
+#define DEFAULT_HEARTBEAT_JITTER   5  // seconds
+#define DEFAULT_SCHEDULE_FILE      "/etc/satan.schedule"
+#define DEFAULT_BATCH_INTERVAL     300 // seconds between scheduled results uploads
+#define DEFAULT_VALIDATION_THREADS 0   // one per online CPU
+#define DEFAULT_SHAPING_RATE       0   // bytes per second, 0 for unlimited
+#define DEFAULT_SHAPING_BURST      0   // bytes, 0 for one second worth of rate
+#define DEFAULT_LOCAL_LINGER       200 // ms a local event waits for others to share its upload
+#define DEFAULT_CAPTURE_MAX        (16*1024*1024) // bytes, 0 for unlimited
+
+#define LOCAL_SOCKET_HWM 16
+
 
 /*  A few globals, to be pulled with next stable */
 
 char *device_uuid = NULL;
 char *command_endpoint = NULL;
 char *answer_endpoint = NULL;
+char *control_endpoint = NULL;        // optional control lane, commands
+char *control_answer_endpoint = NULL; // and answers
+char *local_endpoint = DEFAULT_LOCAL_ENDPOINT; // empty to disable
+char *transport = NULL;
+char *io_engine = NULL;
+char *groups[MAX_GROUPS];
+int group_count = 0;
 
 void *internal_pipe = NULL;
 void *answer_socket = NULL;
+void *control_socket = NULL; // the answer socket, unless a control lane is set up
+validator_pool *validators = NULL;
+capture_t *recorder = NULL;
+spawner_t *spawner = NULL;
+
+int task_budget = DEFAULT_TASK_BUDGET;
+int global_budget = DEFAULT_GLOBAL_BUDGET;
+int dedup_size = DEFAULT_DEDUP_SIZE;
+int dedup_ttl = DEFAULT_DEDUP_TTL;
+int heartbeat_interval = DEFAULT_HEARTBEAT_INTERVAL;
+int heartbeat_jitter = DEFAULT_HEARTBEAT_JITTER;
+int cache_budget = DEFAULT_CACHE_BUDGET;
+char *schedule_file = DEFAULT_SCHEDULE_FILE;
+int batch_interval = DEFAULT_BATCH_INTERVAL;
+int validation_threads = DEFAULT_VALIDATION_THREADS;
+int shaping_rate = DEFAULT_SHAPING_RATE;
+int shaping_burst = DEFAULT_SHAPING_BURST;
+int shaping_task_rate = DEFAULT_SHAPING_RATE;
+int shaping_task_burst = DEFAULT_SHAPING_BURST;
+int local_budget = DEFAULT_LOCAL_BUDGET;
+int local_linger = DEFAULT_LOCAL_LINGER;
+char *capture_file = NULL; // no capture by default
+int capture_max = DEFAULT_CAPTURE_MAX;
+int use_spawner = 1;
+
+volatile int queued_commands = 0; // submitted for validation, not processed yet
+
+typedef struct s_worker_t {
+  task_table *tasks;
+  dedup_cache *recent;
+  void *fileio;             // file I/O stage pipe
+  int fileio_pending;       // jobs queued into the file I/O stage
+  scheduler_t *scheduler;
+  result_cache *cache;      // EXEC results
+  void *local;              // events from local processes, may be NULL
+  local_queue *events;
+} worker_t;
 
 
 
 static void s_help(void)
 {
-  errorLog("Usage: satan [-u uuid] [-s COMMAND_ENDPOINT] [-p ANSWER_ENDPOINT]\n");
+  errorLog("Usage: satan [-u uuid] [-g 'group ...'] [-s COMMAND_ENDPOINT] [-p ANSWER_ENDPOINT] [-c CONTROL_ENDPOINT] [-C CONTROL_ANSWER_ENDPOINT] [-l LOCAL_ENDPOINT] [-t pubsub|dealer] [-S SCHEDULE_FILE] [-r CAPTURE_FILE] [-H HEARTBEAT_INTERVAL]\n");
   exit(1);
 }
 
+/*  Split a space-separated list of group topics, replacing any set before */
+static void s_set_groups(const char *list)
+{
+  char *copy = strndup(list, MAX_STRING_LEN);
+  char *saveptr = NULL;
+  char *group = strtok_r(copy, " ", &saveptr);
+
+  while (group_count > 0)
+    free(groups[--group_count]);
+  while (group != NULL && group_count < MAX_GROUPS) {
+    groups[group_count++] = strdup(group);
+    group = strtok_r(NULL, " ", &saveptr);
+  }
+  free(copy);
+}
+
+/*  SUB filtering is prefix-based: only exact uuid or group matches are ours */
+static bool s_is_addressed(const char *uuid)
+{
+  int i;
+
+  if (str_equals(uuid, device_uuid))
+    return true;
+  for (i = 0; i < group_count; i++) {
+    if (str_equals(uuid, groups[i]))
+      return true;
+  }
+  return false;
+}
+
 static void s_handle_cmdline(int argc, char** argv) {
   int flags = 0;
 
@@ -97,6 +203,70 @@ static void s_handle_cmdline(int argc, char** argv) {
           errorLog("Error: Please specify a valid endpoint !");
         }
         break;
+      case 'c':
+        if (flags+2<argc) {
+          flags++;
+          control_endpoint = strndup(argv[1+flags],MAX_STRING_LEN);
+        } else {
+          errorLog("Error: Please specify a valid endpoint !");
+        }
+        break;
+      case 'C':
+        if (flags+2<argc) {
+          flags++;
+          control_answer_endpoint = strndup(argv[1+flags],MAX_STRING_LEN);
+        } else {
+          errorLog("Error: Please specify a valid endpoint !");
+        }
+        break;
+      case 'l':
+        if (flags+2<argc) {
+          flags++;
+          local_endpoint = strndup(argv[1+flags],MAX_STRING_LEN);
+        } else {
+          errorLog("Error: Please specify a valid endpoint !");
+        }
+        break;
+      case 'g':
+        if (flags+2<argc) {
+          flags++;
+          s_set_groups(argv[1+flags]);
+        } else {
+          errorLog("Error: Please specify a valid group list !");
+        }
+        break;
+      case 't':
+        if (flags+2<argc) {
+          flags++;
+          transport = strndup(argv[1+flags],MAX_STRING_LEN);
+        } else {
+          errorLog("Error: Please specify a valid transport !");
+        }
+        break;
+      case 'S':
+        if (flags+2<argc) {
+          flags++;
+          schedule_file = strndup(argv[1+flags],MAX_STRING_LEN);
+        } else {
+          errorLog("Error: Please specify a valid schedule file !");
+        }
+        break;
+      case 'r':
+        if (flags+2<argc) {
+          flags++;
+          capture_file = strndup(argv[1+flags],MAX_STRING_LEN);
+        } else {
+          errorLog("Error: Please specify a valid capture file !");
+        }
+        break;
+      case 'H':
+        if (flags+2<argc) {
+          flags++;
+          heartbeat_interval = atoi(argv[1+flags]);
+        } else {
+          errorLog("Error: Please specify a valid heartbeat interval !");
+        }
+        break;
       case 'h':
         s_help();
         break;
@@ -113,16 +283,78 @@ static void s_handle_cmdline(int argc, char** argv) {
 
 }
 
+/*  Every answer goes through here, to be encoded and recorded */
+static void s_send(zmsg_t **msg, void *socket)
+{
+  wire_encode(*msg);
+  if (recorder != NULL)
+    capture_record(recorder, CAPTURE_OUT, *msg);
+  zmsg_send(msg, socket);
+}
+
+/*  Decimal number argument */
+static bool s_parse_number(zmsg_t *message, int algorithm, uint32_t *sum)
+{
+  char *number = zmsg_popstr(message);
+  if (number == NULL)
+    return false;
+
+  bool valid = strlen(number) > 0 && strspn(number, "0123456789") == strlen(number);
+  *sum = checksum_update(algorithm,*sum,(uint8_t*)number,strlen(number));
+  free(number);
+  return valid;
+}
+
+/*  Trailing 'key=value' options, up to the checksum (the trailing frame, in v1) */
+static bool s_parse_options(zmsg_t *message, size_t trailing, uint8_t command, int algorithm, uint32_t *sum)
+{
+  while (zmsg_size(message) > trailing) {
+    char *option = zmsg_popstr(message);
+    if (option == NULL)
+      return false;
+    bool valid = messages_option_valid(command, option);
+    *sum = checksum_update(algorithm,*sum,(uint8_t*)option,strlen(option));
+    free(option);
+    if (!valid)
+      return false;
+  }
+  return true;
+}
+
+/*  Task id argument: a string, or in v2 a binary id as well */
+static char *s_parse_target(zmsg_t *message, bool v2, int algorithm, uint32_t *sum)
+{
+  zframe_t *frame = zmsg_pop(message);
+  char *target = NULL;
+
+  if (frame == NULL)
+    return NULL;
+
+  *sum = checksum_update(algorithm,*sum,zframe_data(frame),zframe_size(frame));
+  if (v2 && zframe_size(frame) == WIRE_MSGID_SIZE)
+    target = wire_msgid(zframe_data(frame));
+  else
+    target = zframe_strdup(frame);
+  zframe_destroy(&frame);
+  return target;
+}
+
 int s_parse_message(zmsg_t *message, char** msgid, uint8_t *command, zmsg_t** arguments)
 {
   zmsg_t *duplicate = NULL;
   zmsg_t *_arguments = NULL;
   uint8_t _intcmd;
   uint32_t _computedsum;
+  int _algorithm = CHECKSUM_SFH;
+  size_t _sumsize = CHECKSUM_SIZE;
+  size_t _trailing = 1; // the checksum frame, in v1
+  bool _v2 = false;
+  bool _deferred = false; // PUSH payload left to the file I/O stage
+  uint32_t _presum = 0;   // sum of the frames before it
   int ret;
 
   char *_uuid = NULL, *_msgid = NULL, *_command = NULL, *_exec = NULL;
-  zframe_t *_bin = NULL, *_chksumframe = NULL;
+  zframe_t *_bin = NULL, *_chksumframe = NULL, *_header = NULL;
 
   assert(message);
   assert(msgid);
@@ -135,30 +367,58 @@ int s_parse_message(zmsg_t *message, char** msgid, uint8_t *command, zmsg_t** ar
 
   duplicate = zmsg_dup(message); // Work on a copy
 
-  /*  Check that the message is at least 3 times multipart */
-  if (zmsg_size(duplicate) < 4) goto s_parse_unreadable;
+  /*  A v2 message has a fixed-size binary header right after the uuid */
+  zmsg_first(duplicate);
+  _v2 = wire_header_valid(zmsg_next(duplicate));
+
+  if (_v2) {
+    _trailing = 0;
+  } else {
+    /*  Check that the message is at least 3 times multipart */
+    if (zmsg_size(duplicate) < 4) goto s_parse_unreadable;
+
+    /*  A 4 bytes checksum is a SuperFastHash, 5 bytes ones start with the algorithm */
+    zframe_t *_last = zmsg_last(duplicate);
+    if (zframe_size(_last) == CHECKSUM_EXTENDED_SIZE && checksum_valid(zframe_data(_last)[0])) {
+      _algorithm = zframe_data(_last)[0];
+      _sumsize = CHECKSUM_EXTENDED_SIZE;
+    }
+  }
 
   /*  Pop arguments one by one, check them */
   _uuid = zmsg_popstr(duplicate);
   if (_uuid == NULL || strlen(_uuid) < MIN_UUID_LEN) goto s_parse_unreadable;
-  _computedsum = SuperFastHash((uint8_t*)_uuid,strlen(_uuid), 0);
+  if (!s_is_addressed(_uuid)) goto s_parse_ignored;
+
+  if (_v2) {
+    /*  Message id, command and checksum at once */
+    _header = zmsg_pop(duplicate);
+    const uint8_t *header = zframe_data(_header);
+    if (header[WIRE_FLAGS] & WIRE_FLAG_CRC32C)
+      _algorithm = CHECKSUM_CRC32C;
+    _computedsum = checksum_update(_algorithm,0,(uint8_t*)_uuid,strlen(_uuid));
+    _computedsum = checksum_update(_algorithm,_computedsum,header,WIRE_CHECKSUM);
+
+    *msgid = wire_msgid(header + WIRE_MSGID);
+    _intcmd = header[WIRE_OPCODE];
+    if (_intcmd < MSG_COMMAND_EXEC || _intcmd > MSG_COMMAND_SYNCAPPLY) goto s_parse_parseerror;
+  } else {
+    _computedsum = checksum_update(_algorithm,0,(uint8_t*)_uuid,strlen(_uuid));
 
-  _msgid = zmsg_popstr(duplicate);
-  if (_msgid == NULL || strlen(_msgid) < MIN_UUID_LEN) goto s_parse_unreadable;
-  _computedsum = SuperFastHash((uint8_t*)_msgid,strlen(_msgid),_computedsum);
+    _msgid = zmsg_popstr(duplicate);
+    if (_msgid == NULL || strlen(_msgid) < MIN_UUID_LEN) goto s_parse_unreadable;
+    /*  The mark is for the ids of v2 messages: their answers would be encoded in v2 */
+    if (_msgid[0] == WIRE_MSGID_MARK) goto s_parse_unreadable;
+    _computedsum = checksum_update(_algorithm,_computedsum,(uint8_t*)_msgid,strlen(_msgid));
 
-  *msgid = strdup(_msgid);
+    *msgid = strdup(_msgid);
 
-  _command = zmsg_popstr(duplicate);
-  if (_command == NULL) goto s_parse_unreadable;
-  _computedsum = SuperFastHash((uint8_t*)_command,strlen(_command),_computedsum);
+    _command = zmsg_popstr(duplicate);
+    if (_command == NULL) goto s_parse_unreadable;
+    _computedsum = checksum_update(_algorithm,_computedsum,(uint8_t*)_command,strlen(_command));
 
-  if (str_equals(_command,MSG_COMMAND_STR_PUSH)) {
-    _intcmd = MSG_COMMAND_PUSH;
-  } else if (str_equals(_command,MSG_COMMAND_STR_EXEC)) {
-    _intcmd = MSG_COMMAND_EXEC;
-  } else {
-    goto s_parse_parseerror;
+    _intcmd = wire_command(_command);
+    if (_intcmd == 0) goto s_parse_parseerror;
   }
 
   *command = _intcmd;
@@ -167,38 +427,142 @@ int s_parse_message(zmsg_t *message, char** msgid, uint8_t *command, zmsg_t** ar
 
   switch (_intcmd) {
     case MSG_COMMAND_EXEC:
+    case MSG_COMMAND_PULL:
+      {
+        _exec = zmsg_popstr(duplicate);
+        if (_exec == NULL) goto s_parse_parseerror;
+        _computedsum = checksum_update(_algorithm,_computedsum,(uint8_t*)_exec,strlen(_exec));
+
+        if (!s_parse_options(duplicate, _trailing, _intcmd, _algorithm, &_computedsum)) goto s_parse_parseerror;
+      } break;
+    case MSG_COMMAND_STDIN:
       {
+        /*  Task message id, then the data, empty for end of input */
+        _exec = s_parse_target(duplicate, _v2, _algorithm, &_computedsum);
+        if (_exec == NULL) goto s_parse_parseerror;
+        _bin = zmsg_pop(duplicate);
+        if (_bin == NULL) goto s_parse_parseerror;
+        _computedsum = checksum_update(_algorithm,_computedsum,zframe_data(_bin),zframe_size(_bin));
+      } break;
+    case MSG_COMMAND_TAIL:
+    case MSG_COMMAND_FOLLOW:
+      {
+        /*  Task message id, then a decimal offset or follow flag */
+        _exec = s_parse_target(duplicate, _v2, _algorithm, &_computedsum);
+        if (_exec == NULL) goto s_parse_parseerror;
+        if (!s_parse_number(duplicate, _algorithm, &_computedsum)) goto s_parse_parseerror;
+      } break;
+    case MSG_COMMAND_SCHEDULE:
+      {
+        /*  Entry name, decimal interval, command, then options */
         _exec = zmsg_popstr(duplicate);
         if (_exec == NULL) goto s_parse_parseerror;
-        _computedsum = SuperFastHash((uint8_t*)_exec,strlen(_exec),_computedsum);
+        _computedsum = checksum_update(_algorithm,_computedsum,(uint8_t*)_exec,strlen(_exec));
+        if (!s_parse_number(duplicate, _algorithm, &_computedsum)) goto s_parse_parseerror;
+        char *cmd = zmsg_popstr(duplicate);
+        if (cmd == NULL) goto s_parse_parseerror;
+        _computedsum = checksum_update(_algorithm,_computedsum,(uint8_t*)cmd,strlen(cmd));
+        free(cmd);
+        if (!s_parse_options(duplicate, _trailing, _intcmd, _algorithm, &_computedsum)) goto s_parse_parseerror;
+      } break;
+    case MSG_COMMAND_UNSCHEDULE:
+      {
+        /*  Entry name */
+        _exec = zmsg_popstr(duplicate);
+        if (_exec == NULL) goto s_parse_parseerror;
+        _computedsum = checksum_update(_algorithm,_computedsum,(uint8_t*)_exec,strlen(_exec));
+      } break;
+    case MSG_COMMAND_KILL:
+      {
+        /*  Task message id */
+        _exec = s_parse_target(duplicate, _v2, _algorithm, &_computedsum);
+        if (_exec == NULL) goto s_parse_parseerror;
       } break;
     case MSG_COMMAND_PUSH:
       {
         _bin = zmsg_pop(duplicate);
         if (_bin == NULL) goto s_parse_parseerror;
-        _computedsum = SuperFastHash(zframe_data(_bin),zframe_size(_bin),_computedsum);
-        if (zmsg_size(duplicate) > 1) {
+        /*  Large payloads are summed by the file I/O stage, while written */
+        _deferred = zframe_size(_bin) >= PUSH_DEFERRED_MIN;
+        _presum = _computedsum;
+        if (!_deferred)
+          _computedsum = checksum_update(_algorithm,_computedsum,zframe_data(_bin),zframe_size(_bin));
+        if (zmsg_size(duplicate) > _trailing) {
           char *filename = zmsg_popstr(duplicate);
           if (filename == NULL) goto s_parse_parseerror;
-          _computedsum = SuperFastHash((uint8_t*)filename,strlen(filename),_computedsum);
+          if (!_deferred)
+            _computedsum = checksum_update(_algorithm,_computedsum,(uint8_t*)filename,strlen(filename));
           free(filename);
         }
       } break;
+    case MSG_COMMAND_SYNC:
+    case MSG_COMMAND_SYNCAPPLY:
+      {
+        /*  Directory, then for SYNCAPPLY the manifest digest and the changes */
+        _exec = zmsg_popstr(duplicate);
+        if (_exec == NULL) goto s_parse_parseerror;
+        _computedsum = checksum_update(_algorithm,_computedsum,(uint8_t*)_exec,strlen(_exec));
+        if (_intcmd == MSG_COMMAND_SYNC)
+          break;
+
+        _bin = zmsg_pop(duplicate);
+        if (_bin == NULL) goto s_parse_parseerror;
+        _computedsum = checksum_update(_algorithm,_computedsum,zframe_data(_bin),zframe_size(_bin));
+        while (zmsg_size(duplicate) > _trailing) {
+          /*  '+path' then its contents, or '-path' */
+          zframe_t *op = zmsg_pop(duplicate);
+          bool add = zframe_size(op) > 1 && zframe_data(op)[0] == '+';
+          bool valid = add || (zframe_size(op) > 1 && zframe_data(op)[0] == '-');
+          _computedsum = checksum_update(_algorithm,_computedsum,zframe_data(op),zframe_size(op));
+          zframe_destroy(&op);
+          if (!valid) goto s_parse_parseerror;
+          if (add) {
+            if (zmsg_size(duplicate) <= _trailing) goto s_parse_parseerror;
+            zframe_t *data = zmsg_pop(duplicate);
+            _computedsum = checksum_update(_algorithm,_computedsum,zframe_data(data),zframe_size(data));
+            zframe_destroy(&data);
+          }
+        }
+      } break;
     default:
       break;
   }
 
-  if (zmsg_size(duplicate) != 1 || zmsg_content_size(duplicate) != SATAN_CHECKSUM_SIZE)
-    goto  s_parse_parseerror;
-
   /* Verify checksum */
-  _chksumframe = zmsg_pop(duplicate);
-  uint32_t _chksum = get32bits(zframe_data(_chksumframe));
-  if (_chksum != _computedsum)
+  uint32_t _chksum;
+  if (_v2) {
+    if (zmsg_size(duplicate) != 0)
+      goto s_parse_parseerror;
+    _chksum = get32bits(zframe_data(_header) + WIRE_CHECKSUM);
+  } else {
+    if (zmsg_size(duplicate) != 1 || zmsg_content_size(duplicate) != _sumsize)
+      goto  s_parse_parseerror;
+    _chksumframe = zmsg_pop(duplicate);
+    _chksum = get32bits(zframe_data(_chksumframe) + _sumsize - CHECKSUM_SIZE);
+  }
+  if (!_deferred && _chksum != _computedsum)
     goto s_parse_badcrc;
 
   /*  Pop off the checksum from arguments before returning */
-  zmsg_remove(_arguments, zmsg_last(_arguments));
+  if (!_v2)
+    zmsg_remove(_arguments, zmsg_last(_arguments));
+
+  /*  Task ids in their internal form, whatever the version */
+  if (_intcmd == MSG_COMMAND_STDIN || _intcmd == MSG_COMMAND_TAIL
+      || _intcmd == MSG_COMMAND_FOLLOW || _intcmd == MSG_COMMAND_KILL) {
+    zframe_t *target = zmsg_pop(_arguments);
+    zframe_destroy(&target);
+    zmsg_pushstr(_arguments, "%s", _exec);
+  }
+
+  /*  PUSH payloads come after the checksum left to verify, empty if none */
+  if (_intcmd == MSG_COMMAND_PUSH) {
+    uint8_t verify[MSG_PUSH_VERIFY_SIZE];
+    verify[0] = _algorithm;
+    utils_put32(verify + 1, _presum);
+    utils_put32(verify + 5, _chksum);
+    zmsg_pushmem(_arguments, verify, _deferred ? sizeof(verify) : 0);
+  }
   *arguments = zmsg_dup(_arguments);
 
   ret = MSG_ANSWER_ACCEPTED;
@@ -212,6 +576,7 @@ s_parse_finish: /*  Free everything */
 
   if (_bin) zframe_destroy(&_bin);
   if (_chksumframe) zframe_destroy(&_chksumframe);
+  if (_header) zframe_destroy(&_header);
 
   if (_arguments) zmsg_destroy(&_arguments);
 
@@ -229,9 +594,54 @@ s_parse_unreadable:
 s_parse_parseerror:
   ret = MSG_ANSWER_PARSEERROR;
   goto s_parse_finish;
+
+s_parse_ignored:
+  ret = MSG_ANSWER_IGNORED;
+  goto s_parse_finish;
 }
 
-static int s_process_message(char *msgid, uint8_t command, zmsg_t *arguments)
+/*  Shaping of a task, overridden by its 'rate' and 'burst' options */
+static void s_set_rate(worker_t *self, process_item *item, zmsg_t *arguments)
+{
+  char *rate = messages_option(arguments, MSG_OPTION_RATE);
+  char *burst = messages_option(arguments, MSG_OPTION_BURST);
+
+  if (rate != NULL || burst != NULL)
+    tasks_set_rate(self->tasks, item,
+        rate != NULL ? atoi(rate) : shaping_task_rate,
+        burst != NULL ? atoi(burst) : shaping_task_burst);
+
+  free(burst);
+  free(rate);
+}
+
+/*  Resources of a task, from its 'cpu', 'mem', 'nice' and 'ionice' options */
+static void s_get_limits(zmsg_t *arguments, spawn_limits *limits)
+{
+  char *cpu = messages_option(arguments, MSG_OPTION_CPU);
+  char *mem = messages_option(arguments, MSG_OPTION_MEM);
+  char *nice = messages_option(arguments, MSG_OPTION_NICE);
+  char *ionice = messages_option(arguments, MSG_OPTION_IONICE);
+  int ioclass = 0, iolevel = 0;
+
+  memset(limits, 0, sizeof(spawn_limits));
+  if (cpu != NULL)
+    limits->cpu = atoi(cpu);
+  if (mem != NULL)
+    limits->mem = atoi(mem);
+  if (nice != NULL)
+    limits->nice = atoi(nice);
+  if (ionice != NULL && sscanf(ionice, "%d:%d", &ioclass, &iolevel) >= 1
+      && ioclass >= 1 && ioclass <= 3 && iolevel >= 0 && iolevel <= 7)
+    limits->ioprio = ioclass << 13 | iolevel; // IOPRIO_PRIO_VALUE()
+
+  free(ionice);
+  free(nice);
+  free(mem);
+  free(cpu);
+}
+
+static int s_process_message(worker_t *self, char *msgid, uint8_t command, zmsg_t *arguments)
 {
   assert(msgid);
 
@@ -240,103 +650,509 @@ static int s_process_message(char *msgid, uint8_t command, zmsg_t *arguments)
   switch (command) {
     case MSG_COMMAND_EXEC:
       {
+        int output_fd = -1, input_fd = -1;
+        uint32_t cgroup = 0;
         char *cmd = zmsg_popstr(arguments);
-        pid_t pid = messages_exec(device_uuid, msgid, answer_endpoint, cmd);
-        if (pid == -1) {
+        char *input = messages_option(arguments, MSG_OPTION_STDIN);
+        char *ring = messages_option(arguments, MSG_OPTION_RING);
+        char *ttl = messages_option(arguments, MSG_OPTION_TTL);
+        char *shell = messages_option(arguments, MSG_OPTION_SHELL);
+        char *timeout = messages_option(arguments, MSG_OPTION_TIMEOUT);
+        bool with_input = input != NULL && atoi(input) != 0;
+        bool with_ring = ring != NULL && atoi(ring) > 0;
+        bool with_shell = shell == NULL || atoi(shell) != 0;
+
+        /*  Only plain EXECs are cached, their whole output is the result */
+        bool cached = ttl != NULL && atoi(ttl) > 0 && !with_input && !with_ring && with_shell
+          && self->cache->budget > 0;
+        cache_entry *entry = cached ? cache_lookup(self->cache, cmd) : NULL;
+
+        if (tasks_full(self->tasks)) {
           ret = MSG_ANSWER_EXECERROR;
-        } else {
-          zmsg_t *msg = zmsg_new();
-          zframe_t *frame = zframe_new(&pid, sizeof(pid_t));
-          zmsg_push(msg, frame);
-          zmsg_pushstr(msg, "%s", cmd);
-          zmsg_pushstr(msg, "%s", msgid);
-          zmsg_pushstr(msg, "%s", MSG_INTERNAL);
-          zmsg_send(&msg, internal_pipe);
+        } else if (with_ring && !tasks_ring_fits(self->tasks, (size_t)atoi(ring) * 1024)) {
+          ret = MSG_ANSWER_EXECERROR; // too much output kept already
+        } else if (entry != NULL && entry->running) {
+          cache_wait(entry, msgid);
+          self->tasks->reserved++; // the replay comes with the result
+          ret = MSG_ANSWER_TASK;
+        } else if (entry != NULL) {
+          tasks_replay(self->tasks, msgid, cmd, entry->output, entry->len, device_uuid);
           ret = MSG_ANSWER_TASK;
+        } else {
+          spawn_limits limits;
+          s_get_limits(arguments, &limits);
+          if (timeout != NULL && atoi(timeout) > 0)
+            limits.timeout = atoi(timeout);
+          pid_t pid = messages_exec(spawner, cmd, with_shell, &limits, &output_fd, with_input ? &input_fd : NULL,
+              &cgroup);
+          if (pid == -1) {
+            ret = MSG_ANSWER_EXECERROR;
+          } else {
+            process_item *item = tasks_add(self->tasks, TASK_KIND_EXEC, pid, output_fd, msgid, cmd);
+            item->cgroup = cgroup;
+            s_set_rate(self, item, arguments);
+            if (limits.timeout > 0)
+              tasks_set_timeout(self->tasks, item, (int64_t)limits.timeout * 1000);
+            if (with_input)
+              tasks_open_input(self->tasks, item, input_fd, device_uuid);
+            if (with_ring)
+              tasks_set_ring(self->tasks, item, (size_t)atoi(ring) * 1024);
+            if (cached) {
+              cache_start(self->cache, cmd, (int64_t)atoi(ttl) * 1000);
+              tasks_capture(self->tasks, item, self->cache->budget);
+            }
+            ret = MSG_ANSWER_TASK;
+          }
+        }
+        free(timeout);
+        free(shell);
+        free(ttl);
+        free(ring);
+        free(input);
+        free(cmd);
+      } break;
+    case MSG_COMMAND_PULL:
+      {
+        char *filename = zmsg_popstr(arguments);
+        char *gzip = messages_option(arguments, MSG_OPTION_GZIP);
+        struct stat st;
+        if (tasks_full(self->tasks)) {
+          ret = MSG_ANSWER_EXECERROR;
+        } else if (stat(filename, &st) == 0 && S_ISDIR(st.st_mode)) {
+          /*  Directories are streamed as a tar archive */
+          archive_t *archive = archive_new(filename, gzip != NULL && atoi(gzip) != 0);
+          if (archive == NULL) {
+            ret = MSG_ANSWER_EXECERROR;
+          } else {
+            process_item *item = tasks_add(self->tasks, TASK_KIND_ARCHIVE, 0, -1, msgid, filename);
+            item->archive = archive;
+            s_set_rate(self, item, arguments);
+            ret = MSG_ANSWER_TASK;
+          }
+        } else {
+          int fd = messages_pull(filename);
+          if (fd == -1) {
+            ret = MSG_ANSWER_EXECERROR;
+          } else {
+            process_item *item = tasks_add(self->tasks, TASK_KIND_TRANSFER, 0, fd, msgid, filename);
+            s_set_rate(self, item, arguments);
+            ret = MSG_ANSWER_TASK;
+          }
         }
+        free(gzip);
+        free(filename);
+      } break;
+    case MSG_COMMAND_STDIN:
+      {
+        char *target = zmsg_popstr(arguments);
+        zframe_t *data = zmsg_pop(arguments);
+        if (tasks_queue_input(self->tasks, target, data) == STATUS_OK)
+          ret = MSG_ANSWER_COMPLETED;
+        else
+          ret = MSG_ANSWER_EXECERROR;
+        zframe_destroy(&data);
+        free(target);
+      } break;
+    case MSG_COMMAND_TAIL:
+    case MSG_COMMAND_FOLLOW:
+      {
+        char *target = zmsg_popstr(arguments);
+        char *number = zmsg_popstr(arguments);
+        /*  The chunks of a TAIL are queued, its status goes out behind them
+         *  and is remembered for retransmissions right away */
+        int status = MSG_ANSWER_EXECERROR;
+        if (command == MSG_COMMAND_TAIL) {
+          ret = tasks_tail(self->tasks, target, strtoull(number, NULL, 10), msgid, device_uuid,
+              &status) == STATUS_OK ? MSG_ANSWER_PENDING : MSG_ANSWER_EXECERROR;
+          if (ret == MSG_ANSWER_PENDING)
+            dedup_insert(self->recent, msgid, status);
+        } else
+          ret = tasks_follow(self->tasks, target, atoi(number) != 0) == STATUS_OK ?
+            MSG_ANSWER_COMPLETED : MSG_ANSWER_EXECERROR;
+        free(number);
+        free(target);
+      } break;
+    case MSG_COMMAND_SCHEDULE:
+      {
+        char *name = zmsg_popstr(arguments);
+        char *interval = zmsg_popstr(arguments);
+        char *cmd = zmsg_popstr(arguments);
+        char *jitter = messages_option(arguments, MSG_OPTION_JITTER);
+        if (scheduler_add(self->scheduler, name, atoi(interval),
+              jitter != NULL ? atoi(jitter) : 0, cmd) == STATUS_OK)
+          ret = MSG_ANSWER_COMPLETED;
+        else
+          ret = MSG_ANSWER_EXECERROR;
+        free(jitter);
+        free(cmd);
+        free(interval);
+        free(name);
+      } break;
+    case MSG_COMMAND_UNSCHEDULE:
+      {
+        char *name = zmsg_popstr(arguments);
+        if (scheduler_remove(self->scheduler, name) == STATUS_OK)
+          ret = MSG_ANSWER_COMPLETED;
+        else
+          ret = MSG_ANSWER_EXECERROR;
+        free(name);
+      } break;
+    case MSG_COMMAND_KILL:
+      {
+        char *target = zmsg_popstr(arguments);
+        if (tasks_kill(self->tasks, target) == STATUS_OK)
+          ret = MSG_ANSWER_COMPLETED;
+        else
+          ret = MSG_ANSWER_EXECERROR;
+        free(target);
+      } break;
+    case MSG_COMMAND_TASKS:
+      {
+        zmsg_t *list = tasks_list(self->tasks, device_uuid, msgid);
+        s_send(&list, control_socket);
+        ret = MSG_ANSWER_COMPLETED;
       } break;
     case MSG_COMMAND_PUSH:
-      ret = messages_push(msgid, arguments);
-      break;
+    case MSG_COMMAND_SYNC:
+    case MSG_COMMAND_SYNCAPPLY:
+      {
+        /*  Hand the payload over to the file I/O stage, the answer comes later */
+        zframe_t *frame = NULL;
+        zmsg_t *job = zmsg_new();
+        zmsg_addstr(job, "%s", msgid);
+        zmsg_addmem(job, &command, sizeof(command));
+        while ((frame = zmsg_pop(arguments)) != NULL)
+          zmsg_add(job, frame);
+        zmsg_send(&job, self->fileio);
+        self->fileio_pending++;
+        ret = MSG_ANSWER_PENDING;
+      } break;
   }
 
   return ret;
 }
 
-static void s_check_children_termination(zlist_t *processlist, char *device_id, void *socket)
+static void s_replay_message(worker_t *self, char *msgid, dedup_entry *seen)
 {
-  int status;
-  process_item *item = zlist_first(processlist);
-  while (item != NULL) {
-    // TODO make this act on THREADS
-    if (waitpid(item->pid, &status, WNOHANG) != 0) {
-      zmsg_t *answer = zmsg_new();
-      zmsg_pushstr(answer, "%s", MSG_ANSWER_STR_COMPLETED);
-      zmsg_pushstr(answer, "%s", item->message_id);
-      zmsg_pushstr(answer, "%s", device_id);
-      zmsg_send(&answer, socket);
-      free(item->message_id);
-      free(item->command);
-      zlist_remove(processlist, item);
-      free(item);
-    }
-    item = zlist_next(processlist);
+  /*  Retransmitted message: answer with its latest status, do not run it again */
+  int status = seen->status;
+  process_item *item = tasks_lookup(self->tasks, msgid);
+  if (status == MSG_ANSWER_TASK && (item == NULL || item->finished))
+    status = MSG_ANSWER_COMPLETED;
+
+  /*  Still in the file I/O stage, or a status queued behind output or chunks:
+   *  the MSGACCEPTED just sent stands, the status comes once */
+  if (status == MSG_ANSWER_PENDING
+      || (status != MSG_ANSWER_TASK && tasks_answer_queued(self->tasks, msgid))) {
+    debugLog("Duplicate message %s, still in progress", msgid);
+    return;
   }
+
+  debugLog("Duplicate message %s, replaying status 0x%02x", msgid, status);
+
+  zmsg_t *answer = messages_exec_result2msg(device_uuid, status, msgid);
+  if (answer != NULL)
+    s_send(&answer, answer_socket);
+}
+
+/*  Control commands are answered on the control lane */
+static bool s_is_control(uint8_t command)
+{
+  return command == MSG_COMMAND_KILL || command == MSG_COMMAND_TASKS;
 }
 
-static void s_server_message (zmsg_t *message)
+static void s_server_message (worker_t *self, validated_t *validated)
 {
-  /*  Server message, to be processed  */
-  uint8_t command;
-  int ret = STATUS_ERROR;
-  zmsg_t *arguments = NULL;
-  char *msgid = NULL;
+  /*  Server message, parsed by a validation thread, to be processed  */
+  int ret = validated->status;
+  uint8_t command = validated->command;
+  zmsg_t *arguments = validated->arguments;
+  char *msgid = validated->msgid;
+  void *socket = s_is_control(command) ? control_socket : answer_socket;
   zmsg_t *answer = NULL;
+  dedup_entry *seen = NULL;
+
+  if (ret == MSG_ANSWER_IGNORED)
+    return;
 
-  ret = s_parse_message(message, &msgid, &command, &arguments);
-  answer = messages_parse_result2msg(device_uuid, ret, msgid, message);
+  answer = messages_parse_result2msg(device_uuid, ret, msgid, validated->message);
   assert(answer != NULL);
-  zmsg_send(&answer, answer_socket);
+  s_send(&answer, socket);
+
+  /*  A SYNC only reads, and its manifest cannot be replayed: it runs again */
+  bool remembered = command != MSG_COMMAND_SYNC;
+
+  if (ret == MSG_ANSWER_ACCEPTED && remembered && (seen = dedup_lookup(self->recent, msgid)) != NULL) {
+    s_replay_message(self, msgid, seen);
+  } else if (ret == MSG_ANSWER_ACCEPTED) {
+    /*  Pending until its status is known, which a TAIL records itself */
+    if (remembered)
+      dedup_insert(self->recent, msgid, MSG_ANSWER_PENDING);
+    ret = s_process_message(self, msgid, command, arguments);
+    if (ret != MSG_ANSWER_PENDING) {
+      if (remembered)
+        dedup_insert(self->recent, msgid, ret);
+      answer = messages_exec_result2msg(device_uuid, ret, msgid);
+      assert(answer != NULL);
+      s_send(&answer, socket);
+    }
+  }
+}
 
-  if (ret == MSG_ANSWER_ACCEPTED) {
-    ret = s_process_message(msgid, command, arguments);
-    answer = messages_exec_result2msg(device_uuid, ret, msgid);
-    assert(answer != NULL);
-    zmsg_send(&answer, answer_socket);
+/*  Hand a received message over to its validation thread */
+static void s_submit_message (zmsg_t *message)
+{
+  if (recorder != NULL)
+    capture_record(recorder, CAPTURE_IN, message);
+  __sync_add_and_fetch(&queued_commands, 1);
+  if (!validator_submit(validators, &message)) {
+    errorLog("Validation queue full, message dropped");
+    __sync_sub_and_fetch(&queued_commands, 1);
+    zmsg_destroy(&message);
+  }
+}
+
+static void s_fileio_result (worker_t *self, zmsg_t *result)
+{
+  /*  Completion of a job from the file I/O stage */
+  char *msgid = zmsg_popstr(result);
+  zframe_t *command = zmsg_pop(result);
+  zframe_t *code = zmsg_pop(result);
+
+  /*  Reads of the PULL tasks are not counted as queued jobs */
+  bool read = command != NULL && zframe_size(command) == 1 && zframe_data(command)[0] == MSG_COMMAND_PULL;
+  if (!read)
+    self->fileio_pending--;
+
+  if (read && msgid != NULL && code != NULL && zframe_size(code) == 1) {
+    tasks_read_result(self->tasks, msgid, zframe_data(code)[0], result, device_uuid);
+  } else if (msgid != NULL && code != NULL && zframe_size(code) == 1) {
+    int ret = zframe_data(code)[0];
+    /*  A payload found corrupted while written may be sent again; a SYNC is
+     *  not remembered at all */
+    bool sync = command != NULL && zframe_size(command) == 1 && zframe_data(command)[0] == MSG_COMMAND_SYNC;
+    if (ret == MSG_ANSWER_BADCRC)
+      dedup_forget(self->recent, msgid);
+    else if (!sync)
+      dedup_insert(self->recent, msgid, ret);
+    if (zmsg_size(result) > 0) {
+      /*  SYNC manifest, ahead of its status on the same lane */
+      zmsg_t *manifest = utils_gen_msg(device_uuid, msgid, MSG_ANSWER_STR_MANIFEST, NULL, 0);
+      zframe_t *frame;
+      while ((frame = zmsg_pop(result)) != NULL)
+        zmsg_add(manifest, frame);
+      s_send(&manifest, control_socket);
+    }
+    zmsg_t *answer = messages_exec_result2msg(device_uuid, ret, msgid);
+    if (answer != NULL)
+      s_send(&answer, control_socket);
   }
 
   if (msgid)
     free(msgid);
-  if (arguments)
-    zmsg_destroy(&arguments);
+  if (command)
+    zframe_destroy(&command);
+  if (code)
+    zframe_destroy(&code);
+}
+
+static bool s_direct_transport(void)
+{
+  return transport != NULL && str_equals(transport, TRANSPORT_DEALER);
+}
+
+static int64_t s_next_heartbeat(void)
+{
+  int64_t delay = (int64_t)heartbeat_interval * 1000;
+  if (heartbeat_jitter > 0)
+    delay += random() % (heartbeat_jitter * 1000);
+  return zclock_time() + delay;
+}
+
+static void s_send_heartbeat(worker_t *self)
+{
+  heartbeat_t heartbeat;
+
+  /*  A heartbeat that cannot be sent right away is stale, drop it */
+  if (!(zsocket_events(control_socket) & ZMQ_POLLOUT))
+    return;
+
+  heartbeat_sample(&heartbeat);
+  heartbeat.tasks = zlist_size(self->tasks->items);
+  heartbeat.queued_messages = self->tasks->outbox_messages;
+  heartbeat.queued_bytes = self->tasks->outbox_bytes;
+  heartbeat.queued_commands = queued_commands;
+  heartbeat.queued_files = self->fileio_pending;
+  heartbeat.flags = HEARTBEAT_FLAG_CRC32C;
+  if (checksum_crc32c_accelerated())
+    heartbeat.flags |= HEARTBEAT_FLAG_CRC32C_HW;
+
+  zmsg_t *msg = heartbeat_msg(device_uuid, &heartbeat);
+  s_send(&msg, control_socket);
 }
 
 static void s_worker_loop (void *user_args, zctx_t *ctx, void *pipe)
 {
-  zlist_t *process_items = zlist_new();
+  worker_t self;
+  self.tasks = tasks_new(task_budget, global_budget);
+  tasks_set_shaping(self.tasks, shaping_rate, shaping_burst, shaping_task_rate, shaping_task_burst);
+  self.recent = dedup_new(dedup_size, (int64_t)dedup_ttl * 1000);
+  self.fileio = zthread_fork(ctx, fileio_loop, io_engine);
+  self.fileio_pending = 0;
+  self.tasks->recorder = recorder;
+  self.tasks->spawner = spawner;
+  assert(self.fileio);
+
+  srandom(getpid() ^ zclock_time());
+  int64_t next_heartbeat = s_next_heartbeat();
+  self.scheduler = scheduler_new(schedule_file, batch_interval);
+  self.cache = cache_new(cache_budget);
+  self.events = local_new(local_budget, local_linger);
+  self.local = NULL;
+  if (local_endpoint[0] != 0) {
+    /*  zmq binds an ipc endpoint in the calling thread: its socket file is
+     *  created with LOCAL_SOCKET_MODE, and is never open to all. No other
+     *  thread creates files yet, the umask is theirs too. */
+    mode_t mask = umask(0777 & ~LOCAL_SOCKET_MODE);
+    self.local = zeromq_create_socket(ctx, local_endpoint, ZMQ_PULL, NULL, false, -1, LOCAL_SOCKET_HWM);
+    umask(mask);
+    assert(self.local);
+  }
+
+  /*  Sockets and pipes of the tasks, bounded by the task table */
+  zmq_pollitem_t items[5 + 2 * TASK_MAX];
+  process_item *owners[5 + 2 * TASK_MAX];
+  memset(items, 0, sizeof(items));
 
   while (!zctx_interrupted) {
 
-    s_check_children_termination(process_items, device_uuid, answer_socket);
+    /*  Validated messages, file I/O stage, local events, task outputs and the
+     *  answer sockets when output is queued. In dealer mode, commands are received on the
+     *  answer socket as well. Validated commands wait while the file I/O
+     *  stage is full, new ones while too many are being validated; control
+     *  commands never wait. */
+    bool accepting = self.fileio_pending < FILEIO_QUEUE_DEPTH;
+    bool control_pending = tasks_control_pending(self.tasks);
+    int max = 2 * TASK_MAX; // stdout and stdin
+
+    items[0].socket = NULL;
+    items[0].fd = validators->ready_fd;
+    items[0].events = ZMQ_POLLIN;
+    /*  Shaped output waits for its tokens, local events for their batch, not
+     *  for the socket */
+    int64_t send_delay = tasks_send_delay(self.tasks);
+    int64_t local_delay_ms = local_delay(self.events);
+    items[1].socket = answer_socket;
+    items[1].events = send_delay == 0 || local_delay_ms == 0 ? ZMQ_POLLOUT : 0;
+    if (control_pending && control_socket == answer_socket)
+      items[1].events = ZMQ_POLLOUT;
+    if (s_direct_transport() && queued_commands < COMMAND_QUEUE_DEPTH)
+      items[1].events |= ZMQ_POLLIN;
+    items[2].socket = self.fileio;
+    items[2].events = ZMQ_POLLIN;
+    items[3].socket = control_socket;
+    items[3].events = control_pending && control_socket != answer_socket ? ZMQ_POLLOUT : 0;
+    items[4].socket = self.local;
+    items[4].events = self.local != NULL && local_accepting(self.events) ? ZMQ_POLLIN : 0;
+    tasks_read_files(self.tasks, self.fileio);
+    int count = 5 + tasks_poll_items(self.tasks, items + 5, owners + 5, max);
+
+    /*  Do not sleep while validated messages are left from the previous round */
+    bool ready = validator_pending(validators, !accepting);
+    int timeout = ready ? 0 : MAIN_SLEEP_TIME;
+    if (send_delay > 0 && send_delay < timeout)
+      timeout = send_delay;
+    if (local_delay_ms > 0 && local_delay_ms < timeout)
+      timeout = local_delay_ms;
+    if (zmq_poll(items, count, timeout * ZMQ_POLL_MSEC) == -1)
+      break; // Interrupted
+
+    int i;
+    for (i = 5; i < count; i++) {
+      if (items[i].events & ZMQ_POLLOUT) {
+        if (items[i].revents & (ZMQ_POLLOUT | ZMQ_POLLERR))
+          tasks_write_input(self.tasks, owners[i], device_uuid);
+      } else if (items[i].revents & (ZMQ_POLLIN | ZMQ_POLLERR)) {
+        tasks_read_output(self.tasks, owners[i], device_uuid);
+      }
+    }
 
-    if (zsocket_poll(pipe, 0)) {
-      zmsg_t *message = zmsg_recv (pipe);
-      if (!message) continue;
+    scheduler_collect(self.scheduler, self.tasks);
+    cache_collect(self.cache, self.tasks, device_uuid);
+    tasks_reap(self.tasks, device_uuid);
+    scheduler_run(self.scheduler, self.tasks);
+    tasks_flush(self.tasks, answer_socket, control_socket);
+
+    /*  Scheduled results and local events wait in their batch until the
+     *  socket has room */
+    if (zsocket_events(answer_socket) & ZMQ_POLLOUT) {
+      zmsg_t *batch = scheduler_batch(self.scheduler, device_uuid);
+      if (batch != NULL)
+        s_send(&batch, answer_socket);
+    }
+    if (zsocket_events(answer_socket) & ZMQ_POLLOUT) {
+      zmsg_t *batch = local_batch(self.events, device_uuid);
+      if (batch != NULL)
+        s_send(&batch, answer_socket);
+    }
 
-      char *header = zmsg_popstr(message);
-      if (str_equals(header, MSG_INTERNAL)) {
-        process_item *item = utils_msg2processitem(message);
-        zlist_append(process_items, item);
-      } else if (str_equals(header, MSG_SERVER)) {
-        s_server_message(message);
+    /*  Local events, as long as the queue has room */
+    if (items[4].revents & ZMQ_POLLIN) {
+      while (local_accepting(self.events) && (zsocket_events(self.local) & ZMQ_POLLIN)) {
+        zmsg_t *event = zmsg_recv (self.local);
+        if (event == NULL)
+          break;
+        local_push(self.events, &event);
       }
+    }
 
-      zmsg_destroy(&message);
+    if (heartbeat_interval > 0 && zclock_time() >= next_heartbeat) {
+      s_send_heartbeat(&self);
+      next_heartbeat = s_next_heartbeat();
     }
-    usleep(MAIN_SLEEP_TIME*1000);
+
+    /*  Read chunks come back along with the job results: take them all */
+    while (zsocket_events(self.fileio) & ZMQ_POLLIN) {
+      zmsg_t *result = zmsg_recv (self.fileio);
+      if (result == NULL)
+        break;
+      s_fileio_result(&self, result);
+      zmsg_destroy(&result);
+    }
+
+    if (items[0].revents & ZMQ_POLLIN)
+      validator_clear(validators);
+
+    /*  Control commands are taken even while the file I/O stage is full */
+    validated_t *validated = NULL;
+    while ((validated = validator_next(validators, self.fileio_pending >= FILEIO_QUEUE_DEPTH)) != NULL) {
+      __sync_sub_and_fetch(&queued_commands, 1);
+      s_server_message(&self, validated);
+      validated_destroy(&validated);
+    }
+
+    if (items[1].revents & ZMQ_POLLIN) {
+      zmsg_t *message = zmsg_recv (answer_socket);
+      if (message != NULL)
+        s_submit_message(message);
+    }
+
+    /*  Stopped by the main thread */
+    if (zsocket_events(pipe) & ZMQ_POLLIN)
+      break;
   }
 
-  zlist_destroy(&process_items);
+  dedup_destroy(&self.recent);
+  scheduler_destroy(&self.scheduler);
+  cache_destroy(&self.cache);
+  local_destroy(&self.events);
+  if (self.local != NULL)
+    zsocket_destroy(ctx, self.local);
+  tasks_destroy(&self.tasks);
+
+  /*  Done with the validators: the main thread may destroy them */
+  zframe_t *done = zframe_new(NULL, 0);
+  zframe_send(&done, pipe, 0);
 }
 
 int main(int argc, char *argv[])
@@ -347,41 +1163,169 @@ int main(int argc, char *argv[])
   device_uuid = config_get_str(cfg_ctx, "satan.info.uuid");
   command_endpoint = config_get_str(cfg_ctx, "satan.info.commands");
   answer_endpoint = config_get_str(cfg_ctx, "satan.info.answers");
+  control_endpoint = config_get_str(cfg_ctx, "satan.info.control");
+  control_answer_endpoint = config_get_str(cfg_ctx, "satan.info.control_answers");
+  transport = config_get_str(cfg_ctx, "satan.info.transport");
+  io_engine = config_get_str(cfg_ctx, "satan.io.engine");
+  char *local = config_get_str(cfg_ctx, "satan.local.endpoint");
+  if (local != NULL)
+    local_endpoint = local;
+  if (config_get_int(cfg_ctx, "satan.local.budget") > 0)
+    local_budget = config_get_int(cfg_ctx, "satan.local.budget");
+  if (config_get_int(cfg_ctx, "satan.local.linger") >= 0)
+    local_linger = config_get_int(cfg_ctx, "satan.local.linger");
+  char *group_list = config_get_str(cfg_ctx, "satan.info.groups");
+  if (group_list != NULL) {
+    s_set_groups(group_list);
+    free(group_list);
+  }
+  if (config_get_int(cfg_ctx, "satan.limits.task_budget") > 0)
+    task_budget = config_get_int(cfg_ctx, "satan.limits.task_budget");
+  if (config_get_int(cfg_ctx, "satan.limits.global_budget") > 0)
+    global_budget = config_get_int(cfg_ctx, "satan.limits.global_budget");
+  if (config_get_int(cfg_ctx, "satan.dedup.size") > 0)
+    dedup_size = config_get_int(cfg_ctx, "satan.dedup.size");
+  if (config_get_int(cfg_ctx, "satan.dedup.ttl") > 0)
+    dedup_ttl = config_get_int(cfg_ctx, "satan.dedup.ttl");
+  if (config_get_int(cfg_ctx, "satan.heartbeat.interval") >= 0)
+    heartbeat_interval = config_get_int(cfg_ctx, "satan.heartbeat.interval");
+  if (config_get_int(cfg_ctx, "satan.heartbeat.jitter") >= 0)
+    heartbeat_jitter = config_get_int(cfg_ctx, "satan.heartbeat.jitter");
+  if (config_get_int(cfg_ctx, "satan.cache.budget") >= 0)
+    cache_budget = config_get_int(cfg_ctx, "satan.cache.budget");
+  char *file = config_get_str(cfg_ctx, "satan.scheduler.file");
+  if (file != NULL)
+    schedule_file = file;
+  if (config_get_int(cfg_ctx, "satan.scheduler.flush") > 0)
+    batch_interval = config_get_int(cfg_ctx, "satan.scheduler.flush");
+  if (config_get_int(cfg_ctx, "satan.validation.threads") > 0)
+    validation_threads = config_get_int(cfg_ctx, "satan.validation.threads");
+  capture_file = config_get_str(cfg_ctx, "satan.capture.file");
+  if (config_get_int(cfg_ctx, "satan.capture.max") >= 0)
+    capture_max = config_get_int(cfg_ctx, "satan.capture.max");
+  if (config_get_int(cfg_ctx, "satan.shaping.rate") >= 0)
+    shaping_rate = config_get_int(cfg_ctx, "satan.shaping.rate");
+  if (config_get_int(cfg_ctx, "satan.shaping.burst") >= 0)
+    shaping_burst = config_get_int(cfg_ctx, "satan.shaping.burst");
+  if (config_get_int(cfg_ctx, "satan.shaping.task_rate") >= 0)
+    shaping_task_rate = config_get_int(cfg_ctx, "satan.shaping.task_rate");
+  if (config_get_int(cfg_ctx, "satan.shaping.task_burst") >= 0)
+    shaping_task_burst = config_get_int(cfg_ctx, "satan.shaping.task_burst");
+  if (config_get_int(cfg_ctx, "satan.exec.spawner") >= 0)
+    use_spawner = config_get_int(cfg_ctx, "satan.exec.spawner");
   config_destroy(cfg_ctx);
 #else
   device_uuid = DEFAULT_DEVICE_UUID;
   command_endpoint = DEFAULT_COMMANDS_ENDPOINT;
   answer_endpoint = DEFAULT_ANSWERS_ENDPOINT;
+  transport = DEFAULT_TRANSPORT;
 #endif
 
   /*  override with command line args */
   s_handle_cmdline(argc, argv);
 
+  /*  While we are still a single small thread: tasks are spawned from there */
+  if (use_spawner)
+    spawner = spawner_new();
+
+  /*  Before any thread computes a checksum */
+  checksum_init();
+
+  /*  A task closing its stdin must not take us down */
+  signal(SIGPIPE, SIG_IGN);
+
+  /*  Parsing and checksums run on their own threads, one per core by default */
+  if (validation_threads <= 0)
+    validation_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  validators = validator_new(validation_threads, COMMAND_QUEUE_DEPTH, s_parse_message);
+
+  /*  Traffic recording, for bench/replay.py */
+  if (capture_file != NULL && capture_file[0] != 0)
+    recorder = capture_new(capture_file, capture_max);
+
   /*  zmq sockets and internal pipe  */
   zctx_t *zmq_ctx = zctx_new ();
-  void *command_socket = zeromq_create_socket(zmq_ctx, command_endpoint, ZMQ_SUB, device_uuid, true, -1, -1);
-  answer_socket = zeromq_create_socket(zmq_ctx, answer_endpoint, ZMQ_PUSH, NULL, true, -1, -1);
+  void *command_socket = NULL;
+  void *control_command_socket = NULL;
+  if (s_direct_transport()) {
+    /*  The server addresses us by identity, answers go back on the same socket */
+    answer_socket = zeromq_create_socket(zmq_ctx, command_endpoint, ZMQ_DEALER, device_uuid, true, -1, ANSWER_SOCKET_HWM);
+  } else {
+    command_socket = zeromq_create_socket(zmq_ctx, command_endpoint, ZMQ_SUB, device_uuid, true, -1, -1);
+    int i;
+    for (i = 0; i < group_count; i++)
+      zsocket_set_subscribe (command_socket, groups[i]);
+    answer_socket = zeromq_create_socket(zmq_ctx, answer_endpoint, ZMQ_PUSH, NULL, true, -1, ANSWER_SOCKET_HWM);
+    assert (command_socket != NULL);
+  }
+
+  /*  Optional control lane, so that KILL, TASKS, heartbeats and final statuses
+   *  do not queue behind bulk transfers in the network either */
+  control_socket = answer_socket;
+  if (control_endpoint != NULL) {
+    control_command_socket = zeromq_create_socket(zmq_ctx, control_endpoint, ZMQ_SUB, device_uuid, true, -1, -1);
+    int i;
+    for (i = 0; i < group_count; i++)
+      zsocket_set_subscribe (control_command_socket, groups[i]);
+    assert (control_command_socket != NULL);
+  }
+  if (control_answer_endpoint != NULL) {
+    control_socket = zeromq_create_socket(zmq_ctx, control_answer_endpoint, ZMQ_PUSH, NULL, true, -1, ANSWER_SOCKET_HWM);
+    assert (control_socket != NULL);
+  }
   internal_pipe = zthread_fork(zmq_ctx, s_worker_loop, NULL);
 
-  assert (command_socket != NULL);
   assert (answer_socket != NULL);
   assert (internal_pipe != NULL);
 
   /*  Main listener loop */
   while (!zctx_interrupted) {
-    if (zsocket_poll(command_socket, 0)) {
-      zmsg_t *message = zmsg_recv (command_socket);
-      if (message != NULL){
-        zmsg_pushstr (message, MSG_SERVER);
-        zmsg_send (&message, internal_pipe);
+    /*  Leave commands in the SUB socket while the worker is lagging behind,
+     *  take bursts in as fast as they come otherwise. The control lane is
+     *  always read, and first. */
+    zmq_pollitem_t items[] = {
+      { control_command_socket, 0, control_command_socket != NULL ? ZMQ_POLLIN : 0, 0 },
+      { command_socket, 0, command_socket != NULL && queued_commands < COMMAND_QUEUE_DEPTH ? ZMQ_POLLIN : 0, 0 }
+    };
+    if (items[0].events == 0 && items[1].events == 0) {
+      usleep(MAIN_SLEEP_TIME*1000); // Sleep MAIN_SLEEP_TIME msecs
+      continue;
+    }
+    if (zmq_poll(items, 2, MAIN_SLEEP_TIME * ZMQ_POLL_MSEC) == -1)
+      break; // Interrupted
+
+    int i;
+    for (i = 0; i < 2; i++) {
+      if (items[i].revents & ZMQ_POLLIN) {
+        zmsg_t *message = zmsg_recv (items[i].socket);
+        if (message != NULL)
+          s_submit_message(message);
       }
     }
-    usleep(MAIN_SLEEP_TIME*1000); // Sleep MAIN_SLEEP_TIME msecs
   }
 
-  zsocket_destroy (zmq_ctx, command_socket);
+  /*  Stop the worker and wait for it: it takes from the validators, and
+   *  sends on the sockets of the context */
+  zframe_t *stop = zframe_new(NULL, 0);
+  zframe_send(&stop, internal_pipe, 0);
+  while ((stop = zframe_recv(internal_pipe)) == NULL && errno == EINTR)
+    ;
+  zframe_destroy(&stop);
+
+  /*  Nobody collects results anymore */
+  validator_destroy(&validators);
+
+  if (command_socket != NULL)
+    zsocket_destroy (zmq_ctx, command_socket);
+  if (control_command_socket != NULL)
+    zsocket_destroy (zmq_ctx, control_command_socket);
+  if (control_socket != answer_socket)
+    zsocket_destroy (zmq_ctx, control_socket);
   zsocket_destroy (zmq_ctx, answer_socket);
   zctx_destroy (&zmq_ctx);
 
+  capture_destroy(&recorder);
+  spawner_destroy(&spawner);
+
   return 0;
 }
@@ -22,6 +22,7 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <unistd.h>
+#include "profile.h"
 
 #ifndef _SATAN_MAIN_H_
 #define _SATAN_MAIN_H_
@@ -50,15 +51,8 @@ extern "C" {
 #define STATUS_OK 0
 #define STATUS_ERROR -1
 
-#define MAX_STRING_LEN 256
 #define str_equals(a,b) strncmp(a,b,MAX_STRING_LEN) == 0
 
-typedef struct s_process_item_t {
-  pid_t pid;
-  char *message_id;
-  char *command;
-} process_item;
-
 #ifdef __cplusplus
 }
 #endif
@@ -21,54 +21,174 @@
 #include "main.h"
 #include "messages.h"
 #include "utils.h"
+#include "checksum.h"
+#include "superfasthash.h"
 
-pid_t messages_exec(const char *device_id, const char *msgid, const char *push_endpoint, const char *cmd)
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#ifndef RENAME_NOREPLACE
+#define RENAME_NOREPLACE (1 << 0)
+#endif
+
+#define PUSH_STAGED_SUFFIX ".satan-push"
+
+/*  Through the spawn helper while it runs, forked from here otherwise, without a cgroup */
+pid_t messages_exec(spawner_t *spawner, const char *cmd, bool shell, const spawn_limits *limits,
+    int *output_fd, int *input_fd, uint32_t *cgroup)
 {
 	int pid = -1;
 
-	assert(device_id);
-  assert(msgid);
-	assert(push_endpoint);
   assert(cmd);
+  assert(output_fd);
+  assert(cgroup);
 
-  pid = utils_execute_task(cmd, device_id, msgid, push_endpoint);
+  *cgroup = 0;
+  if (spawner_running(spawner))
+    pid = spawner_exec(spawner, cmd, shell, limits, output_fd, input_fd, cgroup);
+  else
+    pid = utils_execute_task(cmd, shell, limits, output_fd, input_fd);
   if ((pid == 0) || (pid == -1)) return -1;
 
   return pid;
 }
 
-int messages_push(char *msgid, zmsg_t *arguments)
+typedef struct {
+  checksum_stream stream;
+  size_t len;
+} s_push_sum_t;
+
+/*  Sum the payload batch by batch, while it is written */
+static void s_push_overlap(const uint8_t *data, size_t end, void *arg)
+{
+  s_push_sum_t *sum = arg;
+  checksum_stream_update(&sum->stream, data, end, sum->len);
+}
+
+/*  Into place without replacing anything. Where the filesystem has no hard
+ *  links (vfat, exFAT, some FUSE) the staged file is renamed with
+ *  RENAME_NOREPLACE instead, or the data written again with O_EXCL. */
+static int s_push_place(ioengine_t *engine, const char *staged, const char *filename,
+    const uint8_t *data, size_t size)
+{
+  int ret = link(staged, filename);
+
+  if (ret != 0 && (errno == EPERM || errno == ENOTSUP || errno == ENOSYS)) {
+#ifdef SYS_renameat2
+    ret = syscall(SYS_renameat2, AT_FDCWD, staged, AT_FDCWD, filename, RENAME_NOREPLACE);
+    if (ret == 0)
+      return STATUS_OK; // nothing left to unlink
+#endif
+    if (errno != EEXIST)
+      ret = ioengine_write_file(engine, filename, data, size);
+  }
+  unlink(staged);
+  return ret == 0 ? STATUS_OK : STATUS_ERROR;
+}
+
+/*  Staged where no name shows, since the file name itself is unverified with
+ *  a deferred sum; -1 where O_TMPFILE is not supported */
+static int s_push_anonymous(const char *filename)
+{
+#ifdef O_TMPFILE
+  char directory[PATH_MAX];
+  char *slash;
+
+  snprintf(directory, PATH_MAX, "%s", filename);
+  slash = strrchr(directory, '/');
+  if (slash == NULL)
+    snprintf(directory, PATH_MAX, ".");
+  else
+    slash[slash == directory ? 1 : 0] = 0;
+  return open(directory, O_TMPFILE | O_WRONLY | O_CLOEXEC, S_IRUSR | S_IWUSR | S_IRGRP);
+#else
+  return -1;
+#endif
+}
+
+/*  Written aside, then linked into place once complete and verified */
+int messages_push(ioengine_t *engine, char *msgid, zmsg_t *arguments)
 {
 	int ret;
-  char filename[MAX_STRING_LEN];
-	zframe_t *param = NULL;
+  char filename[PATH_MAX], staged[PATH_MAX];
+	zframe_t *verify = NULL, *param = NULL;
+  char *file = NULL;
   uint8_t *data = NULL;
-  int size = 0;
+  int size = 0, fd = -1;
+  s_push_sum_t sum;
 
+  assert(engine);
   assert(msgid);
 	assert(arguments);
 
+  verify = zmsg_pop(arguments);
   param = zmsg_pop(arguments);
-  if (param == NULL) goto s_msg_push_parseerror;
+  if (verify == NULL || param == NULL) goto s_msg_push_parseerror;
   data = zframe_data(param);
   size = zframe_size(param);
 
   if (zmsg_size(arguments) > 0) {
-    char *file = zmsg_popstr(arguments);
-    ret = utils_write_file(file,(char*)data,size);
-    free(file);
+    file = zmsg_popstr(arguments);
+    snprintf(filename, PATH_MAX, "%s", file);
   } else {
-    sprintf(filename, "/tmp/%s", msgid);
-    ret = utils_write_file(filename,(char*)data,size);
+    snprintf(filename, PATH_MAX, "/tmp/%s", msgid);
   }
+  snprintf(staged, PATH_MAX, "%s%s", filename, PUSH_STAGED_SUFFIX);
 
-  if (ret != STATUS_OK) goto s_msg_push_execerror;
+  /*  Never over an existing file */
+  if (access(filename, F_OK) == 0) goto s_msg_push_execerror;
+
+  bool deferred = zframe_size(verify) == MSG_PUSH_VERIFY_SIZE;
+  if (deferred)
+    checksum_stream_init(&sum.stream, zframe_data(verify)[0], get32bits(zframe_data(verify) + 1));
+  sum.len = size;
+
+  /*  Summed while written to an unnamed file, else before anything is written */
+  if (deferred)
+    fd = s_push_anonymous(filename);
+  if (fd != -1) {
+    ret = ioengine_write_fd_overlap(engine, fd, data, size, s_push_overlap, &sum);
+    if (ret != STATUS_OK) goto s_msg_push_execerror;
+  }
+  if (deferred) {
+    checksum_stream_update(&sum.stream, data, size, size);
+    uint32_t computed = sum.stream.sum;
+    if (file != NULL)
+      computed = checksum_update(sum.stream.algorithm, computed, (uint8_t*)file, strlen(file));
+    if (computed != get32bits(zframe_data(verify) + 5)) {
+      ret = MSG_ANSWER_BADCRC;
+      goto s_msg_push_end;
+    }
+  }
+
+  if (fd != -1) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+    ret = linkat(AT_FDCWD, path, AT_FDCWD, filename, AT_SYMLINK_FOLLOW);
+    if (ret != 0 && errno != EEXIST)
+      ret = ioengine_write_file(engine, filename, data, size);
+    if (ret != 0) goto s_msg_push_execerror;
+  } else {
+    unlink(staged); // left over by an interrupted PUSH
+    ret = ioengine_write_file(engine, staged, data, size);
+    if (ret != STATUS_OK) goto s_msg_push_execerror;
+    if (s_push_place(engine, staged, filename, data, size) != STATUS_OK) goto s_msg_push_execerror;
+  }
 
 	ret = MSG_ANSWER_COMPLETED;
 
 s_msg_push_end:
+  if (fd != -1)
+    close(fd);
+  if (file)
+    free(file);
 	if (param)
-		free(param);
+		zframe_destroy(&param);
+  if (verify)
+    zframe_destroy(&verify);
 	return ret;
 
 s_msg_push_execerror:
@@ -80,6 +200,75 @@ s_msg_push_parseerror:
 	goto s_msg_push_end;
 }
 
+int messages_pull(const char *filename)
+{
+  assert(filename);
+
+  return open(filename, O_RDONLY | O_CLOEXEC);
+}
+
+/*  Options each command accepts */
+static const struct {
+  uint8_t command;
+  const char *key;
+} s_options[] = {
+  { MSG_COMMAND_EXEC, MSG_OPTION_STDIN },
+  { MSG_COMMAND_EXEC, MSG_OPTION_RING },
+  { MSG_COMMAND_EXEC, MSG_OPTION_TTL },
+  { MSG_COMMAND_EXEC, MSG_OPTION_RATE },
+  { MSG_COMMAND_EXEC, MSG_OPTION_BURST },
+  { MSG_COMMAND_EXEC, MSG_OPTION_SHELL },
+  { MSG_COMMAND_EXEC, MSG_OPTION_TIMEOUT },
+  { MSG_COMMAND_EXEC, MSG_OPTION_CPU },
+  { MSG_COMMAND_EXEC, MSG_OPTION_MEM },
+  { MSG_COMMAND_EXEC, MSG_OPTION_NICE },
+  { MSG_COMMAND_EXEC, MSG_OPTION_IONICE },
+  { MSG_COMMAND_PULL, MSG_OPTION_GZIP },
+  { MSG_COMMAND_PULL, MSG_OPTION_RATE },
+  { MSG_COMMAND_PULL, MSG_OPTION_BURST },
+  { MSG_COMMAND_SCHEDULE, MSG_OPTION_JITTER },
+};
+
+bool messages_option_valid(uint8_t command, const char *option)
+{
+  assert(option);
+
+  const char *equal = strchr(option, '=');
+  size_t i;
+
+  if (equal == NULL || equal == option || equal[1] == 0)
+    return false;
+
+  for (i = 0; i < sizeof(s_options) / sizeof(s_options[0]); i++) {
+    if (s_options[i].command == command
+        && strlen(s_options[i].key) == (size_t)(equal - option)
+        && strncmp(s_options[i].key, option, equal - option) == 0)
+      return true;
+  }
+  return false;
+}
+
+/*  Value of the 'key=value' option among the remaining arguments, NULL if unset */
+char *messages_option(zmsg_t *arguments, const char *key)
+{
+  assert(arguments);
+  assert(key);
+
+  size_t len = strlen(key);
+  zframe_t *frame = zmsg_first(arguments);
+  while (frame != NULL) {
+    char *option = zframe_strdup(frame);
+    if (strncmp(option, key, len) == 0 && option[len] == '=') {
+      char *value = strdup(option + len + 1);
+      free(option);
+      return value;
+    }
+    free(option);
+    frame = zmsg_next(arguments);
+  }
+  return NULL;
+}
+
 zmsg_t *messages_parse_result2msg(char *device_id, int code, char *msgid, zmsg_t *original)
 {
   zmsg_t *answer = NULL;
@@ -140,6 +329,13 @@ zmsg_t *messages_exec_result2msg(char *device_id, int code, char *msgid)
 				zmsg_pushstr(answer, "%s", msgid);
 				zmsg_pushstr(answer, "%s", device_id);
 			} break;
+		case MSG_ANSWER_BADCRC:
+			{
+				answer = zmsg_new();
+				zmsg_pushstr(answer, "%s", MSG_ANSWER_STR_BADCRC);
+				zmsg_pushstr(answer, "%s", msgid);
+				zmsg_pushstr(answer, "%s", device_id);
+			} break;
 		case MSG_ANSWER_UNDEFERROR:
 			{
 				answer = zmsg_new();
@@ -19,6 +19,9 @@
  */
 
 #include <czmq.h>
+#include "ioengine.h"
+#include "spawner.h"
+#include "protocol.h"
 
 #ifndef _SATAN_MESSAGE_H_
 #define _SATAN_MESSAGE_H_
@@ -27,39 +30,24 @@
 extern "C" {
 #endif
 
-
-#define MSG_COMMAND_STR_EXEC          "EXEC"
-#define MSG_COMMAND_STR_PUSH          "PUSH"
-
-#define MSG_COMMAND_EXEC              0x01
-#define MSG_COMMAND_PUSH              0x02
-
-#define MSG_ANSWER_STR_ACCEPTED      "MSGACCEPTED"
-#define MSG_ANSWER_STR_COMPLETED     "MSGCOMPLETED"
-#define MSG_ANSWER_STR_BADCRC        "MSGBADCRC"
-#define MSG_ANSWER_STR_PARSEERROR    "MSGPARSEERROR"
-#define MSG_ANSWER_STR_UNREADABLE    "MSGUNREADABLE"
-#define MSG_ANSWER_STR_EXECERROR     "MSGEXECERROR"
-#define MSG_ANSWER_STR_UNDEFERROR    "MSGUNDEFERROR"
-#define MSG_ANSWER_STR_CMDOUTPUT     "MSGCMDOUTPUT"
-#define MSG_ANSWER_STR_TASK          "MSGTASK"
-
 // Internal use messages
 #define MSG_SERVER                   "MSGSERVER"
-#define MSG_INTERNAL                 "MSGINTERNAL"
 
-#define MSG_ANSWER_ACCEPTED          0x01
-#define MSG_ANSWER_CMDOUTPUT         0x40
-#define MSG_ANSWER_COMPLETED         0x80
-#define MSG_ANSWER_BADCRC            0x02
-#define MSG_ANSWER_PARSEERROR        0x08
-#define MSG_ANSWER_UNREADABLE        0x09 // The message is SO WRONG we cannot even answer.
-#define MSG_ANSWER_EXECERROR         0x0C
-#define MSG_ANSWER_UNDEFERROR        0x20
-#define MSG_ANSWER_TASK              0xC0
+// Internal answer codes
+#define MSG_ANSWER_IGNORED           0x00 // Not addressed to us, never answered.
+#define MSG_ANSWER_PENDING           0x10 // Handed over to another stage, answered later.
+
+// First PUSH argument: algorithm, sum of the frames before the payload and
+// expected sum, when the payload is checksummed while written; else empty
+#define MSG_PUSH_VERIFY_SIZE         9
+
+pid_t messages_exec(spawner_t *spawner, const char *cmd, bool shell, const spawn_limits *limits,
+    int *output_fd, int *input_fd, uint32_t *cgroup);
+int messages_push(ioengine_t *engine, char *msgid, zmsg_t *arguments);
+int messages_pull(const char *filename);
 
-pid_t messages_exec(const char *device_id, const char *msgid, const char *push_endpoint, const char *cmd);
-int messages_push(char *msgid, zmsg_t *arguments);
+bool messages_option_valid(uint8_t command, const char *option);
+char *messages_option(zmsg_t *arguments, const char *key);
 
 zmsg_t *messages_parse_result2msg(char *device_id, int code, char *msgid, zmsg_t *original);
 zmsg_t *messages_exec_result2msg(char *device_id, int code, char *msgid);
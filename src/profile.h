@@ -0,0 +1,95 @@
+/**
+ * =====================================================================================
+ *
+ *   @file profile.h
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  06/10/2013 09:31:08 AM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Compile-time limits: buffer sizes, queue depths and table sizes.
+ *
+ *       The tiny profile (./configure --enable-tiny) is for routers with a few
+ *       MB of flash and 32MB of RAM: smaller buffers and queues, a bounded
+ *       number of tasks, and the task and dedup tables in static arrays.
+ *       The queues left on the heap are bounded by these limits and budgets,
+ *       see the Tiny profile section of the README.
+ *       The DEFAULT_* values can still be changed through UCI.
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include "platform.h"
+
+#ifndef _SATAN_PROFILE_H_
+#define _SATAN_PROFILE_H_
+
+#define MAX_STRING_LEN 256      // ids, commands and paths; part of the protocol, same in all profiles
+
+#ifdef SATAN_TINY
+
+#define TASK_MAX              16          // tasks alive at once, statically allocated
+#define DEDUP_MAX             64          // remembered message ids, statically allocated
+#define LONG_BUFFER_LEN       1024        // task output read at once
+#define TASK_COALESCE_MAX     (4*1024)    // output messages merged while shaped or blocked
+#define COMMAND_QUEUE_DEPTH   16          // commands being validated or waiting for the worker
+#define FILEIO_QUEUE_DEPTH    4           // jobs waiting for the file I/O stage
+#define VALIDATOR_MAX         2
+#define IOENGINE_CHUNK_SIZE   (8*1024)
+#define IOENGINE_QUEUE_DEPTH  2           // requests per batch, and registered buffers
+#define TASK_INPUT_WINDOW     (16*1024)   // stdin bytes the server may have in flight
+#define TASK_RING_MAX         (64*1024)   // largest output ring buffer
+#define TASK_RING_TOTAL       (256*1024)  // all of them, lingering ones included
+#define SCHEDULER_MAX_ENTRIES 8
+#define SCHEDULER_BATCH_MAX   (8*1024)    // batch size that triggers an upload
+#define SCHEDULER_BATCH_LIMIT (16*1024)   // records held while the uplink has no room
+#define ARCHIVE_MAX_DEPTH     16
+#define LOCAL_BATCH_MAX       (4*1024)    // local events sent in a single message
+#define SYNC_ENTRIES_MAX      256         // files in a synchronized tree
+#define SYNC_CACHE_MAX        256         // file hashes remembered between SYNCs
+#define PUSH_DEFERRED_MIN     (64*1024)   // PUSH payloads checksummed while written, not on validation
+
+#define DEFAULT_TASK_BUDGET   (16*1024)
+#define DEFAULT_GLOBAL_BUDGET (64*1024)
+#define DEFAULT_DEDUP_SIZE    64
+#define DEFAULT_CACHE_BUDGET  (16*1024)   // bytes of cached EXEC results
+#define DEFAULT_LOCAL_BUDGET  (16*1024)   // bytes of local events queued
+
+#else
+
+#define TASK_MAX              256
+#define DEDUP_MAX             4096
+#define LONG_BUFFER_LEN       2000
+#define TASK_COALESCE_MAX     (16*1024)
+#define COMMAND_QUEUE_DEPTH   64
+#define FILEIO_QUEUE_DEPTH    16
+#define VALIDATOR_MAX         8
+#define IOENGINE_CHUNK_SIZE   (32*1024)
+#define IOENGINE_QUEUE_DEPTH  8
+#define TASK_INPUT_WINDOW     (64*1024)
+#define TASK_RING_MAX         (1024*1024)
+#define TASK_RING_TOTAL       (16*1024*1024)
+#define SCHEDULER_MAX_ENTRIES 32
+#define SCHEDULER_BATCH_MAX   (32*1024)
+#define SCHEDULER_BATCH_LIMIT (128*1024)
+#define ARCHIVE_MAX_DEPTH     32
+#define LOCAL_BATCH_MAX       (16*1024)
+#define SYNC_ENTRIES_MAX      4096
+#define SYNC_CACHE_MAX        4096
+#define PUSH_DEFERRED_MIN     (256*1024)
+
+#define DEFAULT_TASK_BUDGET   (64*1024)
+#define DEFAULT_GLOBAL_BUDGET (256*1024)
+#define DEFAULT_DEDUP_SIZE    256
+#define DEFAULT_CACHE_BUDGET  (64*1024)
+#define DEFAULT_LOCAL_BUDGET  (64*1024)
+
+#endif // SATAN_TINY
+
+#endif // _SATAN_PROFILE_H_
@@ -0,0 +1,107 @@
+/**
+ * =====================================================================================
+ *
+ *   @file protocol.h
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  06/21/2013 10:03:18 AM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Protocol constants: commands, options and answers, shared by the
+ *       daemon and the client library
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#ifndef _SATAN_PROTOCOL_H_
+#define _SATAN_PROTOCOL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MSG_COMMAND_STR_EXEC          "EXEC"
+#define MSG_COMMAND_STR_PUSH          "PUSH"
+#define MSG_COMMAND_STR_PULL          "PULL"
+#define MSG_COMMAND_STR_STDIN         "STDIN"
+#define MSG_COMMAND_STR_TAIL          "TAIL"
+#define MSG_COMMAND_STR_FOLLOW        "FOLLOW"
+#define MSG_COMMAND_STR_SCHEDULE      "SCHEDULE"
+#define MSG_COMMAND_STR_UNSCHEDULE    "UNSCHEDULE"
+#define MSG_COMMAND_STR_KILL          "KILL"
+#define MSG_COMMAND_STR_TASKS         "TASKS"
+#define MSG_COMMAND_STR_SYNC          "SYNC"
+#define MSG_COMMAND_STR_SYNCAPPLY     "SYNCAPPLY"
+
+#define MSG_COMMAND_EXEC              0x01
+#define MSG_COMMAND_PUSH              0x02
+#define MSG_COMMAND_PULL              0x03
+#define MSG_COMMAND_STDIN             0x04
+#define MSG_COMMAND_TAIL              0x05
+#define MSG_COMMAND_FOLLOW            0x06
+#define MSG_COMMAND_SCHEDULE          0x07
+#define MSG_COMMAND_UNSCHEDULE        0x08
+#define MSG_COMMAND_KILL              0x09
+#define MSG_COMMAND_TASKS             0x0A
+#define MSG_COMMAND_SYNC              0x0B
+#define MSG_COMMAND_SYNCAPPLY         0x0C
+
+// Options, as 'key=value' frames after the command arguments
+#define MSG_OPTION_GZIP               "gzip"
+#define MSG_OPTION_STDIN              "stdin"
+#define MSG_OPTION_RING               "ring"
+#define MSG_OPTION_JITTER             "jitter"
+#define MSG_OPTION_TTL                "ttl"
+#define MSG_OPTION_RATE               "rate"
+#define MSG_OPTION_BURST              "burst"
+#define MSG_OPTION_SHELL              "shell"
+#define MSG_OPTION_TIMEOUT            "timeout"
+#define MSG_OPTION_CPU                "cpu"
+#define MSG_OPTION_MEM                "mem"
+#define MSG_OPTION_NICE               "nice"
+#define MSG_OPTION_IONICE             "ionice"
+
+#define MSG_ANSWER_STR_ACCEPTED      "MSGACCEPTED"
+#define MSG_ANSWER_STR_COMPLETED     "MSGCOMPLETED"
+#define MSG_ANSWER_STR_BADCRC        "MSGBADCRC"
+#define MSG_ANSWER_STR_PARSEERROR    "MSGPARSEERROR"
+#define MSG_ANSWER_STR_UNREADABLE    "MSGUNREADABLE"
+#define MSG_ANSWER_STR_EXECERROR     "MSGEXECERROR"
+#define MSG_ANSWER_STR_UNDEFERROR    "MSGUNDEFERROR"
+#define MSG_ANSWER_STR_CMDOUTPUT     "MSGCMDOUTPUT"
+#define MSG_ANSWER_STR_TASK          "MSGTASK"
+#define MSG_ANSWER_STR_CHUNK         "MSGCHUNK"
+#define MSG_ANSWER_STR_HEARTBEAT     "MSGHEARTBEAT"
+#define MSG_ANSWER_STR_CREDIT        "MSGCREDIT"
+#define MSG_ANSWER_STR_BATCH         "MSGBATCH"
+#define MSG_ANSWER_STR_TASKS         "MSGTASKS"
+#define MSG_ANSWER_STR_LOCAL         "MSGLOCAL"
+#define MSG_ANSWER_STR_MANIFEST      "MSGMANIFEST"
+
+#define MSG_ANSWER_ACCEPTED          0x01
+#define MSG_ANSWER_CMDOUTPUT         0x40
+#define MSG_ANSWER_COMPLETED         0x80
+#define MSG_ANSWER_BADCRC            0x02
+#define MSG_ANSWER_PARSEERROR        0x08
+#define MSG_ANSWER_UNREADABLE        0x09 // The message is SO WRONG we cannot even answer.
+#define MSG_ANSWER_EXECERROR         0x0C
+#define MSG_ANSWER_UNDEFERROR        0x20
+#define MSG_ANSWER_TASK              0xC0
+
+// Opcodes of the other answers, in the v2 wire format
+#define MSG_ANSWER_CHUNK             0x41
+#define MSG_ANSWER_CREDIT            0x42
+#define MSG_ANSWER_MANIFEST          0x43
+#define MSG_ANSWER_TASKS             0x81
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _SATAN_PROTOCOL_H_
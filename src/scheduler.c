@@ -0,0 +1,333 @@
+/**
+ * =====================================================================================
+ *
+ *   @file scheduler.c
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  06/02/2013 10:44:57 AM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Local scheduler.
+ *
+ *       Entries installed by the server (SCHEDULE) are kept in a registry file,
+ *       one 'name<TAB>interval<TAB>jitter<TAB>command' line each, and run as
+ *       tasks of their own kind. Their output is not streamed: the last bytes
+ *       of it make a compact result record, and records are uploaded together
+ *       as a single MSGBATCH message every flush interval, or earlier once the
+ *       batch is large enough.
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include "main.h"
+#include "messages.h"
+#include "utils.h"
+#include "scheduler.h"
+
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/wait.h>
+
+static int64_t s_next_run(schedule_entry *entry)
+{
+  int64_t delay = (int64_t)entry->interval * 1000;
+  if (entry->jitter > 0)
+    delay += random() % ((int64_t)entry->jitter * 1000);
+  return zclock_time() + delay;
+}
+
+static schedule_entry *s_lookup(scheduler_t *self, const char *name)
+{
+  schedule_entry *entry = zlist_first(self->entries);
+  while (entry != NULL) {
+    if (str_equals(entry->name, name))
+      return entry;
+    entry = zlist_next(self->entries);
+  }
+  return NULL;
+}
+
+static void s_entry_destroy(schedule_entry *entry)
+{
+  free(entry->name);
+  free(entry->command);
+  free(entry);
+}
+
+static bool s_valid(const char *name, int interval, int jitter, const char *command)
+{
+  return strlen(name) > 0 && strpbrk(name, " \t\n") == NULL
+    && strlen(command) > 0 && strchr(command, '\n') == NULL
+    && interval > 0 && jitter >= 0;
+}
+
+static void s_insert(scheduler_t *self, const char *name, int interval, int jitter, const char *command)
+{
+  schedule_entry *entry = calloc(1, sizeof(schedule_entry));
+  assert(entry);
+
+  entry->name = strdup(name);
+  entry->command = strdup(command);
+  entry->interval = interval;
+  entry->jitter = jitter;
+  entry->next_run = s_next_run(entry);
+  zlist_append(self->entries, entry);
+}
+
+/*  Rewrite the registry, atomically */
+static int s_save(scheduler_t *self)
+{
+  char tmpname[MAX_STRING_LEN];
+
+  if (self->file == NULL)
+    return STATUS_OK;
+
+  snprintf(tmpname, MAX_STRING_LEN, "%s.tmp", self->file);
+  FILE *file = fopen(tmpname, "w");
+  if (file == NULL) {
+    errorLog("%s: %s", tmpname, strerror(errno));
+    return STATUS_ERROR;
+  }
+
+  schedule_entry *entry = zlist_first(self->entries);
+  while (entry != NULL) {
+    fprintf(file, "%s\t%d\t%d\t%s\n", entry->name, entry->interval, entry->jitter, entry->command);
+    entry = zlist_next(self->entries);
+  }
+
+  if (fflush(file) != 0 || fsync(fileno(file)) != 0) {
+    fclose(file);
+    unlink(tmpname);
+    return STATUS_ERROR;
+  }
+  fclose(file);
+
+  if (rename(tmpname, self->file) != 0) {
+    unlink(tmpname);
+    return STATUS_ERROR;
+  }
+  return STATUS_OK;
+}
+
+static void s_load(scheduler_t *self)
+{
+  char *line = NULL;
+  size_t size = 0;
+
+  FILE *file = fopen(self->file, "r");
+  if (file == NULL)
+    return;
+
+  while (getline(&line, &size, file) > 0 && zlist_size(self->entries) < SCHEDULER_MAX_ENTRIES) {
+    char *saveptr = NULL;
+    line[strcspn(line, "\n")] = 0;
+    char *name = strtok_r(line, "\t", &saveptr);
+    char *interval = strtok_r(NULL, "\t", &saveptr);
+    char *jitter = strtok_r(NULL, "\t", &saveptr);
+    char *command = strtok_r(NULL, "", &saveptr);
+
+    if (name == NULL || interval == NULL || jitter == NULL || command == NULL
+        || !s_valid(name, atoi(interval), atoi(jitter), command)
+        || s_lookup(self, name) != NULL) {
+      errorLog("%s: skipping malformed entry", self->file);
+      continue;
+    }
+    s_insert(self, name, atoi(interval), atoi(jitter), command);
+  }
+
+  free(line);
+  fclose(file);
+  debugLog("Loaded %zu scheduled tasks from %s", zlist_size(self->entries), self->file);
+}
+
+scheduler_t *scheduler_new(const char *file, int flush_interval)
+{
+  scheduler_t *self = malloc(sizeof(scheduler_t));
+  assert(self);
+
+  self->entries = zlist_new();
+  self->file = file != NULL ? strdup(file) : NULL;
+  self->batch = zlist_new();
+  self->batch_bytes = 0;
+  self->flush_interval = flush_interval;
+  self->next_flush = zclock_time() + (int64_t)flush_interval * 1000;
+
+  if (self->file != NULL)
+    s_load(self);
+
+  return self;
+}
+
+void scheduler_destroy(scheduler_t **self)
+{
+  assert(self);
+
+  if (*self) {
+    schedule_entry *entry = NULL;
+    while ((entry = zlist_pop((*self)->entries)) != NULL)
+      s_entry_destroy(entry);
+    zlist_destroy(&(*self)->entries);
+    zframe_t *record = NULL;
+    while ((record = zlist_pop((*self)->batch)) != NULL)
+      zframe_destroy(&record);
+    zlist_destroy(&(*self)->batch);
+    free((*self)->file);
+    free(*self);
+    *self = NULL;
+  }
+}
+
+/*  Install or replace an entry */
+int scheduler_add(scheduler_t *self, const char *name, int interval, int jitter, const char *command)
+{
+  assert(self);
+  assert(name);
+  assert(command);
+
+  if (!s_valid(name, interval, jitter, command))
+    return STATUS_ERROR;
+
+  schedule_entry *entry = s_lookup(self, name);
+  if (entry != NULL) {
+    zlist_remove(self->entries, entry);
+    s_entry_destroy(entry);
+  } else if (zlist_size(self->entries) >= SCHEDULER_MAX_ENTRIES) {
+    return STATUS_ERROR;
+  }
+
+  s_insert(self, name, interval, jitter, command);
+  return s_save(self);
+}
+
+int scheduler_remove(scheduler_t *self, const char *name)
+{
+  assert(self);
+  assert(name);
+
+  schedule_entry *entry = s_lookup(self, name);
+  if (entry == NULL)
+    return STATUS_ERROR;
+
+  zlist_remove(self->entries, entry);
+  s_entry_destroy(entry);
+  return s_save(self);
+}
+
+/*  Start the entries that are due, unless their previous run is still going */
+void scheduler_run(scheduler_t *self, task_table *tasks)
+{
+  assert(self);
+  assert(tasks);
+
+  char msgid[MAX_STRING_LEN];
+  int64_t now = zclock_time();
+
+  schedule_entry *entry = zlist_first(self->entries);
+  while (entry != NULL) {
+    if (now >= entry->next_run) {
+      entry->next_run = s_next_run(entry);
+      snprintf(msgid, MAX_STRING_LEN, "%s%s", SCHEDULER_PREFIX, entry->name);
+
+      int output_fd = -1;
+      if (tasks_lookup(tasks, msgid) != NULL) {
+        debugLog("Scheduled task %s still running, skipped", entry->name);
+      } else if (tasks_full(tasks)) {
+        errorLog("Too many tasks, scheduled task %s skipped", entry->name);
+      } else {
+        uint32_t cgroup = 0;
+        pid_t pid = messages_exec(tasks->spawner, entry->command, true, NULL, &output_fd, NULL, &cgroup);
+        if (pid != -1) {
+          process_item *item = tasks_add(tasks, TASK_KIND_SCHEDULED, pid, output_fd, msgid, entry->command);
+          item->cgroup = cgroup;
+          tasks_set_ring(tasks, item, SCHEDULER_OUTPUT);
+        }
+      }
+    }
+    entry = zlist_next(self->entries);
+  }
+}
+
+/*  Turn the scheduled tasks that are over into result records. While the
+ *  batch cannot be uploaded and is full, they stay where they are, and the
+ *  next runs of their entries are skipped. */
+void scheduler_collect(scheduler_t *self, task_table *tasks)
+{
+  assert(self);
+  assert(tasks);
+
+  process_item *item = zlist_first(tasks->items);
+  while (item != NULL && self->batch_bytes < SCHEDULER_BATCH_LIMIT) {
+    if (item->kind == TASK_KIND_SCHEDULED && item->exited
+        && item->output_fd == -1 && !item->finished) {
+      const char *name = item->message_id + strlen(SCHEDULER_PREFIX);
+      size_t name_len = strlen(name) > 255 ? 255 : strlen(name);
+      size_t kept = item->offset < item->ring_size ? item->offset : item->ring_size;
+      int64_t duration = zclock_time() - item->started_at;
+      size_t size = SCHEDULER_RECORD_HEADER + name_len + kept;
+      uint8_t *record = malloc(size);
+      size_t i;
+      assert(record);
+
+      record[0] = SCHEDULER_RECORD_VERSION;
+      if (item->status == -1) {
+        record[1] = SCHEDULER_STATUS_LOST;
+        record[2] = SCHEDULER_STATUS_LOST;
+      } else {
+        record[1] = WIFEXITED(item->status) ? WEXITSTATUS(item->status) : 0xff;
+        record[2] = WIFSIGNALED(item->status) ? WTERMSIG(item->status) : 0;
+      }
+      record[3] = name_len;
+      utils_put32(record + 4, (uint32_t)(time(NULL) - duration / 1000));
+      utils_put32(record + 8, (uint32_t)duration);
+      utils_put32(record + 12, (uint32_t)item->offset);
+      memcpy(record + SCHEDULER_RECORD_HEADER, name, name_len);
+
+      /*  Linearize the ring, oldest byte first */
+      for (i = 0; i < kept; i++)
+        record[SCHEDULER_RECORD_HEADER + name_len + i] =
+          item->ring[(item->offset - kept + i) % item->ring_size];
+
+      zlist_append(self->batch, zframe_new(record, size));
+      self->batch_bytes += size;
+      free(record);
+
+      item->finished = true;
+      item->finished_at = zclock_time();
+    }
+    item = zlist_next(tasks->items);
+  }
+}
+
+/*  The batch to upload, once the flush window is reached or the batch is full */
+zmsg_t *scheduler_batch(scheduler_t *self, const char *device_id)
+{
+  assert(self);
+  assert(device_id);
+
+  if (zlist_size(self->batch) == 0)
+    return NULL;
+  if (zclock_time() < self->next_flush && self->batch_bytes < SCHEDULER_BATCH_MAX)
+    return NULL;
+
+  zmsg_t *msg = zmsg_new();
+  zmsg_addstr(msg, "%s", device_id);
+  zmsg_addstr(msg, "%s", "");
+  zmsg_addstr(msg, "%s", MSG_ANSWER_STR_BATCH);
+
+  zframe_t *record = NULL;
+  while ((record = zlist_pop(self->batch)) != NULL)
+    zmsg_add(msg, record);
+  self->batch_bytes = 0;
+  self->next_flush = zclock_time() + (int64_t)self->flush_interval * 1000;
+
+  return msg;
+}
@@ -0,0 +1,70 @@
+/**
+ * =====================================================================================
+ *
+ *   @file scheduler.h
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  06/02/2013 10:31:12 AM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Local scheduler: periodic tasks, results uploaded in batches
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include <czmq.h>
+#include "tasks.h"
+#include "profile.h"
+
+#ifndef _SATAN_SCHEDULER_H_
+#define _SATAN_SCHEDULER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SCHEDULER_OUTPUT      (4*1024)  // output kept per run, the last bytes
+#define SCHEDULER_PREFIX      "@"       // task message ids are the entry name, prefixed
+
+#define SCHEDULER_RECORD_VERSION 0x01
+#define SCHEDULER_RECORD_HEADER  16
+#define SCHEDULER_STATUS_LOST    0xff     // exit code and signal, when the status was lost
+
+typedef struct s_schedule_entry_t {
+  char *name;
+  char *command;
+  int interval;             // seconds
+  int jitter;               // seconds, added at random to every interval
+  int64_t next_run;
+} schedule_entry;
+
+typedef struct s_scheduler_t {
+  zlist_t *entries;
+  char *file;               // persistent registry, NULL if none
+  zlist_t *batch;           // result records waiting for upload
+  size_t batch_bytes;
+  int flush_interval;       // seconds between uploads
+  int64_t next_flush;
+} scheduler_t;
+
+scheduler_t *scheduler_new(const char *file, int flush_interval);
+void scheduler_destroy(scheduler_t **self);
+
+int scheduler_add(scheduler_t *self, const char *name, int interval, int jitter, const char *command);
+int scheduler_remove(scheduler_t *self, const char *name);
+
+void scheduler_run(scheduler_t *self, task_table *tasks);
+void scheduler_collect(scheduler_t *self, task_table *tasks);
+zmsg_t *scheduler_batch(scheduler_t *self, const char *device_id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _SATAN_SCHEDULER_H_
@@ -0,0 +1,102 @@
+/**
+ * =====================================================================================
+ *
+ *   @file shaper.c
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  06/11/2013 02:11:29 PM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Token buckets.
+ *
+ *       A bucket fills up at its rate, up to its burst size, and a message
+ *       goes out when the bucket holds enough tokens for it. A message
+ *       larger than the burst goes out once the bucket is full, leaving it
+ *       in debt, so that it is never stuck. Time is counted in milliseconds
+ *       and tokens in bytes, without floating point: routers rarely have a
+ *       FPU.
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include "main.h"
+#include "shaper.h"
+
+#include <assert.h>
+#include <czmq.h>
+
+void bucket_init(token_bucket *self, int64_t rate, int64_t burst)
+{
+  assert(self);
+
+  self->rate = rate > 0 ? rate : 0;
+  self->burst = burst > 0 ? burst : self->rate;
+  self->tokens = self->burst;
+  self->last = zclock_time();
+  self->remainder = 0;
+}
+
+void bucket_refill(token_bucket *self, int64_t now)
+{
+  assert(self);
+
+  if (self->rate == 0)
+    return;
+
+  if (now <= self->last)
+    return;
+
+  /*  Whole bytes only, the fraction of a byte is kept for the next refill:
+   *  every millisecond is credited once, whatever the rate */
+  int64_t credit = (now - self->last) * self->rate + self->remainder;
+  self->last = now;
+  self->tokens += credit / 1000;
+  self->remainder = credit % 1000;
+  if (self->tokens >= self->burst) {
+    self->tokens = self->burst;
+    self->remainder = 0;
+  }
+}
+
+/*  Bytes that can be sent right away */
+int64_t bucket_available(token_bucket *self)
+{
+  assert(self);
+
+  if (self->rate == 0)
+    return INT64_MAX;
+  return self->tokens > 0 ? self->tokens : 0;
+}
+
+bool bucket_allows(token_bucket *self, size_t size)
+{
+  assert(self);
+
+  return self->rate == 0 || self->tokens >= (int64_t)size || self->tokens >= self->burst;
+}
+
+void bucket_take(token_bucket *self, size_t size)
+{
+  assert(self);
+
+  if (self->rate != 0)
+    self->tokens -= size;
+}
+
+/*  Milliseconds before a message of that size is allowed */
+int64_t bucket_delay(token_bucket *self, size_t size)
+{
+  assert(self);
+
+  if (bucket_allows(self, size))
+    return 0;
+
+  int64_t needed = ((int64_t)size < self->burst ? (int64_t)size : self->burst) - self->tokens;
+  return (needed * 1000 + self->rate - 1) / self->rate;
+}
@@ -0,0 +1,51 @@
+/**
+ * =====================================================================================
+ *
+ *   @file shaper.h
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  06/11/2013 02:05:44 PM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Token buckets, for outbound bandwidth shaping
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifndef _SATAN_SHAPER_H_
+#define _SATAN_SHAPER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct s_token_bucket_t {
+  int64_t rate;             // bytes per second, 0 for unlimited
+  int64_t burst;            // bucket depth, in bytes
+  int64_t tokens;           // may go below zero after a message larger than the burst
+  int64_t last;             // zclock_time() of the last refill
+  int64_t remainder;        // thousandths of a byte credited but not yet added to tokens
+} token_bucket;
+
+void bucket_init(token_bucket *self, int64_t rate, int64_t burst);
+void bucket_refill(token_bucket *self, int64_t now);
+int64_t bucket_available(token_bucket *self);
+bool bucket_allows(token_bucket *self, size_t size);
+void bucket_take(token_bucket *self, size_t size);
+int64_t bucket_delay(token_bucket *self, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _SATAN_SHAPER_H_
@@ -0,0 +1,661 @@
+/**
+ * =====================================================================================
+ *
+ *   @file spawner.c
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  06/17/2013 09:12:40 AM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Spawn helper.
+ *
+ *       Forking the daemon for every task copies the page tables of a process
+ *       that holds a zmq context and a dozen threads. The helper is forked once,
+ *       at startup, before any of them exists: it stays small and single
+ *       threaded, and launches the tasks on our behalf with posix_spawn(), which
+ *       uses vfork() or CLONE_VFORK underneath.
+ *
+ *       Requests go through a SOCK_SEQPACKET socket pair, one packet each: a
+ *       flags byte, the resource limits, then the command line. Tasks with
+ *       limits or a timeout are forked by the helper instead, to set them up
+ *       before exec, and get a cgroup of their own when cgroup v2 is mounted,
+ *       named after a serial number rather than the pid. The answer is the
+ *       task pid and cgroup id, or an errno, with the read end of its stdout
+ *       pipe (and the write end of its stdin pipe) attached as SCM_RIGHTS.
+ *       The tasks are children of the helper, which reaps them and writes
+ *       their pid, wait status and resource usage into a pipe that we read
+ *       from tasks_reap().
+ *
+ *       The helper exits when its socket is closed. Should it die first, tasks
+ *       are forked by the daemon again.
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include "main.h"
+#include "spawner.h"
+#include "utils.h"
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <spawn.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+
+extern char **environ;
+
+typedef struct {
+  int32_t pid;              // > 0 on success
+  int32_t error;            // errno otherwise
+  uint32_t cgroup;          // id of the task cgroup, 0 if none
+} s_answer_t;
+
+typedef struct {
+  int32_t pid;
+  int32_t status;           // waitpid() status
+  struct rusage usage;
+} s_exit_t;
+
+#define IOPRIO_WHO_PROCESS 1
+
+static bool s_cgroups = false; // in the helper: tasks with limits get a cgroup
+
+/*  In the helper: the cgroups made for the tasks, keyed on an id never given
+ *  twice so that a reused pid can't reach one. Some outlive their task while
+ *  its own children live on, and are removed once empty. */
+static struct {
+  uint32_t id;              // 0 for a free slot
+  pid_t pid;                // 0 once the task is reaped
+} s_groups[SPAWN_CGROUPS_MAX];
+static uint32_t s_group_serial = 0;
+
+static bool s_write_file(const char *path, const char *value)
+{
+  int fd = open(path, O_WRONLY | O_CLOEXEC);
+  if (fd == -1)
+    return false;
+  bool written = write(fd, value, strlen(value)) == (ssize_t)strlen(value);
+  close(fd);
+  return written;
+}
+
+static void s_cgroup_path(char *path, size_t size, uint32_t id, const char *file)
+{
+  snprintf(path, size, SPAWN_CGROUP "/task-%u%s%s", id, file ? "/" : "", file ? file : "");
+}
+
+/*  Our own cgroup v2 subtree, with the memory controller if we can have it.
+ *  Leftovers of a previous run are removed if empty, and never reused. */
+static bool s_cgroup_init(void)
+{
+  char path[64];
+  struct dirent *entry;
+  unsigned int id;
+
+  if (access("/sys/fs/cgroup/cgroup.controllers", F_OK) != 0)
+    return false;
+  if (mkdir(SPAWN_CGROUP, 0755) != 0 && errno != EEXIST)
+    return false;
+  s_write_file("/sys/fs/cgroup/cgroup.subtree_control", "+memory");
+  s_write_file(SPAWN_CGROUP "/cgroup.subtree_control", "+memory");
+
+  DIR *dir = opendir(SPAWN_CGROUP);
+  while (dir != NULL && (entry = readdir(dir)) != NULL) {
+    if (sscanf(entry->d_name, "task-%u", &id) != 1)
+      continue;
+    s_cgroup_path(path, sizeof(path), id, NULL);
+    if (rmdir(path) != 0 && id > s_group_serial)
+      s_group_serial = id;
+  }
+  if (dir != NULL)
+    closedir(dir);
+  return true;
+}
+
+/*  Retries the cgroups left busy by the children of their task */
+static void s_cgroup_sweep(void)
+{
+  char path[64];
+  int i;
+
+  for (i = 0; i < SPAWN_CGROUPS_MAX; i++) {
+    if (s_groups[i].id == 0 || s_groups[i].pid != 0)
+      continue;
+    s_cgroup_path(path, sizeof(path), s_groups[i].id, NULL);
+    if (rmdir(path) == 0 || errno == ENOENT)
+      s_groups[i].id = 0;
+  }
+}
+
+/*  In the helper, before the fork: the slot of a new cgroup, -1 if none */
+static int s_cgroup_new(void)
+{
+  char path[64];
+  int i;
+
+  s_cgroup_sweep();
+  for (i = 0; i < SPAWN_CGROUPS_MAX; i++) {
+    if (s_groups[i].id != 0)
+      continue;
+    if (++s_group_serial == 0)
+      s_group_serial = 1;
+    s_cgroup_path(path, sizeof(path), s_group_serial, NULL);
+    if (mkdir(path, 0755) != 0)
+      return -1;
+    s_groups[i].id = s_group_serial;
+    s_groups[i].pid = 0;
+    return i;
+  }
+  return -1;
+}
+
+/*  Once its task is gone, or never started */
+static void s_cgroup_release(int slot)
+{
+  char path[64];
+
+  s_groups[slot].pid = 0;
+  s_cgroup_path(path, sizeof(path), s_groups[slot].id, NULL);
+  if (rmdir(path) == 0 || errno == ENOENT)
+    s_groups[slot].id = 0; // busy while some of its own children live on
+}
+
+/*  In the task, before exec: true if its memory is limited by the cgroup */
+static bool s_cgroup_enter(uint32_t id, const spawn_limits *limits)
+{
+  char path[64], value[32];
+
+  bool limited = false;
+  if (limits->mem > 0) {
+    s_cgroup_path(path, sizeof(path), id, "memory.max");
+    snprintf(value, sizeof(value), "%lld", (long long)limits->mem * 1024);
+    limited = s_write_file(path, value);
+  }
+  s_cgroup_path(path, sizeof(path), id, "cgroup.procs");
+  snprintf(value, sizeof(value), "%d", (int)getpid());
+  return s_write_file(path, value) && limited;
+}
+
+bool spawner_limited(const spawn_limits *limits)
+{
+  return limits != NULL && (limits->cpu > 0 || limits->mem > 0 || limits->nice != 0 || limits->ioprio != 0
+      || limits->timeout > 0);
+}
+
+/*  In the task, before exec; async-signal-safe */
+void spawner_apply_limits(const spawn_limits *limits)
+{
+  struct rlimit limit;
+
+  if (limits == NULL)
+    return;
+  if (limits->cpu > 0) {
+    limit.rlim_cur = limit.rlim_max = limits->cpu;
+    setrlimit(RLIMIT_CPU, &limit);
+  }
+  if (limits->mem > 0) {
+    limit.rlim_cur = limit.rlim_max = (rlim_t)limits->mem * 1024;
+    setrlimit(RLIMIT_AS, &limit);
+  }
+  if (limits->nice != 0)
+    setpriority(PRIO_PROCESS, 0, getpriority(PRIO_PROCESS, 0) + limits->nice);
+  if (limits->ioprio != 0)
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, limits->ioprio);
+}
+
+/*  The whole task: its cgroup if it has one and is to be killed, its process group otherwise */
+int spawner_kill(pid_t pid, uint32_t cgroup, int signal)
+{
+  char path[64];
+
+  if (signal == SIGKILL && cgroup != 0) {
+    s_cgroup_path(path, sizeof(path), cgroup, "cgroup.kill");
+    if (s_write_file(path, "1"))
+      return STATUS_OK;
+  }
+  if (kill(-pid, signal) == 0 || kill(pid, signal) == 0)
+    return STATUS_OK;
+  return STATUS_ERROR;
+}
+
+/*  Pipes of the task, their far ends attached to the answer */
+static void s_send_answer(int fd, pid_t pid, int error, uint32_t cgroup, int *fds, int count)
+{
+  s_answer_t answer = { pid, error, cgroup };
+  struct iovec iov = { &answer, sizeof(answer) };
+  union {
+    char buffer[CMSG_SPACE(2 * sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct msghdr msg;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  if (count > 0) {
+    msg.msg_control = control.buffer;
+    msg.msg_controllen = CMSG_SPACE(count * sizeof(int));
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, count * sizeof(int));
+  }
+  while (sendmsg(fd, &msg, MSG_NOSIGNAL) == -1 && errno == EINTR)
+    ;
+}
+
+/*  A process group of its own, for KILL, and the signals we changed reset */
+static int s_posix_spawn(pid_t *pid, char **argv, bool shell, int out, int in)
+{
+  posix_spawn_file_actions_t actions;
+  posix_spawnattr_t attr;
+  sigset_t mask, defaults;
+  short flags = POSIX_SPAWN_SETPGROUP | POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+  int error;
+
+#ifdef POSIX_SPAWN_USEVFORK
+  flags |= POSIX_SPAWN_USEVFORK;
+#endif
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, out, STDOUT_FILENO);
+  if (in != -1)
+    posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO);
+
+  sigemptyset(&mask);
+  sigemptyset(&defaults);
+  sigaddset(&defaults, SIGPIPE);
+  sigaddset(&defaults, SIGCHLD);
+  sigaddset(&defaults, SIGINT);
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setflags(&attr, flags);
+  posix_spawnattr_setpgroup(&attr, 0);
+  posix_spawnattr_setsigmask(&attr, &mask);
+  posix_spawnattr_setsigdefault(&attr, &defaults);
+
+  if (shell)
+    error = posix_spawn(pid, "/bin/sh", &actions, &attr, argv, environ);
+  else
+    error = posix_spawnp(pid, argv[0], &actions, &attr, argv, environ);
+
+  posix_spawnattr_destroy(&attr);
+  posix_spawn_file_actions_destroy(&actions);
+  return error;
+}
+
+/*  Limited tasks, set up before exec, in the cgroup of the slot if not -1;
+ *  an exec failure comes back through a pipe */
+static int s_fork(pid_t *pid, char **argv, bool shell, const spawn_limits *limits, int slot, int out, int in)
+{
+  int report[2], error = 0;
+
+  if (pipe2(report, O_CLOEXEC) != 0)
+    return errno;
+
+  *pid = fork();
+  if (*pid == -1) {
+    error = errno;
+    close(report[0]);
+    close(report[1]);
+    return error;
+  }
+
+  if (*pid == 0) {
+    spawn_limits rest = *limits;
+    sigset_t mask;
+
+    close(report[0]);
+    dup2(out, STDOUT_FILENO);
+    if (in != -1)
+      dup2(in, STDIN_FILENO);
+    setpgid(0, 0);
+    sigemptyset(&mask);
+    sigprocmask(SIG_SETMASK, &mask, NULL);
+    signal(SIGPIPE, SIG_DFL);
+    signal(SIGINT, SIG_DFL);
+    if (slot != -1 && s_cgroup_enter(s_groups[slot].id, limits))
+      rest.mem = 0; // memory.max is enough, RLIMIT_AS would count reservations too
+    spawner_apply_limits(&rest);
+    if (shell)
+      execv("/bin/sh", argv);
+    else
+      execvp(argv[0], argv);
+    error = errno;
+    while (write(report[1], &error, sizeof(error)) == -1 && errno == EINTR)
+      ;
+    _exit(127);
+  }
+
+  close(report[1]);
+  while (read(report[0], &error, sizeof(error)) == -1 && errno == EINTR)
+    ;
+  close(report[0]);
+  if (error != 0)
+    waitpid(*pid, NULL, 0);
+  return error;
+}
+
+static void s_spawn(int fd, char *request, size_t len)
+{
+  uint8_t flags = request[0];
+  char *argv[SPAWN_ARGS_MAX + 1];
+  spawn_limits limits;
+  char *cmd = request + 1 + sizeof(limits);
+  int out[2], in[2] = { -1, -1 };
+  bool input = (flags & SPAWN_FLAG_INPUT) != 0;
+  pid_t pid = -1;
+  int slot = -1, error;
+
+  if (len < 1 + sizeof(limits)) {
+    s_send_answer(fd, -1, EINVAL, 0, NULL, 0);
+    return;
+  }
+  memcpy(&limits, request + 1, sizeof(limits));
+  request[len] = 0;
+  if (flags & SPAWN_FLAG_SHELL) {
+    argv[0] = "sh";
+    argv[1] = "-c";
+    argv[2] = cmd;
+    argv[3] = NULL;
+  } else if (utils_split_args(cmd, argv, SPAWN_ARGS_MAX) <= 0) {
+    s_send_answer(fd, -1, E2BIG, 0, NULL, 0);
+    return;
+  }
+
+  if (pipe2(out, O_CLOEXEC) != 0) {
+    s_send_answer(fd, -1, errno, 0, NULL, 0);
+    return;
+  }
+  if (input && pipe2(in, O_CLOEXEC) != 0) {
+    error = errno;
+    close(out[0]);
+    close(out[1]);
+    s_send_answer(fd, -1, error, 0, NULL, 0);
+    return;
+  }
+
+  if (spawner_limited(&limits)) {
+    if (s_cgroups)
+      slot = s_cgroup_new();
+    error = s_fork(&pid, argv, flags & SPAWN_FLAG_SHELL, &limits, slot, out[1], in[0]);
+    if (slot != -1 && error != 0)
+      s_cgroup_release(slot);
+    else if (slot != -1)
+      s_groups[slot].pid = pid;
+  } else
+    error = s_posix_spawn(&pid, argv, flags & SPAWN_FLAG_SHELL, out[1], in[0]);
+
+  close(out[1]);
+  if (input)
+    close(in[0]);
+
+  if (error != 0) {
+    close(out[0]);
+    if (input)
+      close(in[1]);
+    s_send_answer(fd, -1, error, 0, NULL, 0);
+    return;
+  }
+
+  /*  Status flags belong to the open file, they follow the descriptors */
+  int fds[2] = { out[0], in[1] };
+  fcntl(out[0], F_SETFL, fcntl(out[0], F_GETFL) | O_NONBLOCK);
+  if (input)
+    fcntl(in[1], F_SETFL, fcntl(in[1], F_GETFL) | O_NONBLOCK);
+  s_send_answer(fd, pid, 0, slot != -1 ? s_groups[slot].id : 0, fds, input ? 2 : 1);
+  close(out[0]);
+  if (input)
+    close(in[1]);
+}
+
+static void s_reap_children(int exits_fd)
+{
+  s_exit_t notice;
+  int status, i;
+  pid_t pid;
+
+  memset(&notice, 0, sizeof(notice));
+  while ((pid = wait4(-1, &status, WNOHANG, &notice.usage)) > 0) {
+    notice.pid = pid;
+    notice.status = status;
+    while (write(exits_fd, &notice, sizeof(notice)) == -1 && errno == EINTR)
+      ;
+    for (i = 0; s_cgroups && i < SPAWN_CGROUPS_MAX; i++) {
+      if (s_groups[i].id != 0 && s_groups[i].pid == pid)
+        s_cgroup_release(i);
+    }
+  }
+  if (s_cgroups)
+    s_cgroup_sweep();
+}
+
+static void s_helper_loop(int fd, int exits_fd)
+{
+  static char request[SPAWN_REQUEST_MAX + 1];
+  sigset_t mask;
+
+  /*  SIGCHLD comes through a descriptor, between two requests */
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask, NULL);
+  int signal_fd = signalfd(-1, &mask, SFD_CLOEXEC);
+  signal(SIGINT, SIG_IGN); // the daemon's to handle; we go when it closes the socket
+  signal(SIGPIPE, SIG_IGN);
+  s_cgroups = s_cgroup_init();
+
+  struct pollfd items[2] = {
+    { fd, POLLIN, 0 },
+    { signal_fd, POLLIN, 0 }
+  };
+
+  while (true) {
+    if (poll(items, 2, -1) == -1) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+
+    if (items[1].revents & POLLIN) {
+      struct signalfd_siginfo info;
+      while (read(signal_fd, &info, sizeof(info)) == -1 && errno == EINTR)
+        ;
+      s_reap_children(exits_fd);
+    }
+
+    if (items[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+      ssize_t len = recv(fd, request, SPAWN_REQUEST_MAX, 0);
+      if (len == -1 && errno == EINTR)
+        continue;
+      if (len <= 0)
+        break;
+      s_spawn(fd, request, (size_t)len);
+    }
+  }
+
+  _exit(0);
+}
+
+/*  To be called before any thread or zmq context exists */
+spawner_t *spawner_new(void)
+{
+  int fds[2], exits[2];
+
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) != 0) {
+    errorLog("Cannot create the spawn helper socket: %s", strerror(errno));
+    return NULL;
+  }
+  if (pipe2(exits, O_CLOEXEC) != 0) {
+    errorLog("Cannot create the spawn helper pipe: %s", strerror(errno));
+    close(fds[0]);
+    close(fds[1]);
+    return NULL;
+  }
+
+  pid_t pid = fork();
+  if (pid == -1) {
+    errorLog("Cannot fork the spawn helper: %s", strerror(errno));
+    close(fds[0]);
+    close(fds[1]);
+    close(exits[0]);
+    close(exits[1]);
+    return NULL;
+  }
+
+  if (pid == 0) {
+    close(fds[0]);
+    close(exits[0]);
+    s_helper_loop(fds[1], exits[1]);
+  }
+
+  close(fds[1]);
+  close(exits[1]);
+  fcntl(exits[0], F_SETFL, fcntl(exits[0], F_GETFL) | O_NONBLOCK);
+
+  spawner_t *self = calloc(1, sizeof(spawner_t));
+  assert(self);
+
+  self->pid = pid;
+  self->fd = fds[0];
+  self->exits_fd = exits[0];
+  self->running = true;
+
+  debugLog("Spawn helper started, pid %d", pid);
+  return self;
+}
+
+void spawner_destroy(spawner_t **self)
+{
+  assert(self);
+
+  if (*self) {
+    close((*self)->fd);
+    close((*self)->exits_fd);
+    if ((*self)->running)
+      waitpid((*self)->pid, NULL, 0);
+    free(*self);
+    *self = NULL;
+  }
+}
+
+bool spawner_running(spawner_t *self)
+{
+  return self != NULL && self->running;
+}
+
+static void s_helper_lost(spawner_t *self)
+{
+  errorLog("Spawn helper lost, forking tasks ourselves");
+  self->running = false;
+  waitpid(self->pid, NULL, WNOHANG);
+}
+
+/*  Stdin is only connected to a pipe when input_fd is given; limits may be NULL.
+ *  The cgroup id of the task, for spawner_kill(), is 0 if it has none. */
+pid_t spawner_exec(spawner_t *self, const char *cmd, bool shell, const spawn_limits *limits,
+    int *output_fd, int *input_fd, uint32_t *cgroup)
+{
+  assert(self);
+  assert(cmd);
+  assert(output_fd);
+  assert(cgroup);
+
+  char request[SPAWN_REQUEST_MAX];
+  size_t header = 1 + sizeof(spawn_limits);
+  size_t len = strlen(cmd);
+
+  if (!self->running)
+    return -1;
+  if (header + len > SPAWN_REQUEST_MAX) {
+    errno = E2BIG;
+    return -1;
+  }
+
+  request[0] = (shell ? SPAWN_FLAG_SHELL : 0) | (input_fd != NULL ? SPAWN_FLAG_INPUT : 0);
+  if (limits != NULL)
+    memcpy(request + 1, limits, sizeof(spawn_limits));
+  else
+    memset(request + 1, 0, sizeof(spawn_limits));
+  memcpy(request + header, cmd, len);
+  if (send(self->fd, request, header + len, MSG_NOSIGNAL) == -1) {
+    s_helper_lost(self);
+    return -1;
+  }
+
+  s_answer_t answer;
+  struct iovec iov = { &answer, sizeof(answer) };
+  union {
+    char buffer[CMSG_SPACE(2 * sizeof(int))];
+    struct cmsghdr align;
+  } control;
+  struct msghdr msg;
+  ssize_t received;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buffer;
+  msg.msg_controllen = sizeof(control.buffer);
+  while ((received = recvmsg(self->fd, &msg, MSG_CMSG_CLOEXEC)) == -1 && errno == EINTR)
+    ;
+  if (received != sizeof(answer)) {
+    s_helper_lost(self);
+    return -1;
+  }
+
+  int fds[2] = { -1, -1 };
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+    size_t size = cmsg->cmsg_len - CMSG_LEN(0);
+    memcpy(fds, CMSG_DATA(cmsg), size < sizeof(fds) ? size : sizeof(fds));
+  }
+
+  if (answer.pid <= 0) {
+    errno = answer.error;
+    return -1;
+  }
+
+  *output_fd = fds[0];
+  if (input_fd != NULL)
+    *input_fd = fds[1];
+  *cgroup = answer.cgroup;
+  return answer.pid;
+}
+
+/*  Next task that exited, false if none did */
+bool spawner_reap(spawner_t *self, pid_t *pid, int *status, struct rusage *usage)
+{
+  assert(self);
+  assert(pid);
+  assert(status);
+  assert(usage);
+
+  s_exit_t notice;
+  ssize_t len;
+
+  while ((len = read(self->exits_fd, &notice, sizeof(notice))) == -1 && errno == EINTR)
+    ;
+  if (len == 0 && self->running)
+    s_helper_lost(self);
+  if (len != sizeof(notice))
+    return false;
+
+  *pid = notice.pid;
+  *status = notice.status;
+  *usage = notice.usage;
+  return true;
+}
@@ -0,0 +1,72 @@
+/**
+ * =====================================================================================
+ *
+ *   @file spawner.h
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  06/17/2013 09:12:40 AM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Spawn helper headers
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include <czmq.h>
+#include <sys/resource.h>
+#include "profile.h"
+
+#ifndef _SATAN_SPAWNER_H_
+#define _SATAN_SPAWNER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SPAWN_REQUEST_MAX  4096  // command line and flags, in a single packet
+#define SPAWN_ARGS_MAX     64    // arguments of a command run without a shell
+
+#define SPAWN_FLAG_SHELL   0x01  // run through /bin/sh -c
+#define SPAWN_FLAG_INPUT   0x02  // connect stdin to a pipe
+
+#define SPAWN_CGROUP       "/sys/fs/cgroup/satan"  // cgroup v2, one child per limited task, "task-<id>"
+#define SPAWN_CGROUPS_MAX  (2 * TASK_MAX)         // tracked by the helper, live or left busy by grandchildren
+
+typedef struct {
+  int cpu;                  // seconds of CPU time, RLIMIT_CPU; 0 for unlimited
+  int mem;                  // KB, memory.max of its cgroup, else RLIMIT_AS; 0 for unlimited
+  int nice;                 // added to the nice value
+  int ioprio;               // ioprio_set() value, 0 to leave it unchanged
+  int timeout;              // seconds, enforced by the daemon: the task still gets a cgroup to kill
+} spawn_limits;
+
+typedef struct s_spawner_t {
+  pid_t pid;                // the helper
+  int fd;                   // requests and their answers, with the task pipes
+  int exits_fd;             // exit statuses of the tasks, read end
+  bool running;             // false once the helper is gone
+} spawner_t;
+
+spawner_t *spawner_new(void);
+void spawner_destroy(spawner_t **self);
+
+bool spawner_running(spawner_t *self);
+pid_t spawner_exec(spawner_t *self, const char *cmd, bool shell, const spawn_limits *limits,
+    int *output_fd, int *input_fd, uint32_t *cgroup);
+bool spawner_reap(spawner_t *self, pid_t *pid, int *status, struct rusage *usage);
+
+bool spawner_limited(const spawn_limits *limits);
+void spawner_apply_limits(const spawn_limits *limits);
+int spawner_kill(pid_t pid, uint32_t cgroup, int signal);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _SATAN_SPAWNER_H_
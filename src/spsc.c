@@ -0,0 +1,97 @@
+/**
+ * =====================================================================================
+ *
+ *   @file spsc.c
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  06/07/2013 10:20:13 AM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Lock-free single producer, single consumer queue.
+ *
+ *       A fixed ring of pointer slots. Only the producer moves the tail and
+ *       only the consumer moves the head, each one reading the other index
+ *       with acquire semantics and publishing its own with release
+ *       semantics, so that the slot contents are visible before the index
+ *       that hands them over. The two indexes live on their own cache lines.
+ *
+ *       Nothing here blocks or wakes anyone up: callers pair the queue with a
+ *       notification of their own.
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include "spsc.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+spsc_t *spsc_new(size_t capacity)
+{
+  size_t size = 1;
+
+  while (size < capacity)
+    size <<= 1;
+
+  spsc_t *self = calloc(1, sizeof(spsc_t));
+  assert(self);
+
+  self->mask = size - 1;
+  self->slots = calloc(size, sizeof(void*));
+  assert(self->slots);
+
+  return self;
+}
+
+/*  Items still queued belong to the caller, drain them first */
+void spsc_destroy(spsc_t **self)
+{
+  assert(self);
+
+  if (*self) {
+    free((*self)->slots);
+    free(*self);
+    *self = NULL;
+  }
+}
+
+/*  Producer side, false when the queue is full */
+bool spsc_push(spsc_t *self, void *item)
+{
+  size_t tail = __atomic_load_n(&self->tail, __ATOMIC_RELAXED);
+  size_t head = __atomic_load_n(&self->head, __ATOMIC_ACQUIRE);
+
+  if (tail - head > self->mask)
+    return false;
+
+  self->slots[tail & self->mask] = item;
+  __atomic_store_n(&self->tail, tail + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+/*  Consumer side, NULL when the queue is empty */
+void *spsc_pop(spsc_t *self)
+{
+  size_t head = __atomic_load_n(&self->head, __ATOMIC_RELAXED);
+  size_t tail = __atomic_load_n(&self->tail, __ATOMIC_ACQUIRE);
+
+  if (head == tail)
+    return NULL;
+
+  void *item = self->slots[head & self->mask];
+  __atomic_store_n(&self->head, head + 1, __ATOMIC_RELEASE);
+  return item;
+}
+
+/*  Consumer side */
+bool spsc_empty(spsc_t *self)
+{
+  return __atomic_load_n(&self->head, __ATOMIC_RELAXED)
+    == __atomic_load_n(&self->tail, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,53 @@
+/**
+ * =====================================================================================
+ *
+ *   @file spsc.h
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  06/07/2013 10:12:40 AM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Lock-free single producer, single consumer queue of pointers
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifndef _SATAN_SPSC_H_
+#define _SATAN_SPSC_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SPSC_CACHE_LINE 64
+
+typedef struct s_spsc_t {
+  size_t head;              // next slot to read, owned by the consumer
+  char _pad1[SPSC_CACHE_LINE - sizeof(size_t)];
+  size_t tail;              // next slot to write, owned by the producer
+  char _pad2[SPSC_CACHE_LINE - sizeof(size_t)];
+  size_t mask;              // capacity - 1, a power of two
+  void **slots;
+} spsc_t;
+
+spsc_t *spsc_new(size_t capacity);
+void spsc_destroy(spsc_t **self);
+
+bool spsc_push(spsc_t *self, void *item);
+void *spsc_pop(spsc_t *self);
+bool spsc_empty(spsc_t *self);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _SATAN_SPSC_H_
@@ -0,0 +1,132 @@
+/**
+ * =====================================================================================
+ *
+ *   @file submit.c
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  06/12/2013 11:40:02 AM
+ *
+ *   @section DESCRIPTION
+ *
+ *       satan-submit: hands a local event over to the running satan, which
+ *       sends it to the server on its own connection.
+ *
+ *         satan-submit hotplug "usb1 added"
+ *         logread | satan-submit syslog -
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include "platform.h"
+#include "main.h"
+#include "local.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <czmq.h>
+
+#ifdef SATAN_HAVE_UCI
+#include "config.h"
+#endif
+
+#define SUBMIT_LINGER 5000 // ms to wait for satan before giving up
+
+static void s_help(void)
+{
+  errorLog("Usage: satan-submit [-l LOCAL_ENDPOINT] TAG [DATA | -]\n");
+  exit(1);
+}
+
+/*  Standard input, NULL if longer than max: one more byte is read to tell */
+static zframe_t *s_read_stdin(size_t max)
+{
+  size_t len = 0;
+  uint8_t *buffer = malloc(max + 1);
+  assert(buffer);
+
+  while (len <= max) {
+    size_t n = fread(buffer + len, 1, max + 1 - len, stdin);
+    if (n == 0)
+      break;
+    len += n;
+  }
+
+  zframe_t *frame = len <= max ? zframe_new(buffer, len) : NULL;
+  free(buffer);
+  return frame;
+}
+
+int main(int argc, char *argv[])
+{
+  char *endpoint = DEFAULT_LOCAL_ENDPOINT;
+  size_t budget = DEFAULT_LOCAL_BUDGET;
+  int arg = 1;
+
+#ifdef SATAN_HAVE_UCI
+  config_context *cfg_ctx = config_new();
+  char *local = config_get_str(cfg_ctx, "satan.local.endpoint");
+  if (local != NULL)
+    endpoint = local;
+  if (config_get_int(cfg_ctx, "satan.local.budget") > 0)
+    budget = config_get_int(cfg_ctx, "satan.local.budget");
+  config_destroy(cfg_ctx);
+#endif
+
+  if (arg + 1 < argc && str_equals(argv[arg], "-l")) {
+    endpoint = argv[arg + 1];
+    arg += 2;
+  }
+  if (arg >= argc || argc > arg + 2 || strlen(argv[arg]) == 0)
+    s_help();
+
+  /*  satan drops what does not fit in its budget, tag included */
+  size_t tag_len = strlen(argv[arg]);
+  if (tag_len > MAX_STRING_LEN || tag_len > budget) {
+    errorLog("Tag too long");
+    return 1;
+  }
+
+  zmsg_t *event = zmsg_new();
+  zmsg_addstr(event, "%s", argv[arg]);
+  if (arg + 1 < argc && str_equals(argv[arg + 1], "-")) {
+    zframe_t *data = s_read_stdin(budget - tag_len);
+    if (data == NULL) {
+      errorLog("Input longer than the %zu bytes an event may carry", budget - tag_len);
+      zmsg_destroy(&event);
+      return 1;
+    }
+    zmsg_add(event, data);
+  } else if (arg + 1 < argc) {
+    if (strlen(argv[arg + 1]) > budget - tag_len) {
+      errorLog("Data longer than the %zu bytes an event may carry", budget - tag_len);
+      zmsg_destroy(&event);
+      return 1;
+    }
+    zmsg_addstr(event, "%s", argv[arg + 1]);
+  }
+
+  /*  The event is queued at once; wait for it to be delivered, not forever */
+  zctx_t *ctx = zctx_new();
+  zctx_set_linger(ctx, SUBMIT_LINGER);
+  void *socket = zsocket_new(ctx, ZMQ_PUSH);
+  zsocket_set_sndtimeo(socket, SUBMIT_LINGER);
+  if (zsocket_connect(socket, "%s", endpoint) != 0) {
+    errorLog("Cannot connect to %s", endpoint);
+    return 1;
+  }
+
+  int ret = zmsg_send(&event, socket);
+  zmsg_destroy(&event);
+  zctx_destroy(&ctx);
+
+  if (ret != 0) {
+    errorLog("satan did not take the event");
+    return 1;
+  }
+  return 0;
+}
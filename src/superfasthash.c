@@ -41,18 +41,14 @@
                       +(uint32_t)(((const uint8_t *)(d))[0]) )
 #endif
 
-uint32_t SuperFastHash (uint8_t* data, int len, uint32_t hash) 
+/* Main loop only, over the first len / 4 blocks: a frame may be hashed in
+ * pieces that are all a multiple of 4 bytes long, but the last one which
+ * goes through SuperFastHash() itself. */
+uint32_t SuperFastHashBlocks (const uint8_t* data, int len, uint32_t hash)
 {
 	uint32_t tmp;
-	int rem;
-
-	if (len <= 0 || data == NULL) return 0;
-
-	rem = len & 3;
-	len >>= 2;
 
-	/* Main loop */
-	for (;len > 0; len--) {
+	for (len >>= 2; len > 0; len--) {
 		hash  += get16bits (data);
 		tmp    = (get16bits (data+2) << 11) ^ hash;
 		hash   = (hash << 16) ^ tmp;
@@ -60,6 +56,21 @@ uint32_t SuperFastHash (uint8_t* data, int len, uint32_t hash)
 		hash  += hash >> 11;
 	}
 
+	return hash;
+}
+
+uint32_t SuperFastHash (uint8_t* data, int len, uint32_t hash) 
+{
+	int rem;
+
+	if (len <= 0 || data == NULL) return 0;
+
+	rem = len & 3;
+
+	/* Main loop */
+	hash = SuperFastHashBlocks (data, len, hash);
+	data += len - rem;
+
 	/* Handle end cases */
 	switch (rem) {
 		case 3: hash += get16bits (data);
@@ -47,6 +47,7 @@ extern "C" {
 #endif
 
 uint32_t SuperFastHash (uint8_t* data, int len, uint32_t hash);
+uint32_t SuperFastHashBlocks (const uint8_t* data, int len, uint32_t hash);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,521 @@
+/**
+ * =====================================================================================
+ *
+ *   @file sync.c
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  06/19/2013 10:41:05 AM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Directory synchronization.
+ *
+ *       SYNC answers the manifest of a tree: one entry per regular file, as
+ *       path (relative to the tree), size, mtime and CRC32C of its contents,
+ *       sorted by path, and a digest of all of them. Hashes are cached by
+ *       device and inode, and kept as long as the size and mtime match, so a
+ *       rescan only reads the files that changed.
+ *
+ *       SYNCAPPLY then carries the files to add or replace and those to
+ *       delete, along with the digest of the manifest the server based them
+ *       on: a tree that changed meanwhile is left alone. New contents are all
+ *       written next to their target first, and only renamed into place (and
+ *       the deletions done) once every one of them is on the flash. The files
+ *       they replace or delete are renamed aside meanwhile, so that a rename
+ *       that fails halfway puts everything back.
+ *
+ *       Both run on the file I/O stage; the cache belongs to it.
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include "main.h"
+#include "messages.h"
+#include "checksum.h"
+#include "sync.h"
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+typedef struct {
+  char *lines[SYNC_ENTRIES_MAX]; // "path\tsize\tmtime\tcrc"
+  int count;
+  bool overflow;
+} s_manifest_t;
+
+typedef struct {
+  char *path;               // relative
+  zframe_t *data;           // NULL for a deletion
+  uint32_t crc;
+  bool backup;              // the previous file is aside, under SYNC_BACKUP_SUFFIX
+} s_change_t;
+
+sync_cache *sync_new(size_t max)
+{
+  sync_cache *self = malloc(sizeof(sync_cache));
+  assert(self);
+
+  self->hashes = zhash_new();
+  self->keys = zlist_new();
+  self->max = max;
+  self->buffer = malloc(IOENGINE_CHUNK_SIZE);
+  assert(self->buffer);
+
+  return self;
+}
+
+void sync_destroy(sync_cache **self)
+{
+  assert(self);
+
+  if (*self) {
+    char *key;
+    while ((key = zlist_pop((*self)->keys)) != NULL)
+      free(key);
+    zlist_destroy(&(*self)->keys);
+    zhash_destroy(&(*self)->hashes);
+    free((*self)->buffer);
+    free(*self);
+    *self = NULL;
+  }
+}
+
+static int64_t s_mtime(struct stat *st)
+{
+  return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+}
+
+/*  Evict the oldest hash not used since it was last passed over, so that
+ *  the files of the trees synchronized often stay */
+static void s_evict(sync_cache *self)
+{
+  char *key;
+
+  while ((key = zlist_pop(self->keys)) != NULL) {
+    sync_hash *hash = zhash_lookup(self->hashes, key);
+    if (hash != NULL && hash->used) {
+      hash->used = false;
+      zlist_append(self->keys, key);
+      continue;
+    }
+    zhash_delete(self->hashes, key);
+    free(key);
+    return;
+  }
+}
+
+static void s_remember(sync_cache *self, struct stat *st, uint32_t crc)
+{
+  char key[48];
+  snprintf(key, sizeof(key), "%lx:%lx", (unsigned long)st->st_dev, (unsigned long)st->st_ino);
+
+  sync_hash *hash = zhash_lookup(self->hashes, key);
+  if (hash == NULL) {
+    if (zhash_size(self->hashes) >= self->max)
+      s_evict(self);
+    hash = malloc(sizeof(sync_hash));
+    assert(hash);
+    zhash_insert(self->hashes, key, hash);
+    zhash_freefn(self->hashes, key, free);
+    zlist_append(self->keys, strdup(key));
+  }
+
+  hash->size = st->st_size;
+  hash->mtime = s_mtime(st);
+  hash->crc = crc;
+  hash->used = false;
+}
+
+/*  CRC32C of a file, from the cache while it has not changed */
+static int s_hash(sync_cache *self, const char *path, struct stat *st, uint32_t *crc)
+{
+  char key[48];
+  snprintf(key, sizeof(key), "%lx:%lx", (unsigned long)st->st_dev, (unsigned long)st->st_ino);
+
+  sync_hash *hash = zhash_lookup(self->hashes, key);
+  if (hash != NULL && hash->size == st->st_size && hash->mtime == s_mtime(st)) {
+    hash->used = true;
+    *crc = hash->crc;
+    return STATUS_OK;
+  }
+
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    return STATUS_ERROR;
+
+  ssize_t len;
+  *crc = 0;
+  while ((len = read(fd, self->buffer, IOENGINE_CHUNK_SIZE)) > 0)
+    *crc = checksum_update(CHECKSUM_CRC32C, *crc, self->buffer, len);
+  close(fd);
+  if (len == -1)
+    return STATUS_ERROR;
+
+  s_remember(self, st, *crc);
+  return STATUS_OK;
+}
+
+static bool s_suffixed(const char *name, const char *suffix)
+{
+  size_t len = strlen(name), size = strlen(suffix);
+  return len >= size && str_equals(name + len - size, suffix);
+}
+
+/*  Our own files, in the middle of a SYNCAPPLY */
+static bool s_staged(const char *name)
+{
+  return s_suffixed(name, SYNC_STAGED_SUFFIX) || s_suffixed(name, SYNC_BACKUP_SUFFIX);
+}
+
+static void s_scan(sync_cache *self, const char *root, const char *relative, int depth, s_manifest_t *manifest)
+{
+  char path[PATH_MAX], entry_path[PATH_MAX], line[PATH_MAX + 64];
+  struct dirent *entry;
+  struct stat st;
+
+  if (depth == ARCHIVE_MAX_DEPTH) {
+    errorLog("%s/%s: too deep, not synchronized", root, relative);
+    return;
+  }
+
+  snprintf(path, PATH_MAX, "%s/%s", root, relative);
+  DIR *dir = opendir(path);
+  if (dir == NULL)
+    return;
+
+  while ((entry = readdir(dir)) != NULL) {
+    if (str_equals(entry->d_name, ".") || str_equals(entry->d_name, "..") || s_staged(entry->d_name))
+      continue;
+
+    if (relative[0] != 0)
+      snprintf(entry_path, PATH_MAX, "%s/%s", relative, entry->d_name);
+    else
+      snprintf(entry_path, PATH_MAX, "%s", entry->d_name);
+    snprintf(path, PATH_MAX, "%s/%s", root, entry_path);
+    if (lstat(path, &st) != 0)
+      continue;
+
+    /*  Regular files only: links and special files are not synchronized */
+    if (S_ISDIR(st.st_mode)) {
+      s_scan(self, root, entry_path, depth + 1, manifest);
+    } else if (S_ISREG(st.st_mode)) {
+      uint32_t crc;
+      if (s_hash(self, path, &st, &crc) != STATUS_OK)
+        continue;
+      if (manifest->count == SYNC_ENTRIES_MAX) {
+        manifest->overflow = true;
+        continue;
+      }
+      snprintf(line, sizeof(line), "%s\t%lld\t%lld\t%08x", entry_path,
+          (long long)st.st_size, (long long)st.st_mtim.tv_sec, crc);
+      manifest->lines[manifest->count++] = strdup(line);
+    }
+  }
+  closedir(dir);
+}
+
+static int s_compare(const void *a, const void *b)
+{
+  return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/*  Manifest of the tree, and its digest: CRC32C of all its entries, in order */
+static int s_manifest(sync_cache *self, const char *root, char *digest, zmsg_t *out)
+{
+  s_manifest_t *manifest = calloc(1, sizeof(s_manifest_t));
+  uint32_t crc = 0;
+  struct stat st;
+  int i, ret = STATUS_OK;
+
+  assert(manifest);
+  if (stat(root, &st) != 0 || !S_ISDIR(st.st_mode)) {
+    free(manifest);
+    return STATUS_ERROR;
+  }
+
+  s_scan(self, root, "", 0, manifest);
+  if (manifest->overflow) {
+    errorLog("%s: more than %d files, not synchronized", root, SYNC_ENTRIES_MAX);
+    ret = STATUS_ERROR;
+  }
+
+  qsort(manifest->lines, manifest->count, sizeof(char*), s_compare);
+  for (i = 0; i < manifest->count; i++) {
+    crc = checksum_update(CHECKSUM_CRC32C, crc, (uint8_t*)manifest->lines[i], strlen(manifest->lines[i]));
+    if (out != NULL && ret == STATUS_OK)
+      zmsg_addstr(out, "%s", manifest->lines[i]);
+    free(manifest->lines[i]);
+  }
+  snprintf(digest, 9, "%08x", crc);
+  if (out != NULL && ret == STATUS_OK)
+    zmsg_pushstr(out, "%s", digest);
+
+  free(manifest);
+  return ret;
+}
+
+/*  [digest][entry]... appended to the manifest message */
+int sync_manifest(sync_cache *self, const char *root, zmsg_t *manifest)
+{
+  assert(self);
+  assert(root);
+  assert(manifest);
+
+  char digest[9];
+  zmsg_t *entries = zmsg_new();
+  int ret = s_manifest(self, root, digest, entries);
+
+  zframe_t *frame;
+  while ((frame = zmsg_pop(entries)) != NULL)
+    zmsg_add(manifest, frame);
+  zmsg_destroy(&entries);
+
+  return ret == STATUS_OK ? MSG_ANSWER_COMPLETED : MSG_ANSWER_EXECERROR;
+}
+
+/*  Relative, without any '.' or '..' component: stays inside the tree */
+static bool s_path_valid(const char *path)
+{
+  const char *component = path;
+
+  if (path[0] == 0 || path[0] == '/' || s_staged(path))
+    return false;
+  while (component != NULL) {
+    const char *next = strchr(component, '/');
+    size_t len = next != NULL ? (size_t)(next - component) : strlen(component);
+    if (len == 0 || (len == 1 && component[0] == '.') || (len == 2 && strncmp(component, "..", 2) == 0))
+      return false;
+    component = next != NULL ? next + 1 : NULL;
+  }
+  return true;
+}
+
+/*  No component of the path is a symbolic link, which rename() and mkdir()
+ *  would follow out of the tree, and its parents are directories */
+static bool s_path_safe(const char *root, const char *path)
+{
+  char prefix[PATH_MAX];
+  const char *slash = path;
+  struct stat st;
+
+  do {
+    slash = strchr(slash, '/');
+    size_t len = slash != NULL ? (size_t)(slash - path) : strlen(path);
+    snprintf(prefix, PATH_MAX, "%s/%.*s", root, (int)len, path);
+    if (lstat(prefix, &st) != 0)
+      return errno == ENOENT; // created as we go
+    if (S_ISLNK(st.st_mode) || (slash != NULL && !S_ISDIR(st.st_mode)))
+      return false;
+  } while (slash++ != NULL);
+  return true;
+}
+
+/*  The directories made are pushed on 'made', deepest first */
+static void s_make_parents(const char *path, zlist_t *made)
+{
+  char dir[PATH_MAX];
+  char *slash;
+
+  snprintf(dir, PATH_MAX, "%s", path);
+  for (slash = strchr(dir + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/')) {
+    *slash = 0;
+    if (mkdir(dir, 0755) == 0)
+      zlist_push(made, strdup(dir));
+    *slash = '/';
+  }
+}
+
+/*  Those left empty, once the changes are undone */
+static void s_remove_parents(zlist_t *made)
+{
+  char *dir;
+
+  while ((dir = zlist_pop(made)) != NULL) {
+    rmdir(dir);
+    free(dir);
+  }
+}
+
+/*  New contents next to their target, with the mode of the file they replace */
+static int s_stage(ioengine_t *engine, const char *root, s_change_t *change, zlist_t *made)
+{
+  char path[PATH_MAX], staged[PATH_MAX];
+  struct stat st;
+
+  snprintf(path, PATH_MAX, "%s/%s", root, change->path);
+  snprintf(staged, PATH_MAX, "%s%s", path, SYNC_STAGED_SUFFIX);
+  s_make_parents(path, made);
+  unlink(staged);
+
+  if (ioengine_write_file(engine, staged, zframe_data(change->data), zframe_size(change->data)) != STATUS_OK)
+    return STATUS_ERROR;
+  if (stat(path, &st) == 0)
+    chmod(staged, st.st_mode & 07777);
+
+  change->crc = checksum_update(CHECKSUM_CRC32C, 0, zframe_data(change->data), zframe_size(change->data));
+  return STATUS_OK;
+}
+
+static void s_unstage(const char *root, s_change_t *changes, int count)
+{
+  char staged[PATH_MAX];
+  int i;
+
+  for (i = 0; i < count; i++) {
+    if (changes[i].data != NULL) {
+      snprintf(staged, PATH_MAX, "%s/%s%s", root, changes[i].path, SYNC_STAGED_SUFFIX);
+      unlink(staged);
+    }
+  }
+}
+
+/*  The previous file aside, then the new contents in its place */
+static int s_commit(const char *root, s_change_t *change)
+{
+  char path[PATH_MAX], staged[PATH_MAX], backup[PATH_MAX];
+  struct stat st;
+
+  snprintf(path, PATH_MAX, "%s/%s", root, change->path);
+  snprintf(staged, PATH_MAX, "%s%s", path, SYNC_STAGED_SUFFIX);
+  snprintf(backup, PATH_MAX, "%s%s", path, SYNC_BACKUP_SUFFIX);
+
+  if (lstat(path, &st) == 0) {
+    if (S_ISDIR(st.st_mode)) {
+      errorLog("%s: is a directory", path);
+      return STATUS_ERROR;
+    }
+    if (rename(path, backup) != 0) {
+      errorLog("%s: cannot be moved aside: %s", path, strerror(errno));
+      return STATUS_ERROR;
+    }
+    change->backup = true;
+  }
+
+  if (change->data != NULL && rename(staged, path) != 0) {
+    errorLog("%s: cannot be renamed into place: %s", path, strerror(errno));
+    if (change->backup && rename(backup, path) == 0)
+      change->backup = false;
+    return STATUS_ERROR;
+  }
+  return STATUS_OK;
+}
+
+/*  Undo s_commit(): the new contents back to staging, the previous file back in place */
+static void s_rollback(const char *root, s_change_t *change)
+{
+  char path[PATH_MAX], staged[PATH_MAX], backup[PATH_MAX];
+
+  snprintf(path, PATH_MAX, "%s/%s", root, change->path);
+  snprintf(staged, PATH_MAX, "%s%s", path, SYNC_STAGED_SUFFIX);
+  snprintf(backup, PATH_MAX, "%s%s", path, SYNC_BACKUP_SUFFIX);
+
+  if (change->data != NULL && rename(path, staged) != 0)
+    errorLog("%s: cannot be rolled back: %s", path, strerror(errno));
+  if (change->backup && rename(backup, path) != 0)
+    errorLog("%s: cannot be restored: %s", path, strerror(errno));
+  change->backup = false;
+}
+
+/*  [root][digest] then ['+' path][data] or ['-' path] per change */
+int sync_apply(sync_cache *self, ioengine_t *engine, zmsg_t *arguments)
+{
+  assert(self);
+  assert(engine);
+  assert(arguments);
+
+  char *root = zmsg_popstr(arguments);
+  char *expected = zmsg_popstr(arguments);
+  s_change_t *changes = calloc(SYNC_ENTRIES_MAX, sizeof(s_change_t));
+  zlist_t *made = zlist_new();
+  char digest[9], path[PATH_MAX];
+  int count = 0, committed = 0, i;
+  int ret = MSG_ANSWER_EXECERROR;
+  struct stat st;
+
+  assert(changes);
+  if (root == NULL || expected == NULL)
+    goto s_apply_end;
+
+  /*  The server diffed against that manifest: nothing must have changed since */
+  if (s_manifest(self, root, digest, NULL) != STATUS_OK || !str_equals(digest, expected)) {
+    debugLog("%s changed since its manifest, not synchronized", root);
+    goto s_apply_end;
+  }
+
+  char *op;
+  while ((op = zmsg_popstr(arguments)) != NULL) {
+    bool valid = count < SYNC_ENTRIES_MAX && (op[0] == '+' || op[0] == '-')
+      && s_path_valid(op + 1) && s_path_safe(root, op + 1);
+    if (valid) {
+      changes[count].path = strdup(op + 1);
+      if (op[0] == '+')
+        valid = (changes[count].data = zmsg_pop(arguments)) != NULL;
+      count++;
+    }
+    free(op);
+    if (!valid)
+      goto s_apply_end;
+  }
+
+  for (i = 0; i < count; i++) {
+    if (changes[i].data == NULL)
+      continue;
+    if (s_stage(engine, root, &changes[i], made) != STATUS_OK) {
+      errorLog("%s/%s: cannot be written, nothing synchronized", root, changes[i].path);
+      goto s_apply_undo;
+    }
+  }
+
+  /*  Everything is on the flash: commit, all or nothing */
+  for (committed = 0; committed < count; committed++) {
+    if (s_commit(root, &changes[committed]) != STATUS_OK) {
+      errorLog("%s: rolling back, nothing synchronized", root);
+      goto s_apply_undo;
+    }
+  }
+
+  for (i = 0; i < count; i++) {
+    snprintf(path, PATH_MAX, "%s/%s", root, changes[i].path);
+    if (changes[i].data != NULL && stat(path, &st) == 0)
+      s_remember(self, &st, changes[i].crc);
+    if (changes[i].backup) {
+      strncat(path, SYNC_BACKUP_SUFFIX, PATH_MAX - strlen(path) - 1);
+      unlink(path);
+    }
+  }
+  ret = MSG_ANSWER_COMPLETED;
+  goto s_apply_end;
+
+s_apply_undo:
+  while (committed-- > 0)
+    s_rollback(root, &changes[committed]);
+  s_unstage(root, changes, count);
+  s_remove_parents(made);
+
+s_apply_end:
+  for (i = 0; i < count; i++) {
+    free(changes[i].path);
+    if (changes[i].data != NULL)
+      zframe_destroy(&changes[i].data);
+  }
+  char *dir;
+  while ((dir = zlist_pop(made)) != NULL)
+    free(dir);
+  zlist_destroy(&made);
+  free(changes);
+  free(expected);
+  free(root);
+  return ret;
+}
@@ -0,0 +1,58 @@
+/**
+ * =====================================================================================
+ *
+ *   @file sync.h
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  06/19/2013 10:41:05 AM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Directory synchronization headers
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include <czmq.h>
+#include "ioengine.h"
+
+#ifndef _SATAN_SYNC_H_
+#define _SATAN_SYNC_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SYNC_STAGED_SUFFIX ".satan-sync"     // new contents, before they are renamed into place
+#define SYNC_BACKUP_SUFFIX ".satan-sync-old" // replaced or deleted files, until all changes are made
+
+typedef struct s_sync_hash_t {
+  int64_t size;
+  int64_t mtime;            // ns
+  uint32_t crc;             // CRC32C of the contents
+  bool used;                // looked up since the last eviction pass
+} sync_hash;
+
+typedef struct s_sync_cache_t {
+  zhash_t *hashes;          // "dev:inode" -> sync_hash
+  zlist_t *keys;            // of the hashes, oldest first
+  size_t max;               // entries, evicted one by one beyond
+  uint8_t *buffer;          // file reads
+} sync_cache;
+
+sync_cache *sync_new(size_t max);
+void sync_destroy(sync_cache **self);
+
+int sync_manifest(sync_cache *self, const char *root, zmsg_t *manifest);
+int sync_apply(sync_cache *self, ioengine_t *engine, zmsg_t *arguments);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _SATAN_SYNC_H_
@@ -0,0 +1,1000 @@
+/**
+ * =====================================================================================
+ *
+ *   @file tasks.c
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  05/12/2013 10:21:47 AM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Task table management.
+ *
+ *       Every EXEC'd task has its stdout connected to a pipe read by the worker.
+ *       Output is queued into a per-task outbox and flushed to the answer socket
+ *       only when it has room. When a task outbox (or all of them together) goes
+ *       over its budget, the worker stops reading the task pipe: the kernel pipe
+ *       buffer fills up and the producer gets blocked on write().
+ *
+ *       Tasks with an output ring only keep their last output bytes, which the
+ *       server fetches on demand (tail) or asks to have streamed (follow).
+ *
+ *       PULL'ed files and directories are read by the file I/O stage instead,
+ *       a batch of chunks at a time while the task is not throttled.
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include "main.h"
+#include "messages.h"
+#include "utils.h"
+#include "tasks.h"
+#include "wire.h"
+#include "fileio.h"
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#ifdef SATAN_TINY
+/*  Task items come from a static table, no heap */
+static process_item s_slots[TASK_MAX];
+static bool s_slot_used[TASK_MAX];
+
+static process_item *s_item_alloc(void)
+{
+  int i;
+  for (i = 0; i < TASK_MAX; i++) {
+    if (!s_slot_used[i]) {
+      s_slot_used[i] = true;
+      memset(&s_slots[i], 0, sizeof(process_item));
+      return &s_slots[i];
+    }
+  }
+  return NULL;
+}
+
+static void s_item_free(process_item *item)
+{
+  s_slot_used[item - s_slots] = false;
+}
+#else
+static process_item *s_item_alloc(void)
+{
+  return calloc(1, sizeof(process_item));
+}
+
+static void s_item_free(process_item *item)
+{
+  free(item);
+}
+#endif
+
+task_table *tasks_new(size_t task_budget, size_t global_budget)
+{
+  task_table *self = malloc(sizeof(task_table));
+  assert(self);
+
+  self->items = zlist_new();
+  self->outbox_bytes = 0;
+  self->outbox_messages = 0;
+  self->task_budget = task_budget;
+  self->global_budget = global_budget;
+  self->recorder = NULL;
+  self->spawner = NULL;
+  self->reserved = 0;
+  self->ring_bytes = 0;
+  self->task_rate = 0;
+  self->task_burst = 0;
+  bucket_init(&self->bucket, 0, 0);
+
+  return self;
+}
+
+static void s_close_input(process_item *item)
+{
+  zframe_t *frame = NULL;
+  while ((frame = zlist_pop(item->inbox)) != NULL)
+    zframe_destroy(&frame);
+  item->inbox_bytes = 0;
+  item->inbox_pos = 0;
+  if (item->input_fd != -1)
+    close(item->input_fd);
+  item->input_fd = -1;
+}
+
+static void s_close_source(process_item *item)
+{
+  if (item->output_fd != -1)
+    close(item->output_fd);
+  item->output_fd = -1;
+  archive_destroy(&item->archive);
+}
+
+static void s_item_destroy(process_item *item)
+{
+  zmsg_t *msg = NULL;
+  while ((msg = zlist_pop(item->outbox)) != NULL)
+    zmsg_destroy(&msg);
+  zlist_destroy(&item->outbox);
+  s_close_input(item);
+  zlist_destroy(&item->inbox);
+  if (!item->reading)
+    s_close_source(item); // still read by the file I/O stage otherwise, left to the exit
+  free(item->ring);
+  free(item->capture);
+  free(item->message_id);
+  free(item->command);
+  s_item_free(item);
+}
+
+void tasks_destroy(task_table **self)
+{
+  assert(self);
+
+  if (*self) {
+    process_item *item = NULL;
+    while ((item = zlist_pop((*self)->items)) != NULL)
+      s_item_destroy(item);
+    zlist_destroy(&(*self)->items);
+    free(*self);
+    *self = NULL;
+  }
+}
+
+process_item *tasks_add(task_table *self, int kind, pid_t pid, int output_fd,
+    const char *msgid, const char *command)
+{
+  assert(self);
+  assert(msgid);
+  assert(command);
+
+  if (zlist_size(self->items) >= TASK_MAX)
+    return NULL;
+
+  process_item *item = s_item_alloc();
+  assert(item);
+
+  item->kind = kind;
+  item->pid = pid;
+  item->cgroup = 0;
+  item->exited = (pid == 0); // Nothing to reap
+  item->accounted = (pid > 0);
+  item->started_at = zclock_time();
+  item->output_fd = output_fd;
+  item->input_fd = -1;
+  item->inbox = zlist_new();
+  item->message_id = strdup(msgid);
+  item->command = strdup(command);
+  item->outbox = zlist_new();
+  bucket_init(&item->bucket, self->task_rate, self->task_burst);
+
+  zlist_append(self->items, item);
+  return item;
+}
+
+/*  No room for another task, counting the promised ones */
+bool tasks_full(task_table *self)
+{
+  assert(self);
+
+  return zlist_size(self->items) + self->reserved >= TASK_MAX;
+}
+
+/*  Outbound rate and burst, in bytes per second and bytes, 0 for unlimited */
+void tasks_set_shaping(task_table *self, int64_t rate, int64_t burst, int64_t task_rate, int64_t task_burst)
+{
+  assert(self);
+
+  bucket_init(&self->bucket, rate, burst);
+  self->task_rate = task_rate;
+  self->task_burst = task_burst;
+}
+
+/*  Per command override of the task shaping */
+void tasks_set_rate(task_table *self, process_item *item, int64_t rate, int64_t burst)
+{
+  assert(self);
+  assert(item);
+
+  bucket_init(&item->bucket, rate, burst);
+}
+
+/*  Wall-clock limit of a task, in ms */
+void tasks_set_timeout(task_table *self, process_item *item, int64_t timeout)
+{
+  assert(self);
+  assert(item);
+
+  item->deadline = item->started_at + timeout;
+}
+
+process_item *tasks_lookup(task_table *self, const char *msgid)
+{
+  assert(self);
+  assert(msgid);
+
+  process_item *item = zlist_first(self->items);
+  while (item != NULL) {
+    if (str_equals(item->message_id, msgid))
+      return item;
+    item = zlist_next(self->items);
+  }
+  return NULL;
+}
+
+static void s_enqueue(task_table *self, process_item *item, zmsg_t *msg)
+{
+  size_t size = zmsg_content_size(msg);
+  zlist_append(item->outbox, msg);
+  item->outbox_bytes += size;
+  self->outbox_bytes += size;
+  self->outbox_messages++;
+}
+
+static zmsg_t *s_pop(task_table *self, process_item *item)
+{
+  zmsg_t *msg = zlist_pop(item->outbox);
+  size_t size = zmsg_content_size(msg);
+  item->outbox_bytes -= size;
+  self->outbox_bytes -= size;
+  self->outbox_messages--;
+  return msg;
+}
+
+static bool s_answer_is(zmsg_t *msg, const char *answer)
+{
+  if (msg == NULL || zmsg_size(msg) < 3)
+    return false;
+  zmsg_first(msg);
+  zmsg_next(msg);
+  return zframe_streq(zmsg_next(msg), answer);
+}
+
+static bool s_is_output(zmsg_t *msg)
+{
+  return zmsg_size(msg) == 4 && s_answer_is(msg, MSG_ANSWER_STR_CMDOUTPUT);
+}
+
+/*  Final statuses and credits, which go out first */
+static bool s_is_control(zmsg_t *msg)
+{
+  return s_answer_is(msg, MSG_ANSWER_STR_COMPLETED)
+    || s_answer_is(msg, MSG_ANSWER_STR_EXECERROR)
+    || s_answer_is(msg, MSG_ANSWER_STR_CREDIT);
+}
+
+/*  Next message of the task, with the output queued behind it merged in, as
+ *  much as the buckets let through right away: a shaped or blocked task sends
+ *  fewer, larger messages. */
+static zmsg_t *s_dequeue(task_table *self, process_item *item)
+{
+  zmsg_t *msg = s_pop(self, item);
+  if (!s_is_output(msg))
+    return msg;
+
+  int64_t room = TASK_COALESCE_MAX;
+  if (bucket_available(&item->bucket) < room)
+    room = bucket_available(&item->bucket);
+  if (bucket_available(&self->bucket) < room)
+    room = bucket_available(&self->bucket);
+
+  size_t size = zmsg_content_size(msg);
+  zmsg_t *next = zlist_first(item->outbox);
+  if (!s_is_output(next) || (int64_t)(size + zframe_size(zmsg_last(next))) > room)
+    return msg;
+
+  zframe_t *data = zmsg_last(msg);
+  size_t len = zframe_size(data);
+  uint8_t *buffer = malloc(room);
+  assert(buffer);
+  memcpy(buffer, zframe_data(data), len);
+
+  while (s_is_output(next) && (int64_t)(size + zframe_size(zmsg_last(next))) <= room) {
+    next = s_pop(self, item);
+    zframe_t *more = zmsg_last(next);
+    memcpy(buffer + len, zframe_data(more), zframe_size(more));
+    len += zframe_size(more);
+    size += zframe_size(more);
+    zmsg_destroy(&next);
+    next = zlist_first(item->outbox);
+  }
+
+  zmsg_remove(msg, data);
+  zframe_destroy(&data);
+  zmsg_add(msg, zframe_new(buffer, len));
+  free(buffer);
+  return msg;
+}
+
+/*  Pause reading when over budget, resume once drained to half of it */
+static void s_update_throttling(task_table *self, process_item *item)
+{
+  bool over = item->outbox_bytes >= self->task_budget
+    || self->outbox_bytes >= self->global_budget;
+  bool drained = item->outbox_bytes <= self->task_budget / 2
+    && self->outbox_bytes <= self->global_budget / 2;
+
+  if (!item->throttled && over) {
+    item->throttled = true;
+    item->throttled_since = zclock_time();
+    debugLog("Throttling task %d (%zu bytes queued, %zu total)",
+        item->pid, item->outbox_bytes, self->outbox_bytes);
+  } else if (item->throttled && drained) {
+    item->throttled = false;
+    item->throttled_ms += zclock_time() - item->throttled_since;
+    debugLog("Resuming task %d after %lld ms", item->pid, (long long)item->throttled_ms);
+  }
+}
+
+/*  Queued output of a killed task; the statuses of TAILs, under their own
+ *  message ids, are kept */
+static void s_drop_output(task_table *self, process_item *item)
+{
+  zmsg_t *msg = NULL;
+  size_t count = zlist_size(item->outbox);
+  while (count--) {
+    msg = s_pop(self, item);
+    zmsg_first(msg);
+    if (!zframe_streq(zmsg_next(msg), item->message_id))
+      s_enqueue(self, item, msg);
+    else
+      zmsg_destroy(&msg);
+  }
+  s_update_throttling(self, item);
+}
+
+int tasks_poll_items(task_table *self, zmq_pollitem_t *items, process_item **owners, int max)
+{
+  assert(self);
+
+  int count = 0;
+  process_item *item = zlist_first(self->items);
+  while (item != NULL && count < max) {
+    if (item->output_fd != -1 && !item->throttled && item->kind != TASK_KIND_TRANSFER) {
+      items[count].socket = NULL;
+      items[count].fd = item->output_fd;
+      items[count].events = ZMQ_POLLIN;
+      items[count].revents = 0;
+      owners[count] = item;
+      count++;
+    }
+    if (item->input_fd != -1 && zlist_size(item->inbox) > 0 && count < max) {
+      items[count].socket = NULL;
+      items[count].fd = item->input_fd;
+      items[count].events = ZMQ_POLLOUT;
+      items[count].revents = 0;
+      owners[count] = item;
+      count++;
+    }
+    item = zlist_next(self->items);
+  }
+  return count;
+}
+
+static zmsg_t *s_chunk_msg(const char *device_id, const char *msgid,
+    uint64_t offset, uint8_t *data, size_t len)
+{
+  uint8_t header[8];
+  utils_put64(header, offset);
+
+  zmsg_t *msg = zmsg_new();
+  zmsg_push(msg, zframe_new(data, len));
+  zmsg_push(msg, zframe_new(header, sizeof(header)));
+  zmsg_pushstr(msg, "%s", MSG_ANSWER_STR_CHUNK);
+  zmsg_pushstr(msg, "%s", msgid);
+  zmsg_pushstr(msg, "%s", device_id);
+  return msg;
+}
+
+/*  Byte N of the output lives at ring[N % ring_size] */
+static void s_ring_append(process_item *item, const uint8_t *data, size_t len)
+{
+  uint64_t offset = item->offset;
+
+  /*  Only the tail of a write larger than the ring survives */
+  if (len > item->ring_size) {
+    offset += len - item->ring_size;
+    data += len - item->ring_size;
+    len = item->ring_size;
+  }
+
+  while (len > 0) {
+    size_t pos = offset % item->ring_size;
+    size_t size = item->ring_size - pos < len ? item->ring_size - pos : len;
+    memcpy(item->ring + pos, data, size);
+    offset += size;
+    data += size;
+    len -= size;
+  }
+}
+
+static void s_capture_append(process_item *item, const uint8_t *data, size_t len)
+{
+  if (item->capture_overflow || item->capture_len + len > item->capture_max) {
+    item->capture_overflow = true;
+    return;
+  }
+
+  item->capture = realloc(item->capture, item->capture_len + len);
+  assert(item->capture);
+  memcpy(item->capture + item->capture_len, data, len);
+  item->capture_len += len;
+}
+
+/*  Keep a copy of up to max bytes of the task output */
+void tasks_capture(task_table *self, process_item *item, size_t max)
+{
+  assert(self);
+  assert(item);
+
+  item->capture = malloc(1);
+  assert(item->capture);
+  item->capture_len = 0;
+  item->capture_max = max;
+}
+
+/*  A task with no process, answering with a known output */
+process_item *tasks_replay(task_table *self, const char *msgid, const char *command,
+    const uint8_t *output, size_t len, const char *device_id)
+{
+  assert(self);
+
+  process_item *item = tasks_add(self, TASK_KIND_EXEC, 0, -1, msgid, command);
+  size_t offset = 0;
+
+  if (item == NULL)
+    return NULL;
+
+  while (offset < len) {
+    size_t size = len - offset < LONG_BUFFER_LEN ? len - offset : LONG_BUFFER_LEN;
+    s_enqueue(self, item, utils_gen_msg(device_id, msgid, MSG_ANSWER_STR_CMDOUTPUT,
+          (char*)output + offset, size));
+    offset += size;
+  }
+  item->offset = len;
+  return item;
+}
+
+/*  Room for another ring of that size, all of them staying under TASK_RING_TOTAL */
+bool tasks_ring_fits(task_table *self, size_t size)
+{
+  assert(self);
+
+  if (size > TASK_RING_MAX)
+    size = TASK_RING_MAX;
+  return self->ring_bytes + size <= TASK_RING_TOTAL;
+}
+
+void tasks_set_ring(task_table *self, process_item *item, size_t size)
+{
+  assert(self);
+  assert(item);
+
+  if (size > TASK_RING_MAX)
+    size = TASK_RING_MAX;
+  item->ring = malloc(size);
+  assert(item->ring);
+  item->ring_size = size;
+  self->ring_bytes += size;
+}
+
+/*  Send what the ring still holds from offset on, as offset-tagged chunks,
+ *  then the final status of the TAIL, queued behind them */
+/*  Queues the output held by the ring from offset on, then the final status
+ *  of the TAIL, which is also returned in status. Refused while the output
+ *  queued goes over the global budget: a ring at most is added to it. */
+int tasks_tail(task_table *self, const char *msgid, uint64_t offset, const char *tail_msgid,
+    const char *device_id, int *status)
+{
+  assert(self);
+  assert(msgid);
+  assert(tail_msgid);
+  assert(status);
+
+  process_item *item = tasks_lookup(self, msgid);
+  if (item == NULL || item->ring == NULL || self->outbox_bytes >= self->global_budget)
+    return STATUS_ERROR;
+
+  uint64_t oldest = item->offset > item->ring_size ? item->offset - item->ring_size : 0;
+  if (offset < oldest)
+    offset = oldest;
+
+  while (offset < item->offset) {
+    size_t pos = offset % item->ring_size;
+    uint64_t len = item->offset - offset;
+    if (len > item->ring_size - pos)
+      len = item->ring_size - pos;
+    if (len > IOENGINE_CHUNK_SIZE)
+      len = IOENGINE_CHUNK_SIZE;
+    s_enqueue(self, item, s_chunk_msg(device_id, item->message_id, offset, item->ring + pos, len));
+    offset += len;
+  }
+  s_enqueue(self, item, utils_gen_msg(device_id, tail_msgid, MSG_ANSWER_STR_COMPLETED, NULL, 0));
+  *status = MSG_ANSWER_COMPLETED;
+  s_update_throttling(self, item);
+  return STATUS_OK;
+}
+
+int tasks_follow(task_table *self, const char *msgid, bool follow)
+{
+  assert(self);
+  assert(msgid);
+
+  process_item *item = tasks_lookup(self, msgid);
+  if (item == NULL || item->ring == NULL)
+    return STATUS_ERROR;
+
+  item->following = follow;
+  return STATUS_OK;
+}
+
+/*  Chunks to read ahead, as many as the task budget allows */
+static int s_read_ahead(task_table *self, process_item *item)
+{
+  size_t room = self->task_budget > item->outbox_bytes ? self->task_budget - item->outbox_bytes : 0;
+  size_t count = 1 + room / IOENGINE_CHUNK_SIZE;
+
+  return count > IOENGINE_QUEUE_DEPTH ? IOENGINE_QUEUE_DEPTH : count;
+}
+
+/*  PULL'ed files and archives are read by the file I/O stage, one batch in
+ *  flight per task, so that a slow flash never stalls the worker */
+void tasks_read_files(task_table *self, void *pipe)
+{
+  assert(self);
+  assert(pipe);
+
+  uint8_t command = MSG_COMMAND_PULL;
+  process_item *item = zlist_first(self->items);
+  while (item != NULL) {
+    if ((item->kind == TASK_KIND_TRANSFER || item->kind == TASK_KIND_ARCHIVE)
+        && (item->output_fd != -1 || item->archive != NULL) && !item->reading && !item->throttled) {
+      fileio_read read = { item->archive != NULL ? -1 : item->output_fd, item->archive,
+        item->offset, s_read_ahead(self, item) };
+      zmsg_t *job = zmsg_new();
+      zmsg_addstr(job, "%s", item->message_id);
+      zmsg_addmem(job, &command, sizeof(command));
+      zmsg_addmem(job, &read, sizeof(read));
+      zmsg_send(&job, pipe);
+      item->reading = true;
+    }
+    item = zlist_next(self->items);
+  }
+}
+
+/*  Chunks read by the file I/O stage, the status telling whether more is left */
+void tasks_read_result(task_table *self, const char *msgid, int status, zmsg_t *chunks,
+    const char *device_id)
+{
+  assert(self);
+  assert(msgid);
+  assert(chunks);
+
+  process_item *item = tasks_lookup(self, msgid);
+  zframe_t *frame = NULL;
+  if (item == NULL || !item->reading)
+    return;
+
+  item->reading = false;
+  while ((frame = zmsg_pop(chunks)) != NULL) {
+    if (!item->failed) {
+      s_enqueue(self, item, s_chunk_msg(device_id, item->message_id,
+            item->offset, zframe_data(frame), zframe_size(frame)));
+      item->offset += zframe_size(frame);
+    }
+    zframe_destroy(&frame);
+  }
+
+  /*  A task killed meanwhile is closed now */
+  if (status == MSG_ANSWER_EXECERROR)
+    item->failed = true;
+  if (status != MSG_ANSWER_CHUNK || item->failed)
+    s_close_source(item);
+  s_update_throttling(self, item);
+}
+
+void tasks_read_output(task_table *self, process_item *item, const char *device_id)
+{
+  assert(self);
+  assert(item);
+
+
+  char buffer[LONG_BUFFER_LEN];
+  ssize_t len = read(item->output_fd, buffer, LONG_BUFFER_LEN);
+
+  if (len > 0 && item->ring != NULL) {
+    s_ring_append(item, (uint8_t*)buffer, len);
+    if (item->following)
+      s_enqueue(self, item, s_chunk_msg(device_id, item->message_id,
+            item->offset, (uint8_t*)buffer, len));
+    item->offset += len;
+    s_update_throttling(self, item);
+  } else if (len > 0) {
+    if (item->capture != NULL)
+      s_capture_append(item, (uint8_t*)buffer, len);
+    zmsg_t *msg = utils_gen_msg(device_id, item->message_id,
+        MSG_ANSWER_STR_CMDOUTPUT, buffer, len);
+    s_enqueue(self, item, msg);
+    item->offset += len;
+    s_update_throttling(self, item);
+  } else if (len == 0 || (errno != EAGAIN && errno != EINTR)) {
+    close(item->output_fd);
+    item->output_fd = -1;
+  }
+}
+
+static void s_grant_credit(task_table *self, process_item *item, const char *device_id, size_t credit)
+{
+  uint8_t bytes[4];
+  utils_put32(bytes, (uint32_t)credit);
+  s_enqueue(self, item, utils_gen_msg(device_id, item->message_id,
+        MSG_ANSWER_STR_CREDIT, (char*)bytes, sizeof(bytes)));
+}
+
+/*  Connect the task stdin, and grant the server its first window */
+void tasks_open_input(task_table *self, process_item *item, int input_fd, const char *device_id)
+{
+  assert(self);
+  assert(item);
+
+  item->input_fd = input_fd;
+  s_grant_credit(self, item, device_id, TASK_INPUT_WINDOW);
+}
+
+/*  STDIN data for a task, an empty frame closes its stdin */
+int tasks_queue_input(task_table *self, const char *msgid, zframe_t *data)
+{
+  assert(self);
+  assert(msgid);
+  assert(data);
+
+  process_item *item = tasks_lookup(self, msgid);
+  if (item == NULL || item->input_fd == -1 || item->input_eof)
+    return STATUS_ERROR;
+
+  /*  The server went over its credit */
+  if (item->inbox_bytes + zframe_size(data) > TASK_INPUT_WINDOW)
+    return STATUS_ERROR;
+
+  if (zframe_size(data) == 0) {
+    item->input_eof = true;
+    if (zlist_size(item->inbox) == 0)
+      s_close_input(item);
+    return STATUS_OK;
+  }
+
+  zlist_append(item->inbox, zframe_dup(data));
+  item->inbox_bytes += zframe_size(data);
+  return STATUS_OK;
+}
+
+/*  Write the inbox while the pipe has room, credit the server back as it drains */
+void tasks_write_input(task_table *self, process_item *item, const char *device_id)
+{
+  assert(self);
+  assert(item);
+
+  zframe_t *frame = NULL;
+  while (item->input_fd != -1 && (frame = zlist_first(item->inbox)) != NULL) {
+    ssize_t len = write(item->input_fd, zframe_data(frame) + item->inbox_pos,
+        zframe_size(frame) - item->inbox_pos);
+    if (len < 0) {
+      if (errno == EAGAIN || errno == EINTR)
+        break;
+      /*  The task closed its stdin, drop what is left */
+      debugLog("Task %d stdin closed: %s", item->pid, strerror(errno));
+      s_close_input(item);
+      return;
+    }
+
+    item->inbox_pos += len;
+    item->inbox_bytes -= len;
+    item->input_credit += len;
+    if (item->inbox_pos == zframe_size(frame)) {
+      zlist_pop(item->inbox);
+      zframe_destroy(&frame);
+      item->inbox_pos = 0;
+    }
+  }
+
+  /*  Grant in large steps rather than once per write */
+  if (item->input_credit >= TASK_INPUT_WINDOW / 2
+      || (item->input_credit > 0 && zlist_size(item->inbox) == 0)) {
+    if (!item->input_eof)
+      s_grant_credit(self, item, device_id, item->input_credit);
+    item->input_credit = 0;
+  }
+
+  if (item->input_eof && zlist_size(item->inbox) == 0)
+    s_close_input(item);
+}
+
+/*  Exit statuses of the children of the spawn helper */
+static void s_collect_spawned(task_table *self)
+{
+  struct rusage usage;
+  pid_t pid;
+  int status;
+
+  while (self->spawner != NULL && spawner_reap(self->spawner, &pid, &status, &usage)) {
+    process_item *item = zlist_first(self->items);
+    while (item != NULL && (item->exited || item->pid != pid))
+      item = zlist_next(self->items);
+    if (item != NULL) {
+      item->status = status;
+      item->usage = usage;
+      item->exited = true;
+      item->exited_at = zclock_time();
+    }
+  }
+}
+
+static uint32_t s_ms(struct timeval *tv)
+{
+  return (uint32_t)(tv->tv_sec * 1000 + tv->tv_usec / 1000);
+}
+
+/*  What the process of a task cost, see TASK_ACCOUNTING_SIZE */
+static void s_accounting(process_item *item, uint8_t *record)
+{
+  memset(record, 0, TASK_ACCOUNTING_SIZE);
+  if (item->status == -1) {
+    record[0] = TASK_ACCT_LOST;
+  } else if (WIFEXITED(item->status)) {
+    record[0] = TASK_ACCT_EXITED;
+    record[1] = WEXITSTATUS(item->status);
+  } else if (WIFSIGNALED(item->status)) {
+    record[0] = TASK_ACCT_SIGNALED;
+    record[2] = WTERMSIG(item->status);
+  }
+  if (item->timed_out)
+    record[0] |= TASK_ACCT_TIMEOUT;
+  utils_put32(record + 4, (uint32_t)(item->exited_at - item->started_at));
+  utils_put32(record + 8, s_ms(&item->usage.ru_utime));
+  utils_put32(record + 12, s_ms(&item->usage.ru_stime));
+  utils_put32(record + 16, (uint32_t)item->usage.ru_maxrss);
+}
+
+void tasks_reap(task_table *self, const char *device_id)
+{
+  assert(self);
+
+  s_collect_spawned(self);
+
+  process_item *item = zlist_first(self->items);
+  while (item != NULL) {
+    /*  The spawn helper's children are not ours to wait for; if it died,
+     *  their statuses are lost with it */
+    if (!item->exited) {
+      pid_t done = wait4(item->pid, &item->status, WNOHANG, &item->usage);
+      if (done > 0 || (done == -1 && errno != ECHILD))
+        item->exited = true;
+      else if (done == -1 && !spawner_running(self->spawner)) {
+        item->status = -1;
+        item->exited = true;
+      }
+      if (item->exited)
+        item->exited_at = zclock_time();
+    }
+
+    if (!item->exited && item->deadline > 0 && !item->timed_out && zclock_time() >= item->deadline) {
+      debugLog("Task %d timed out, killed", item->pid);
+      spawner_kill(item->pid, item->cgroup, SIGKILL);
+      item->timed_out = true;
+    }
+
+    /*  Scheduled tasks end in a batch record instead, see scheduler_collect() */
+    if (item->exited && item->output_fd == -1 && item->archive == NULL && !item->finished
+        && item->kind != TASK_KIND_SCHEDULED) {
+      uint8_t throttled_ms[4], output_bytes[8];
+      utils_put32(throttled_ms, (uint32_t)item->throttled_ms);
+      utils_put64(output_bytes, item->offset);
+      zmsg_t *answer = utils_gen_msg(device_id, item->message_id,
+          item->failed ? MSG_ANSWER_STR_EXECERROR : MSG_ANSWER_STR_COMPLETED,
+          (char*)throttled_ms, sizeof(throttled_ms));
+      zmsg_addmem(answer, output_bytes, sizeof(output_bytes));
+      if (item->accounted) {
+        uint8_t accounting[TASK_ACCOUNTING_SIZE];
+        s_accounting(item, accounting);
+        zmsg_addmem(answer, accounting, sizeof(accounting));
+      }
+      s_enqueue(self, item, answer);
+      item->finished = true;
+      item->finished_at = zclock_time();
+    }
+
+    /*  Ring tasks stay around for a while, to be tailed */
+    if (item->finished && zlist_size(item->outbox) == 0
+        && (item->kind != TASK_KIND_EXEC || item->ring == NULL
+          || zclock_time() - item->finished_at >= TASK_RING_LINGER)) {
+      zlist_remove(self->items, item);
+      self->ring_bytes -= item->ring_size;
+      s_item_destroy(item);
+      item = zlist_first(self->items); // Restart, the cursor is lost
+      continue;
+    }
+    item = zlist_next(self->items);
+  }
+}
+
+/*  Stop a task: its process group gets SIGTERM, a transfer stops being read.
+ *  Its queued output is dropped, its final status follows. */
+int tasks_kill(task_table *self, const char *msgid)
+{
+  assert(self);
+  assert(msgid);
+
+  process_item *item = tasks_lookup(self, msgid);
+  if (item == NULL || item->finished)
+    return STATUS_ERROR;
+
+  if (!item->exited && item->pid > 0) {
+    if (spawner_kill(item->pid, item->cgroup, SIGTERM) != STATUS_OK)
+      return STATUS_ERROR;
+  } else {
+    if (!item->reading)
+      s_close_source(item);
+    item->failed = true;
+  }
+
+  debugLog("Killed task %s", msgid);
+  s_drop_output(self, item);
+  return STATUS_OK;
+}
+
+/*  The running tasks, one 'msgid<TAB>kind<TAB>seconds<TAB>output bytes<TAB>command' frame each */
+zmsg_t *tasks_list(task_table *self, const char *device_id, const char *msgid)
+{
+  assert(self);
+  assert(msgid);
+
+  zmsg_t *msg = utils_gen_msg(device_id, msgid, MSG_ANSWER_STR_TASKS, NULL, 0);
+  int64_t now = zclock_time();
+
+  process_item *item = zlist_first(self->items);
+  while (item != NULL) {
+    /*  v2 ids are listed in hex, without their mark */
+    if (!item->finished)
+      zmsg_addstr(msg, "%s\t%d\t%lld\t%llu\t%s",
+          item->message_id + (wire_msgid_is_v2(item->message_id) ? 1 : 0), item->kind,
+          (long long)((now - item->started_at) / 1000), (unsigned long long)item->offset, item->command);
+    item = zlist_next(self->items);
+  }
+  return msg;
+}
+
+/*  Milliseconds before a queued message may be sent, -1 when none is queued */
+int64_t tasks_send_delay(task_table *self)
+{
+  assert(self);
+
+  int64_t now = zclock_time();
+  int64_t delay = -1;
+
+  bucket_refill(&self->bucket, now);
+  process_item *item = zlist_first(self->items);
+  while (item != NULL && delay != 0) {
+    zmsg_t *msg = zlist_first(item->outbox);
+    if (msg != NULL && !s_is_control(msg)) {
+      size_t size = zmsg_content_size(msg);
+      bucket_refill(&item->bucket, now);
+      int64_t wait = bucket_delay(&item->bucket, size);
+      if (bucket_delay(&self->bucket, size) > wait)
+        wait = bucket_delay(&self->bucket, size);
+      if (delay == -1 || wait < delay)
+        delay = wait;
+    }
+    item = zlist_next(self->items);
+  }
+  return delay;
+}
+
+/*  A final status or credit is waiting to be sent */
+bool tasks_control_pending(task_table *self)
+{
+  assert(self);
+
+  process_item *item = zlist_first(self->items);
+  while (item != NULL) {
+    if (s_is_control(zlist_first(item->outbox)))
+      return true;
+    item = zlist_next(self->items);
+  }
+  return false;
+}
+
+/*  Whether an answer to that message is still waiting in an outbox */
+bool tasks_answer_queued(task_table *self, const char *msgid)
+{
+  assert(self);
+  assert(msgid);
+
+  process_item *item = zlist_first(self->items);
+  while (item != NULL) {
+    zmsg_t *msg = zlist_first(item->outbox);
+    while (msg != NULL) {
+      zmsg_first(msg);
+      zframe_t *frame = zmsg_next(msg);
+      if (frame != NULL && zframe_streq(frame, msgid))
+        return true;
+      msg = zlist_next(item->outbox);
+    }
+    item = zlist_next(self->items);
+  }
+  return false;
+}
+
+static void s_send(task_table *self, zmsg_t **msg, void *socket)
+{
+  wire_encode(*msg);
+  if (self->recorder != NULL)
+    capture_record(self->recorder, CAPTURE_OUT, *msg);
+  zmsg_send(msg, socket);
+}
+
+/*  Final statuses and credits first, on the control socket and unshaped. Then
+ *  round-robin over the outboxes, as long as the socket accepts messages and
+ *  the buckets let them through. */
+void tasks_flush(task_table *self, void *socket, void *control)
+{
+  assert(self);
+  assert(socket);
+  assert(control);
+
+  int64_t now = zclock_time();
+  process_item *item = NULL;
+  bool progress = true;
+
+  bucket_refill(&self->bucket, now);
+  item = zlist_first(self->items);
+  while (item != NULL) {
+    bucket_refill(&item->bucket, now);
+    item = zlist_next(self->items);
+  }
+
+  item = zlist_first(self->items);
+  while (item != NULL && (zsocket_events(control) & ZMQ_POLLOUT)) {
+    if (s_is_control(zlist_first(item->outbox))) {
+      zmsg_t *msg = s_pop(self, item);
+      s_send(self, &msg, control);
+    } else {
+      item = zlist_next(self->items);
+    }
+  }
+
+  while (progress && self->outbox_bytes > 0) {
+    progress = false;
+    item = zlist_first(self->items);
+    while (item != NULL) {
+      if (!(zsocket_events(socket) & ZMQ_POLLOUT))
+        goto tasks_flush_end;
+
+      zmsg_t *msg = zlist_first(item->outbox);
+      if (msg != NULL && !s_is_control(msg)
+          && bucket_allows(&item->bucket, zmsg_content_size(msg))
+          && bucket_allows(&self->bucket, zmsg_content_size(msg))) {
+        msg = s_dequeue(self, item);
+        bucket_take(&item->bucket, zmsg_content_size(msg));
+        bucket_take(&self->bucket, zmsg_content_size(msg));
+        s_send(self, &msg, socket);
+        progress = true;
+      }
+      item = zlist_next(self->items);
+    }
+  }
+
+tasks_flush_end:
+  item = zlist_first(self->items);
+  while (item != NULL) {
+    s_update_throttling(self, item);
+    item = zlist_next(self->items);
+  }
+}
@@ -0,0 +1,148 @@
+/**
+ * =====================================================================================
+ *
+ *   @file tasks.h
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  05/12/2013 10:14:02 AM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Task table: running children, their output pipes and outbound budgets
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include <czmq.h>
+#include "ioengine.h"
+#include "capture.h"
+#include "archive.h"
+#include "profile.h"
+#include "shaper.h"
+#include "spawner.h"
+
+#ifndef _SATAN_TASKS_H_
+#define _SATAN_TASKS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define TASK_KIND_EXEC     0x01 // child process, output read from its stdout
+#define TASK_KIND_TRANSFER 0x02 // PULL'ed file, sent as offset-tagged chunks
+#define TASK_KIND_ARCHIVE  0x03 // PULL'ed directory, sent as a chunked tar stream
+#define TASK_KIND_SCHEDULED 0x04 // child process run by the scheduler, output kept in its ring
+
+#define TASK_RING_LINGER   (600*1000)  // ms a finished ring task can still be tailed
+
+/*  Last frame of the MSGCOMPLETED of a task that ran a process, all little-endian:
+ *  flags, exit code, signal, 0, then wall time, user and system CPU time (ms)
+ *  and maximum resident set size (KB), 32 bits each */
+#define TASK_ACCOUNTING_SIZE 20
+#define TASK_ACCT_EXITED     0x01 // the exit code is valid
+#define TASK_ACCT_SIGNALED   0x02 // the signal is valid
+#define TASK_ACCT_TIMEOUT    0x04 // killed when its timeout expired
+#define TASK_ACCT_LOST       0x08 // the status was lost with the spawn helper
+
+typedef struct s_process_item_t {
+  int kind;
+  pid_t pid;
+  uint32_t cgroup;          // id of its cgroup in SPAWN_CGROUP, 0 if none
+  char *message_id;
+  char *command;
+  int64_t started_at;
+  int output_fd;            // read end of the task stdout, -1 once EOF is reached
+  archive_t *archive;       // tar stream of an archive task, NULL once read
+  int input_fd;             // write end of the task stdin, -1 if none or closed
+  zlist_t *inbox;           // STDIN frames waiting for room in the pipe
+  size_t inbox_bytes;
+  size_t inbox_pos;         // bytes of the first frame already written
+  size_t input_credit;      // bytes written, not granted back yet
+  bool input_eof;           // close stdin once the inbox is written
+  bool exited;              // the child has been reaped
+  int status;               // waitpid() status, valid once exited, -1 if lost
+  struct rusage usage;      // and resources used
+  int64_t exited_at;
+  int64_t deadline;         // killed past it, 0 for no timeout
+  bool timed_out;
+  bool finished;            // MSGCOMPLETED has been queued
+  int64_t finished_at;
+  bool failed;              // reading failed, MSGEXECERROR is sent instead
+  bool accounted;           // ran a process, or shares the run of one: its MSGCOMPLETED carries the accounting
+  uint64_t offset;          // bytes read so far
+  uint8_t *ring;            // last ring_size bytes of output, kept instead of being sent
+  size_t ring_size;
+  bool following;           // ring task output is streamed as it comes as well
+  uint8_t *capture;         // copy of the output, for the results cache
+  size_t capture_len;
+  size_t capture_max;
+  bool capture_overflow;    // more output than capture_max, the copy is incomplete
+  zlist_t *outbox;          // answers waiting for room on the answer socket
+  size_t outbox_bytes;
+  bool reading;             // a PULL read of the source is in the file I/O stage
+  bool throttled;           // output_fd is not read while set
+  int64_t throttled_since;
+  int64_t throttled_ms;     // total time spent throttled
+  token_bucket bucket;      // output shaping
+} process_item;
+
+typedef struct s_task_table_t {
+  zlist_t *items;
+  size_t outbox_bytes;      // queued bytes, all tasks included
+  size_t outbox_messages;
+  size_t task_budget;       // per-task outbox watermark
+  size_t global_budget;     // global outbox watermark
+  size_t reserved;          // slots promised to EXECs waiting for a cached result
+  size_t ring_bytes;        // held by the output rings, lingering tasks included
+  token_bucket bucket;      // output shaping, all tasks included
+  int64_t task_rate;        // default shaping of a task
+  int64_t task_burst;
+  capture_t *recorder;      // records the messages sent, may be NULL
+  spawner_t *spawner;       // starts the child processes, may be NULL
+} task_table;
+
+task_table *tasks_new(size_t task_budget, size_t global_budget);
+void tasks_destroy(task_table **self);
+
+process_item *tasks_add(task_table *self, int kind, pid_t pid, int output_fd,
+    const char *msgid, const char *command);
+process_item *tasks_lookup(task_table *self, const char *msgid);
+bool tasks_full(task_table *self);
+int tasks_kill(task_table *self, const char *msgid);
+zmsg_t *tasks_list(task_table *self, const char *device_id, const char *msgid);
+void tasks_set_shaping(task_table *self, int64_t rate, int64_t burst, int64_t task_rate, int64_t task_burst);
+void tasks_set_rate(task_table *self, process_item *item, int64_t rate, int64_t burst);
+void tasks_set_timeout(task_table *self, process_item *item, int64_t timeout);
+int64_t tasks_send_delay(task_table *self);
+
+int tasks_poll_items(task_table *self, zmq_pollitem_t *items, process_item **owners, int max);
+void tasks_read_output(task_table *self, process_item *item, const char *device_id);
+void tasks_open_input(task_table *self, process_item *item, int input_fd, const char *device_id);
+bool tasks_ring_fits(task_table *self, size_t size);
+void tasks_set_ring(task_table *self, process_item *item, size_t size);
+void tasks_capture(task_table *self, process_item *item, size_t max);
+process_item *tasks_replay(task_table *self, const char *msgid, const char *command,
+    const uint8_t *output, size_t len, const char *device_id);
+int tasks_tail(task_table *self, const char *msgid, uint64_t offset, const char *tail_msgid,
+    const char *device_id, int *status);
+int tasks_follow(task_table *self, const char *msgid, bool follow);
+int tasks_queue_input(task_table *self, const char *msgid, zframe_t *data);
+void tasks_write_input(task_table *self, process_item *item, const char *device_id);
+void tasks_read_files(task_table *self, void *pipe);
+void tasks_read_result(task_table *self, const char *msgid, int status, zmsg_t *chunks,
+    const char *device_id);
+void tasks_reap(task_table *self, const char *device_id);
+bool tasks_control_pending(task_table *self);
+bool tasks_answer_queued(task_table *self, const char *msgid);
+void tasks_flush(task_table *self, void *socket, void *control);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _SATAN_TASKS_H_
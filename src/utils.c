@@ -27,11 +27,11 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <signal.h>
 #include <czmq.h>
 #include <stdarg.h>
 #include <unistd.h>
-
-#define LONG_BUFFER_LEN 2000
+#include <fcntl.h>
 
 zmsg_t *utils_gen_msg(const char *device_id, const char *msgid, const char *msg, char *bytes, int len)
 {
@@ -46,97 +46,110 @@ zmsg_t *utils_gen_msg(const char *device_id, const char *msgid, const char *msg,
   return answer;
 }
 
-void s_monitored_execution(void *socket, const char *device_id, const char *msgid, const char *cmd)
+/*  Split a command line on blanks, in place, into a NULL-terminated argv.
+ *  No quoting: commands that need it go through the shell. */
+int utils_split_args(char *line, char **argv, int max)
 {
-  assert(socket);
-  assert(device_id);
-  assert(msgid);
-
-  char answer[LONG_BUFFER_LEN];
-  memset(answer,0,LONG_BUFFER_LEN);
-  unsigned int answer_len = 0;
-
-  char buffer[MAX_STRING_LEN];
-  memset(buffer,0,MAX_STRING_LEN);
-  unsigned int buffer_len = 0;
-
-  /*  Execute the command and circularly read the output, sending the buffer upstream */
-  FILE *stream = popen(cmd, "r");
-  while ( fgets(buffer, MAX_STRING_LEN, stream) != NULL ) {
-    buffer_len = strlen(buffer);
-    if (answer_len + buffer_len >= LONG_BUFFER_LEN) {
-      zmsg_t *msg = utils_gen_msg(device_id, msgid,
-          MSG_ANSWER_STR_CMDOUTPUT, answer, answer_len);
-      zmsg_send(&msg, socket);
-
-      /*  Reset the buffer */
-      memset(answer,0,LONG_BUFFER_LEN);
-      answer_len = 0;
-    }
-    strncat(answer, buffer, MAX_STRING_LEN);
-    answer_len += buffer_len;
-  }
-  if (answer_len != 0) {
-    zmsg_t *msg = utils_gen_msg(device_id, msgid,
-        MSG_ANSWER_STR_CMDOUTPUT, answer, answer_len);
-    zmsg_send(&msg, socket);
+  assert(line);
+  assert(argv);
+
+  char *saveptr = NULL;
+  char *arg = strtok_r(line, " \t\n", &saveptr);
+  int count = 0;
+
+  while (arg != NULL) {
+    if (count == max)
+      return -1;
+    argv[count++] = arg;
+    arg = strtok_r(NULL, " \t\n", &saveptr);
   }
-  pclose(stream);
+  argv[count] = NULL;
+  return count;
 }
 
-pid_t utils_execute_task(const char *cmd,  const char *device_id,
-    const char *msgid, const char *push_endpoint)
+/*  Stdin is only connected to a pipe when input_fd is given */
+pid_t utils_execute_task(const char *cmd, bool shell, const spawn_limits *limits, int *output_fd, int *input_fd)
 {
   assert(cmd);
-  assert(msgid);
-  assert(device_id);
-  assert(push_endpoint);
+  assert(output_fd);
+
+  /*  Split before forking, we are not alone in this process */
+  char *argv[SPAWN_ARGS_MAX + 1];
+  char *line = strdup(cmd);
+  assert(line);
+  if (!shell && utils_split_args(line, argv, SPAWN_ARGS_MAX) <= 0) {
+    free(line);
+    return -1;
+  }
+
+  int fds[2], in_fds[2] = { -1, -1 };
+  if (pipe2(fds, O_CLOEXEC) != 0) {
+    free(line);
+    return -1;
+  }
+  if (input_fd != NULL && pipe2(in_fds, O_CLOEXEC) != 0) {
+    close(fds[0]);
+    close(fds[1]);
+    free(line);
+    return -1;
+  }
 
   pid_t process_id = fork();
+  if (process_id == -1) {
+    close(fds[0]);
+    close(fds[1]);
+    if (input_fd != NULL) {
+      close(in_fds[0]);
+      close(in_fds[1]);
+    }
+    free(line);
+    return -1;
+  }
+
   if (!process_id) {
-    zctx_t *zmq_ctx = zctx_new ();
-    void *socket = zeromq_create_socket(zmq_ctx, push_endpoint, ZMQ_PUSH, NULL, true, -1, -1);
-    s_monitored_execution(socket, device_id, msgid, cmd);
-    sleep(1); // Give some time to send the latest messages
-    zsocket_destroy (zmq_ctx, socket);
-    zctx_destroy (&zmq_ctx);
-    exit(0);
+    /*  The worker reads our stdout through the pipe, and feeds our stdin */
+    dup2(fds[1], STDOUT_FILENO);
+    if (input_fd != NULL)
+      dup2(in_fds[0], STDIN_FILENO);
+    signal(SIGPIPE, SIG_DFL);
+    setpgid(0, 0); // A process group of its own, for KILL
+    spawner_apply_limits(limits);
+    if (shell)
+      execl("/bin/sh", "sh", "-c", cmd, (char*)NULL);
+    else
+      execvp(argv[0], argv);
+    _exit(127);
+  }
+
+  free(line);
+  close(fds[1]);
+  fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+  *output_fd = fds[0];
+
+  if (input_fd != NULL) {
+    close(in_fds[0]);
+    fcntl(in_fds[1], F_SETFL, fcntl(in_fds[1], F_GETFL) | O_NONBLOCK);
+    *input_fd = in_fds[1];
   }
 
   return process_id;
 }
 
-int utils_write_file(const char *file_name, const char *data, int len)
+/*  Little-endian encoding for binary answer frames */
+void utils_put16(uint8_t *dest, uint16_t value)
 {
-	int written = 0;
-
-	int file = open(file_name, O_WRONLY | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR | S_IRGRP);
-	if (file < 0) {
-		return STATUS_ERROR;
-	}
-
-	written = write(file,data,len);
-	close(file);
-
-	if (written != len) {
-		unlink(file_name);
-		return STATUS_ERROR;
-	}
-
-	return STATUS_OK;
+  dest[0] = value & 0xff;
+  dest[1] = (value >> 8) & 0xff;
 }
 
-process_item *utils_msg2processitem(zmsg_t *message)
+void utils_put32(uint8_t *dest, uint32_t value)
 {
-  process_item *item = malloc(sizeof(process_item));
-
-  char *msgid = zmsg_popstr(message);
-  char *command = zmsg_popstr(message);
-  zframe_t *frame = zmsg_pop(message);
-  pid_t *pid = (pid_t*)frame;
-  memcpy(&item->pid,pid,sizeof(pid_t));
-  item->message_id = msgid;
-  item->command = command;
+  utils_put16(dest, value & 0xffff);
+  utils_put16(dest + 2, (value >> 16) & 0xffff);
+}
 
-  return item;
+void utils_put64(uint8_t *dest, uint64_t value)
+{
+  utils_put32(dest, value & 0xffffffff);
+  utils_put32(dest + 4, (value >> 32) & 0xffffffff);
 }
@@ -18,6 +18,7 @@
  * =====================================================================================
  */
 
+#include "spawner.h"
 
 #ifndef _SATAN_UTILS_H_
 #define _SATAN_UTILS_H_
@@ -26,12 +27,14 @@
 extern "C" {
 #endif
 
-pid_t utils_execute_task(const char *cmd,  const char *device_id,
-    const char *msgid, const char *push_endpoint);
+zmsg_t *utils_gen_msg(const char *device_id, const char *msgid, const char *msg, char *bytes, int len);
 
-int utils_write_file(const char *file_name, const char *data, int len);
+int utils_split_args(char *line, char **argv, int max);
+pid_t utils_execute_task(const char *cmd, bool shell, const spawn_limits *limits, int *output_fd, int *input_fd);
 
-process_item *utils_msg2processitem(zmsg_t *message);
+void utils_put16(uint8_t *dest, uint16_t value);
+void utils_put32(uint8_t *dest, uint32_t value);
+void utils_put64(uint8_t *dest, uint64_t value);
 
 #ifdef __cplusplus
 }
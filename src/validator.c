@@ -0,0 +1,333 @@
+/**
+ * =====================================================================================
+ *
+ *   @file validator.c
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  06/07/2013 11:15:37 AM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Message validation threads.
+ *
+ *       Parsing and checksumming incoming messages is the CPU bound part of
+ *       command processing, PUSH payloads above all, so it is spread over a
+ *       few threads. Each message goes to the shard picked by the hash of its
+ *       message id, or of the task it addresses for STDIN, TAIL and FOLLOW, so
+ *       that the messages of one task keep their order; SCHEDULE and
+ *       UNSCHEDULE go by the name of their entry likewise. Shards are fed and
+ *       drained through lock-free single producer, single consumer queues,
+ *       with eventfds to wake the other side up.
+ *
+ *       Control commands (KILL, TASKS) have queues of their own in every
+ *       shard, which are always served first, on both sides: a KILL does not
+ *       wait behind PUSH payloads being checksummed, nor behind commands the
+ *       worker is not ready to take. A KILL still queues behind the normal
+ *       messages of its shard while one of them may be the task it targets,
+ *       as told by a count of those in flight per slot of their key.
+ *
+ *       Only the parsing runs here. The validated messages are handed back to
+ *       the worker, which alone owns the task table and the answer socket, in
+ *       the order each shard produced them.
+ *
+ *       There must be a single submitter: the main thread with a SUB command
+ *       socket, the worker itself with a DEALER one.
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include "main.h"
+#include "messages.h"
+#include "superfasthash.h"
+#include "validator.h"
+#include "wire.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+static void s_notify(int fd)
+{
+  uint64_t one = 1;
+  while (write(fd, &one, sizeof(one)) == -1 && errno == EINTR)
+    ;
+}
+
+/*  Command of a message, in either wire format; 0 if there is none */
+static uint8_t s_command(zmsg_t *message)
+{
+  zmsg_first(message); // uuid
+  zframe_t *frame = zmsg_next(message);
+
+  if (wire_header_valid(frame))
+    return zframe_data(frame)[WIRE_OPCODE];
+
+  frame = zmsg_next(message);
+  if (frame == NULL || zframe_size(frame) >= MAX_STRING_LEN)
+    return 0;
+
+  char command[MAX_STRING_LEN];
+  memcpy(command, zframe_data(frame), zframe_size(frame));
+  command[zframe_size(frame)] = 0;
+  return wire_command(command);
+}
+
+static bool s_is_urgent(zmsg_t *message)
+{
+  uint8_t command = s_command(message);
+  return command == MSG_COMMAND_KILL || command == MSG_COMMAND_TASKS;
+}
+
+/*  Hash of the message id, of the target task for task-bound commands, or of
+ *  the entry name for the scheduler ones */
+static uint32_t s_shard_key(zmsg_t *message)
+{
+  uint8_t command = s_command(message);
+
+  zmsg_first(message); // uuid
+  zframe_t *frame = zmsg_next(message);
+  if (frame == NULL)
+    return 0;
+
+  const uint8_t *key = zframe_data(frame);
+  size_t size = zframe_size(frame);
+  bool v2 = wire_header_valid(frame);
+  if (v2) {
+    key += WIRE_MSGID;
+    size = WIRE_MSGID_SIZE;
+  } else {
+    zmsg_next(message); // command
+  }
+
+  zframe_t *target = zmsg_next(message);
+  if (target != NULL && (command == MSG_COMMAND_STDIN || command == MSG_COMMAND_TAIL
+        || command == MSG_COMMAND_FOLLOW || command == MSG_COMMAND_KILL
+        || command == MSG_COMMAND_SCHEDULE || command == MSG_COMMAND_UNSCHEDULE)) {
+    key = zframe_data(target);
+    size = zframe_size(target);
+  }
+
+  return SuperFastHash((uint8_t*)key, size, 0);
+}
+
+/*  Slot of the in-flight count of a message, among those of its shard */
+static int s_slot(validator_pool *pool, uint32_t key)
+{
+  return key / pool->count % VALIDATOR_KEY_SLOTS;
+}
+
+static void *s_shard_loop(void *args)
+{
+  validator_shard *shard = args;
+  validator_pool *pool = shard->pool;
+  uint64_t count;
+
+  while (!pool->stopping) {
+    if (read(shard->wakeup_fd, &count, sizeof(count)) == -1 && errno != EINTR)
+      break;
+
+    /*  One message at a time, control commands first, each to the output
+     *  matching its input */
+    zmsg_t *message = NULL;
+    bool urgent = false;
+    while ((urgent = (message = spsc_pop(shard->urgent_input)) != NULL)
+        || (message = spsc_pop(shard->input)) != NULL) {
+      spsc_t *output = urgent ? shard->urgent_output : shard->output;
+      validated_t *result = calloc(1, sizeof(validated_t));
+      assert(result);
+
+      result->message = message;
+      result->status = pool->parse(message, &result->msgid, &result->command, &result->arguments);
+
+      /*  Bounded by the commands in flight, the worker drains it shortly */
+      while (!spsc_push(output, result))
+        usleep(1000);
+      s_notify(pool->ready_fd);
+    }
+  }
+
+  return NULL;
+}
+
+validator_pool *validator_new(int count, size_t depth, validator_parse_fn *parse)
+{
+  sigset_t all, previous;
+  int i;
+
+  assert(parse);
+
+  if (count < 1)
+    count = 1;
+  if (count > VALIDATOR_MAX)
+    count = VALIDATOR_MAX;
+
+  validator_pool *self = calloc(1, sizeof(validator_pool));
+  assert(self);
+
+  self->count = count;
+  self->parse = parse;
+  self->ready_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  assert(self->ready_fd != -1);
+
+  /*  Signals are for the main thread */
+  sigfillset(&all);
+  pthread_sigmask(SIG_BLOCK, &all, &previous);
+
+  for (i = 0; i < count; i++) {
+    validator_shard *shard = &self->shards[i];
+    shard->pool = self;
+    shard->input = spsc_new(depth);
+    shard->output = spsc_new(depth);
+    shard->urgent_input = spsc_new(depth);
+    shard->urgent_output = spsc_new(depth);
+    shard->wakeup_fd = eventfd(0, EFD_CLOEXEC);
+    assert(shard->wakeup_fd != -1);
+    if (pthread_create(&shard->thread, NULL, s_shard_loop, shard) != 0) {
+      errorLog("Could not start validation thread: %s", strerror(errno));
+      assert(false);
+    }
+  }
+
+  pthread_sigmask(SIG_SETMASK, &previous, NULL);
+  debugLog("Validating messages on %d threads", count);
+
+  return self;
+}
+
+void validator_destroy(validator_pool **self)
+{
+  int i;
+
+  assert(self);
+
+  if (*self) {
+    (*self)->stopping = 1;
+    for (i = 0; i < (*self)->count; i++)
+      s_notify((*self)->shards[i].wakeup_fd);
+
+    for (i = 0; i < (*self)->count; i++) {
+      validator_shard *shard = &(*self)->shards[i];
+      zmsg_t *message = NULL;
+      validated_t *result = NULL;
+
+      pthread_join(shard->thread, NULL);
+      while ((message = spsc_pop(shard->input)) != NULL
+          || (message = spsc_pop(shard->urgent_input)) != NULL)
+        zmsg_destroy(&message);
+      while ((result = spsc_pop(shard->output)) != NULL
+          || (result = spsc_pop(shard->urgent_output)) != NULL)
+        validated_destroy(&result);
+      spsc_destroy(&shard->input);
+      spsc_destroy(&shard->output);
+      spsc_destroy(&shard->urgent_input);
+      spsc_destroy(&shard->urgent_output);
+      close(shard->wakeup_fd);
+    }
+
+    close((*self)->ready_fd);
+    free(*self);
+    *self = NULL;
+  }
+}
+
+/*  Queue a received message on its shard, false when the shard is full */
+bool validator_submit(validator_pool *self, zmsg_t **message)
+{
+  assert(self);
+  assert(message);
+  assert(*message);
+
+  uint32_t key = s_shard_key(*message);
+  validator_shard *shard = &self->shards[key % self->count];
+  int slot = s_slot(self, key);
+
+  /*  Not ahead of what may be its target */
+  bool urgent = s_is_urgent(*message) && shard->pending[slot] == 0;
+  if (!urgent)
+    __sync_add_and_fetch(&shard->pending[slot], 1);
+  if (!spsc_push(urgent ? shard->urgent_input : shard->input, *message)) {
+    if (!urgent)
+      __sync_sub_and_fetch(&shard->pending[slot], 1);
+    return false;
+  }
+
+  *message = NULL;
+  s_notify(shard->wakeup_fd);
+  return true;
+}
+
+/*  Next validated message, control commands first, taking the shards in turn;
+ *  NULL when none is ready */
+validated_t *validator_next(validator_pool *self, bool urgent_only)
+{
+  validated_t *result = NULL;
+  int i;
+
+  assert(self);
+
+  for (i = 0; i < self->count; i++) {
+    if ((result = spsc_pop(self->shards[i].urgent_output)) != NULL)
+      return result;
+  }
+
+  if (urgent_only)
+    return NULL;
+
+  for (i = 0; i < self->count; i++) {
+    validator_shard *shard = &self->shards[self->next];
+    self->next = (self->next + 1) % self->count;
+
+    if ((result = spsc_pop(shard->output)) != NULL) {
+      __sync_sub_and_fetch(&shard->pending[s_slot(self, s_shard_key(result->message))], 1);
+      return result;
+    }
+  }
+  return NULL;
+}
+
+/*  Results are waiting, control commands only if urgent_only */
+bool validator_pending(validator_pool *self, bool urgent_only)
+{
+  int i;
+
+  assert(self);
+
+  for (i = 0; i < self->count; i++) {
+    if (!spsc_empty(self->shards[i].urgent_output)
+        || (!urgent_only && !spsc_empty(self->shards[i].output)))
+      return true;
+  }
+  return false;
+}
+
+/*  Reset the ready notification, before collecting the results */
+void validator_clear(validator_pool *self)
+{
+  uint64_t count;
+
+  assert(self);
+
+  if (read(self->ready_fd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+    errorLog("Validation notification: %s", strerror(errno));
+}
+
+void validated_destroy(validated_t **self)
+{
+  assert(self);
+
+  if (*self) {
+    zmsg_destroy(&(*self)->message);
+    zmsg_destroy(&(*self)->arguments);
+    free((*self)->msgid);
+    free(*self);
+    *self = NULL;
+  }
+}
@@ -0,0 +1,79 @@
+/**
+ * =====================================================================================
+ *
+ *   @file validator.h
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  06/07/2013 11:02:54 AM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Message validation threads, sharded by message id
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include <czmq.h>
+#include <pthread.h>
+#include "spsc.h"
+#include "profile.h"
+
+#ifndef _SATAN_VALIDATOR_H_
+#define _SATAN_VALIDATOR_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define VALIDATOR_KEY_SLOTS 64    // per shard, counting the normal messages in flight by key
+
+/*  Same contract as the message parser: status, then msgid and arguments when accepted */
+typedef int (validator_parse_fn)(zmsg_t *message, char **msgid, uint8_t *command, zmsg_t **arguments);
+
+typedef struct s_validated_t {
+  zmsg_t *message;          // as received
+  int status;               // MSG_ANSWER_*
+  char *msgid;
+  uint8_t command;
+  zmsg_t *arguments;
+} validated_t;
+
+typedef struct s_validator_shard_t {
+  pthread_t thread;
+  int wakeup_fd;            // eventfd, messages submitted
+  spsc_t *input;            // zmsg_t, from the single submitter
+  spsc_t *output;           // validated_t, to the reactor
+  spsc_t *urgent_input;     // same, for control commands
+  spsc_t *urgent_output;
+  volatile int pending[VALIDATOR_KEY_SLOTS]; // normal messages submitted, not collected yet
+  struct s_validator_pool_t *pool;
+} validator_shard;
+
+typedef struct s_validator_pool_t {
+  int count;
+  validator_shard shards[VALIDATOR_MAX];
+  int ready_fd;             // eventfd, results to collect
+  int next;                 // round robin over the shards when collecting
+  validator_parse_fn *parse;
+  volatile int stopping;
+} validator_pool;
+
+validator_pool *validator_new(int count, size_t depth, validator_parse_fn *parse);
+void validator_destroy(validator_pool **self);
+
+bool validator_submit(validator_pool *self, zmsg_t **message);
+validated_t *validator_next(validator_pool *self, bool urgent_only);
+bool validator_pending(validator_pool *self, bool urgent_only);
+void validator_clear(validator_pool *self);
+void validated_destroy(validated_t **self);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _SATAN_VALIDATOR_H_
@@ -0,0 +1,177 @@
+/**
+ * =====================================================================================
+ *
+ *   @file wire.c
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  06/14/2013 10:02:53 AM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Binary wire format (v2).
+ *
+ *       A v2 message keeps the uuid as its first frame, for the SUB topics,
+ *       and replaces the message id, command (or answer) and checksum frames
+ *       with a single fixed-size header frame:
+ *
+ *         offset  size
+ *         0       1     magic (0xA5)
+ *         1       1     version (2)
+ *         2       1     opcode: MSG_COMMAND_* or MSG_ANSWER_*
+ *         3       1     flags: 0x01 for a CRC32C checksum
+ *         4       16    message id, binary
+ *         20      4     checksum of the uuid, header up to here and arguments
+ *
+ *       The arguments follow as in v1; task ids among them are binary too.
+ *       Commands are told apart from v1 ones by their second frame. Answers
+ *       to a v2 command are sent in v2, with a zero checksum; the answers
+ *       without a message id (heartbeats, batches, local events) stay in v1.
+ *
+ *       Inside the daemon, v2 message ids are kept as strings, so that tasks,
+ *       retransmissions and the like do not tell both versions apart: a mark,
+ *       then the id in hex. Answers are encoded back on their way out.
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include "main.h"
+#include "messages.h"
+#include "wire.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+typedef struct {
+  const char *name;
+  uint8_t opcode;
+} s_opcode_t;
+
+static const s_opcode_t s_commands[] = {
+  { MSG_COMMAND_STR_EXEC, MSG_COMMAND_EXEC },
+  { MSG_COMMAND_STR_PUSH, MSG_COMMAND_PUSH },
+  { MSG_COMMAND_STR_PULL, MSG_COMMAND_PULL },
+  { MSG_COMMAND_STR_STDIN, MSG_COMMAND_STDIN },
+  { MSG_COMMAND_STR_TAIL, MSG_COMMAND_TAIL },
+  { MSG_COMMAND_STR_FOLLOW, MSG_COMMAND_FOLLOW },
+  { MSG_COMMAND_STR_SCHEDULE, MSG_COMMAND_SCHEDULE },
+  { MSG_COMMAND_STR_UNSCHEDULE, MSG_COMMAND_UNSCHEDULE },
+  { MSG_COMMAND_STR_KILL, MSG_COMMAND_KILL },
+  { MSG_COMMAND_STR_TASKS, MSG_COMMAND_TASKS },
+  { MSG_COMMAND_STR_SYNC, MSG_COMMAND_SYNC },
+  { MSG_COMMAND_STR_SYNCAPPLY, MSG_COMMAND_SYNCAPPLY },
+  { NULL, 0 }
+};
+
+static const s_opcode_t s_answers[] = {
+  { MSG_ANSWER_STR_CMDOUTPUT, MSG_ANSWER_CMDOUTPUT }, // most frequent first
+  { MSG_ANSWER_STR_CHUNK, MSG_ANSWER_CHUNK },
+  { MSG_ANSWER_STR_ACCEPTED, MSG_ANSWER_ACCEPTED },
+  { MSG_ANSWER_STR_COMPLETED, MSG_ANSWER_COMPLETED },
+  { MSG_ANSWER_STR_TASK, MSG_ANSWER_TASK },
+  { MSG_ANSWER_STR_CREDIT, MSG_ANSWER_CREDIT },
+  { MSG_ANSWER_STR_EXECERROR, MSG_ANSWER_EXECERROR },
+  { MSG_ANSWER_STR_PARSEERROR, MSG_ANSWER_PARSEERROR },
+  { MSG_ANSWER_STR_BADCRC, MSG_ANSWER_BADCRC },
+  { MSG_ANSWER_STR_UNREADABLE, MSG_ANSWER_UNREADABLE },
+  { MSG_ANSWER_STR_UNDEFERROR, MSG_ANSWER_UNDEFERROR },
+  { MSG_ANSWER_STR_TASKS, MSG_ANSWER_TASKS },
+  { MSG_ANSWER_STR_MANIFEST, MSG_ANSWER_MANIFEST },
+  { NULL, 0 }
+};
+
+static const char s_hex[] = "0123456789abcdef";
+
+static int s_unhex(char c)
+{
+  if (c >= '0' && c <= '9')
+    return c - '0';
+  if (c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  return -1;
+}
+
+/*  A v2 header, with its single bounds check */
+bool wire_header_valid(zframe_t *frame)
+{
+  if (frame == NULL || zframe_size(frame) != WIRE_HEADER_SIZE)
+    return false;
+  return zframe_data(frame)[0] == WIRE_MAGIC && zframe_data(frame)[1] == WIRE_VERSION;
+}
+
+/*  Internal form of a binary message id, to be freed */
+char *wire_msgid(const uint8_t *id)
+{
+  char *msgid = malloc(WIRE_MSGID_LEN + 1);
+  int i;
+
+  assert(msgid);
+  msgid[0] = WIRE_MSGID_MARK;
+  for (i = 0; i < WIRE_MSGID_SIZE; i++) {
+    msgid[1 + 2 * i] = s_hex[id[i] >> 4];
+    msgid[2 + 2 * i] = s_hex[id[i] & 0x0f];
+  }
+  msgid[WIRE_MSGID_LEN] = 0;
+  return msgid;
+}
+
+bool wire_msgid_is_v2(const char *msgid)
+{
+  return msgid != NULL && msgid[0] == WIRE_MSGID_MARK && strlen(msgid) == WIRE_MSGID_LEN;
+}
+
+/*  Opcode of a v1 command, 0 if unknown */
+uint8_t wire_command(const char *command)
+{
+  const s_opcode_t *entry;
+
+  for (entry = s_commands; entry->name != NULL; entry++) {
+    if (str_equals(command, entry->name))
+      return entry->opcode;
+  }
+  return 0;
+}
+
+/*  Answer to a v2 command, built as a v1 one: rewritten in v2 in place */
+void wire_encode(zmsg_t *msg)
+{
+  assert(msg);
+
+  if (zmsg_size(msg) < 3)
+    return;
+
+  zmsg_first(msg);
+  zframe_t *msgid = zmsg_next(msg);
+  zframe_t *answer = zmsg_next(msg);
+  if (zframe_size(msgid) != WIRE_MSGID_LEN || zframe_data(msgid)[0] != WIRE_MSGID_MARK)
+    return;
+
+  const s_opcode_t *entry = s_answers;
+  while (entry->name != NULL && !zframe_streq(answer, entry->name))
+    entry++;
+  if (entry->name == NULL)
+    return;
+
+  uint8_t header[WIRE_HEADER_SIZE];
+  const char *hex = (const char*)zframe_data(msgid) + 1;
+  int i;
+
+  memset(header, 0, sizeof(header));
+  header[0] = WIRE_MAGIC;
+  header[1] = WIRE_VERSION;
+  header[WIRE_OPCODE] = entry->opcode;
+  for (i = 0; i < WIRE_MSGID_SIZE; i++)
+    header[WIRE_MSGID + i] = s_unhex(hex[2 * i]) << 4 | s_unhex(hex[2 * i + 1]);
+
+  zframe_t *uuid = zmsg_pop(msg);
+  zmsg_remove(msg, msgid);
+  zmsg_remove(msg, answer);
+  zframe_destroy(&msgid);
+  zframe_destroy(&answer);
+  zmsg_push(msg, zframe_new(header, sizeof(header)));
+  zmsg_push(msg, uuid);
+}
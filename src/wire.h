@@ -0,0 +1,57 @@
+/**
+ * =====================================================================================
+ *
+ *   @file wire.h
+ *   @author Victor Perron (), victor@iso3103.net
+ *
+ *        Version:  1.0
+ *        Created:  06/14/2013 10:02:53 AM
+ *
+ *   @section DESCRIPTION
+ *
+ *       Binary wire format (v2) headers
+ *
+ *   @section LICENSE
+ *
+ *       LGPLv2.1
+ *
+ * =====================================================================================
+ */
+
+#include <czmq.h>
+
+#ifndef _SATAN_WIRE_H_
+#define _SATAN_WIRE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WIRE_MAGIC        0xA5
+#define WIRE_VERSION      2
+#define WIRE_HEADER_SIZE  24
+
+// Header fields offsets
+#define WIRE_OPCODE       2   // MSG_COMMAND_* or MSG_ANSWER_*
+#define WIRE_FLAGS        3
+#define WIRE_MSGID        4   // 16 bytes, binary
+#define WIRE_CHECKSUM     20  // 32 bits, from the uuid to the last frame
+
+#define WIRE_MSGID_SIZE   16
+#define WIRE_FLAG_CRC32C  0x01
+
+// Message ids of v2 messages, internally: a mark then the id in hex
+#define WIRE_MSGID_MARK   '\x02'
+#define WIRE_MSGID_LEN    (1 + 2 * WIRE_MSGID_SIZE)
+
+bool wire_header_valid(zframe_t *frame);
+char *wire_msgid(const uint8_t *id);
+bool wire_msgid_is_v2(const char *msgid);
+uint8_t wire_command(const char *command);
+void wire_encode(zmsg_t *msg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _SATAN_WIRE_H_
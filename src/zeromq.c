@@ -69,6 +69,10 @@ void *zeromq_create_socket (zctx_t *context, const char *endpoint, int type,
   if (type == ZMQ_SUB)
     zsocket_set_subscribe (socket, (char*)(topic == NULL ? "" : topic));
 
+  // On DEALER sockets, the topic is the routing identity
+  if (type == ZMQ_DEALER && topic != NULL)
+    zsocket_set_identity (socket, (char*)topic);
+
   if (connect) {
     zsocket_connect (socket, "%s", endpoint);
   } else {
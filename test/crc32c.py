@@ -0,0 +1,22 @@
+#! /usr/bin/python
+
+"""
+CRC32C (Castagnoli), chained over message frames like SuperFastHash.
+Python version with no dependencies, slow but enough for tests.
+"""
+
+__table = []
+for i in xrange(256):
+    crc = i
+    for j in xrange(8):
+        crc = (crc >> 1) ^ (0x82f63b78 if crc & 1 else 0)
+    __table.append(crc)
+
+def CRC32C(data, crc):
+    crc ^= 0xffffffff
+    for c in data:
+        crc = __table[(crc ^ ord(c)) & 0xff] ^ (crc >> 8)
+    return crc ^ 0xffffffff
+
+if __name__ == "__main__":
+    assert CRC32C("123456789", 0) == 0xe3069283
@@ -4,9 +4,16 @@ import zmq
 import uuid
 import struct
 import os
+import shutil
+import tarfile
+import StringIO
 import subprocess
+import ctypes
+import ctypes.util
+import sys
 from superfasthash import SuperFastHash
-from time import sleep
+from crc32c import CRC32C
+from time import sleep, time
 import unittest
 
 """
@@ -20,8 +27,10 @@ If you want to run a single test, run:
 """
 
 device_id = "test"
+group_id = "testgroup"
 pub_endpoint = "tcp://localhost:10080"
 pull_endpoint = "tcp://localhost:10081"
+local_endpoint = "ipc:///tmp/satan.sock"
 with open("/dev/urandom") as f:
     binarydata = f.readline()
     for i in xrange(100):
@@ -33,7 +42,7 @@ print "#########################################################################
 print "#"
 print "#   Please run the following process BEFORE tests :"
 print "#"
-print "#   satan -s "+pub_endpoint+" -p "+pull_endpoint+" -u "+device_id
+print "#   satan -s "+pub_endpoint+" -p "+pull_endpoint+" -u "+device_id+" -g "+group_id+" -S /tmp/satan.schedule -l "+local_endpoint+" -H 0"
 print "#"
 print "################################################################################"
 context = zmq.Context()
@@ -54,9 +63,27 @@ def send_msg(socket,msg):
     msg.append(_sum)
     socket.send_multipart(msg)
 
+def send_msg_crc32c(socket,msg):
+    _sum = 0
+    for part in msg:
+        _sum = CRC32C(part, _sum)
+    msg.append(struct.pack('<BI', 1, _sum))
+    socket.send_multipart(msg)
+
 def gen_uuid():
     return uuid.uuid4().hex
 
+def send_msg_v2(socket, opcode, msgid, args, flags=0):
+    header = struct.pack('<BBBB16s', 0xA5, 2, opcode, flags, msgid)
+    _sum = SuperFastHash(device_id, 0)
+    for part in [header] + args:
+        _sum = SuperFastHash(part, _sum)
+    socket.send_multipart([device_id, header + struct.pack('<I', _sum)] + args)
+
+def answer_v2(ans):
+    magic, version, opcode, flags, msgid = struct.unpack('<BBBB16s', ans[1][:20])
+    return opcode, msgid
+
 
 class TestProtocol(unittest.TestCase):
 
@@ -85,6 +112,52 @@ class TestProtocol(unittest.TestCase):
         ans = pull_socket.recv_multipart()
         self.assertEqual(ans[1], msgid)
         self.assertEqual(ans[2], 'MSGCOMPLETED')
+    def test_push_3(self):
+        msgid = gen_uuid()
+        send_msg(pub_socket, [device_id, msgid, "PUSH", binarydata])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGACCEPTED')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGCOMPLETED')
+        # Retransmission: the cached status is replayed, the file is not written twice
+        send_msg(pub_socket, [device_id, msgid, "PUSH", binarydata])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[1], msgid)
+        self.assertEqual(ans[2], 'MSGACCEPTED')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[1], msgid)
+        self.assertEqual(ans[2], 'MSGCOMPLETED')
+    def test_push_4(self):
+        # Large payload, checksummed while written
+        msgid = gen_uuid()
+        payload = binarydata * (300 * 1024 / len(binarydata) + 1)
+        send_msg_crc32c(pub_socket, [device_id, msgid, "PUSH", payload, "/tmp/push_large"])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGACCEPTED')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[1], msgid)
+        self.assertEqual(ans[2], 'MSGCOMPLETED')
+        self.assertEqual(open("/tmp/push_large").read(), payload)
+        os.remove("/tmp/push_large")
+    def test_push_5(self):
+        msgid = gen_uuid()
+        payload = binarydata * (300 * 1024 / len(binarydata) + 1)
+        msg = [device_id, msgid, "PUSH", payload, "/tmp/push_corrupted"]
+        pub_socket.send_multipart(msg + [hash_msg(msg[:3] + ["corrupted"] + msg[4:])])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGACCEPTED')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[1], msgid)
+        self.assertEqual(ans[2], 'MSGBADCRC')
+        self.assertFalse(os.path.exists("/tmp/push_corrupted"))
+        # Not remembered: sent again, it is written
+        send_msg(pub_socket, msg)
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGACCEPTED')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGCOMPLETED')
+        self.assertEqual(open("/tmp/push_corrupted").read(), payload)
+        os.remove("/tmp/push_corrupted")
 
     def test_exec_0(self):
         msgid = gen_uuid()
@@ -104,6 +177,24 @@ class TestProtocol(unittest.TestCase):
         ans = pull_socket.recv_multipart()
         self.assertEqual(ans[1], msgid)
         self.assertEqual(ans[2], 'MSGCOMPLETED')
+    def test_exec_crc32c_0(self):
+        msgid = gen_uuid()
+        send_msg_crc32c(pub_socket, [device_id, msgid, "EXEC", "echo machin"])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[1], msgid)
+        self.assertEqual(ans[2], 'MSGACCEPTED')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGTASK')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[3], 'machin\n')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGCOMPLETED')
+    def test_exec_crc32c_1(self):
+        msgid = gen_uuid()
+        pub_socket.send_multipart([device_id, msgid, "EXEC", "echo machin", struct.pack('<BI', 1, 0)])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[1], msgid)
+        self.assertEqual(ans[2], 'MSGBADCRC')
     def test_exec_2(self):
         msgid = gen_uuid()
         send_msg(pub_socket, [device_id, msgid, "EXEC", "testme", "stupid"])
@@ -126,6 +217,846 @@ class TestProtocol(unittest.TestCase):
         ans = pull_socket.recv_multipart()
         self.assertEqual(ans[1], msgid)
         self.assertEqual(ans[2], 'MSGCOMPLETED')
+    def test_exec_noshell_0(self):
+        msgid = gen_uuid()
+        send_msg(pub_socket, [device_id, msgid, "EXEC", "echo machin  truc", "shell=0"])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGACCEPTED')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGTASK')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGCMDOUTPUT')
+        self.assertEqual(ans[3], 'machin truc\n')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGCOMPLETED')
+    def test_exec_noshell_1(self):
+        msgid = gen_uuid()
+        send_msg(pub_socket, [device_id, msgid, "EXEC", "/nonexistent/command", "shell=0"])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGACCEPTED')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[1], msgid)
+        self.assertEqual(ans[2], 'MSGEXECERROR')
+    def test_exec_accounting_0(self):
+        msgid = gen_uuid()
+        send_msg(pub_socket, [device_id, msgid, "EXEC", "exit 3"])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGACCEPTED')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGTASK')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGCOMPLETED')
+        flags, code, signal, _, wall, user, system, rss = struct.unpack('<BBBBIIII', ans[5])
+        self.assertEqual(flags, 0x01)
+        self.assertEqual(code, 3)
+        self.assertTrue(rss > 0)
+    def test_exec_timeout_0(self):
+        msgid = gen_uuid()
+        send_msg(pub_socket, [device_id, msgid, "EXEC", "sleep 10", "timeout=1", "nice=5"])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGACCEPTED')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGTASK')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGCOMPLETED')
+        flags, code, signal, _, wall, user, system, rss = struct.unpack('<BBBBIIII', ans[5])
+        self.assertEqual(flags, 0x02 | 0x04)
+        self.assertEqual(signal, 9)
+        self.assertTrue(1000 <= wall < 5000)
+
+    def test_v2_exec_0(self):
+        msgid = uuid.uuid4().bytes
+        send_msg_v2(pub_socket, 0x01, msgid, ["echo machin"])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(len(ans[1]), 24)
+        self.assertEqual(answer_v2(ans), (0x01, msgid)) # MSGACCEPTED
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(answer_v2(ans), (0xC0, msgid)) # MSGTASK
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(answer_v2(ans), (0x40, msgid)) # MSGCMDOUTPUT
+        self.assertEqual(ans[2], 'machin\n')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(answer_v2(ans), (0x80, msgid)) # MSGCOMPLETED
+    def test_v2_exec_1(self):
+        msgid = uuid.uuid4().bytes
+        header = struct.pack('<BBBB16sI', 0xA5, 2, 0x01, 0, msgid, 0)
+        pub_socket.send_multipart([device_id, header, "echo machin"])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(answer_v2(ans), (0x02, msgid)) # MSGBADCRC
+    def test_v2_kill_0(self):
+        msgid = uuid.uuid4().bytes
+        send_msg_v2(pub_socket, 0x01, msgid, ["sleep 30"])
+        ans = pull_socket.recv_multipart()
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(answer_v2(ans), (0xC0, msgid))
+        killid = uuid.uuid4().bytes
+        send_msg_v2(pub_socket, 0x09, killid, [msgid])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(answer_v2(ans), (0x01, killid))
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(answer_v2(ans), (0x80, killid))
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(answer_v2(ans)[1], msgid)
+    def test_v2_mark_0(self):
+        # A v1 id looking like the internal form of a v2 one is not taken
+        msgid = "\x02" + uuid.uuid4().hex
+        send_msg(pub_socket, [device_id, msgid, "EXEC", "echo machin"])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[1], '')
+        self.assertEqual(ans[2], 'MSGUNREADABLE')
+
+    def test_rate_0(self):
+        # 20KB at 10KB/s with a 2KB burst: about two seconds, in coalesced outputs
+        msgid = gen_uuid()
+        start = time()
+        send_msg(pub_socket, [device_id, msgid, "EXEC", "head -c 20000 /dev/zero", "rate=10000", "burst=2000"])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGACCEPTED')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGTASK')
+        output = ""
+        while True:
+            ans = pull_socket.recv_multipart()
+            if ans[2] != 'MSGCMDOUTPUT':
+                break
+            output += ans[3]
+        self.assertEqual(ans[2], 'MSGCOMPLETED')
+        self.assertEqual(len(output), 20000)
+        self.assertTrue(time() - start >= 1.5)
+
+    def test_rate_2(self):
+        # 3333 B/s is not a whole number of bytes per ms: 9000 bytes past the burst still take 2.7 seconds
+        msgid = gen_uuid()
+        start = time()
+        send_msg(pub_socket, [device_id, msgid, "EXEC", "head -c 10000 /dev/zero", "rate=3333", "burst=1000"])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGACCEPTED')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGTASK')
+        output = ""
+        while True:
+            ans = pull_socket.recv_multipart()
+            if ans[2] != 'MSGCMDOUTPUT':
+                break
+            output += ans[3]
+        self.assertEqual(ans[2], 'MSGCOMPLETED')
+        self.assertEqual(len(output), 10000)
+        self.assertTrue(2.4 <= time() - start < 6)
+
+    def test_rate_1(self):
+        msgid = gen_uuid()
+        send_msg(pub_socket, [device_id, msgid, "SCHEDULE", "rated", "60", "true", "rate=100"])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[1], msgid)
+        self.assertEqual(ans[2], 'MSGPARSEERROR')
+
+    def test_throttle_0(self):
+        # 2MB shaped to 500KB/s: the task queue fills at once, its pipe is paused most of the 4 seconds
+        msgid = gen_uuid()
+        send_msg(pub_socket, [device_id, msgid, "EXEC", "head -c 2000000 /dev/zero", "rate=500000", "burst=16384"])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGACCEPTED')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGTASK')
+        size = 0
+        while True:
+            ans = pull_socket.recv_multipart()
+            if ans[2] != 'MSGCMDOUTPUT':
+                break
+            size += len(ans[3])
+        self.assertEqual(ans[1], msgid)
+        self.assertEqual(ans[2], 'MSGCOMPLETED')
+        self.assertEqual(size, 2000000)
+        self.assertTrue(struct.unpack('<I', ans[3])[0] >= 2000)
+        self.assertEqual(struct.unpack('<Q', ans[4])[0], 2000000)
+
+    def test_kill_0(self):
+        msgid = gen_uuid()
+        send_msg(pub_socket, [device_id, msgid, "EXEC", "sleep 30"])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGACCEPTED')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGTASK')
+        killid = gen_uuid()
+        start = time()
+        send_msg(pub_socket, [device_id, killid, "KILL", msgid])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[1], killid)
+        self.assertEqual(ans[2], 'MSGACCEPTED')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[1], killid)
+        self.assertEqual(ans[2], 'MSGCOMPLETED')
+        # The task ends on SIGTERM, its final status carries its output size
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[1], msgid)
+        self.assertTrue(ans[2] in ('MSGCOMPLETED', 'MSGEXECERROR'))
+        self.assertEqual(struct.unpack('<Q', ans[4])[0], 0)
+        self.assertTrue(time() - start < 5)
+    def test_kill_1(self):
+        msgid = gen_uuid()
+        send_msg(pub_socket, [device_id, msgid, "KILL", gen_uuid()])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGACCEPTED')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[1], msgid)
+        self.assertEqual(ans[2], 'MSGEXECERROR')
+
+    def test_kill_2(self):
+        # A KILL right behind its EXEC, with a PUSH in the way: it must not overtake it
+        msgid = gen_uuid()
+        send_msg(pub_socket, [device_id, gen_uuid(), "PUSH", binarydata * 64, "/tmp/kill_2"])
+        send_msg(pub_socket, [device_id, msgid, "EXEC", "sleep 30"])
+        killid = gen_uuid()
+        send_msg(pub_socket, [device_id, killid, "KILL", msgid])
+        answers = {}
+        while answers.get(msgid, [''])[-1] not in ('MSGCOMPLETED', 'MSGEXECERROR') or killid not in answers:
+            ans = pull_socket.recv_multipart()
+            answers.setdefault(ans[1], []).append(ans[2])
+        self.assertEqual(answers[killid], ['MSGACCEPTED', 'MSGCOMPLETED'])
+        if os.path.exists("/tmp/kill_2"):
+            os.remove("/tmp/kill_2")
+
+    def test_local_0(self):
+        local_socket = context.socket(zmq.PUSH)
+        local_socket.connect(local_endpoint)
+        local_socket.send_multipart(["hotplug", "usb1 added"])
+        local_socket.send_multipart(["boot"])
+        ans = pull_socket.recv_multipart()
+        local_socket.close()
+        self.assertEqual(ans[0], device_id)
+        self.assertEqual(ans[1], '')
+        self.assertEqual(ans[2], 'MSGLOCAL')
+        self.assertEqual(ans[3:], ["hotplug", "usb1 added", "boot", ""])
+
+    def test_tasks_0(self):
+        taskid = gen_uuid()
+        send_msg(pub_socket, [device_id, taskid, "EXEC", "sleep 2"])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGACCEPTED')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGTASK')
+        msgid = gen_uuid()
+        send_msg(pub_socket, [device_id, msgid, "TASKS"])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGACCEPTED')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[1], msgid)
+        self.assertEqual(ans[2], 'MSGTASKS')
+        tasks = [frame.split('\t') for frame in ans[3:]]
+        self.assertTrue([taskid, '1'] in [task[:2] for task in tasks])
+        self.assertTrue(['sleep 2'] in [task[4:] for task in tasks])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[1], msgid)
+        self.assertEqual(ans[2], 'MSGCOMPLETED')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[1], taskid)
+        self.assertEqual(ans[2], 'MSGCOMPLETED')
+
+    def test_stdin_0(self):
+        msgid = gen_uuid()
+        send_msg(pub_socket, [device_id, msgid, "EXEC", "tr a-z A-Z", "stdin=1"])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGACCEPTED')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGTASK')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[1], msgid)
+        self.assertEqual(ans[2], 'MSGCREDIT')
+        self.assertEqual(struct.unpack('<I', ans[3])[0], 65536)
+        # Task answers (credits, output) interleave with the STDIN ones
+        answers = {}
+        for data in ["machin\n", ""]:
+            inputid = gen_uuid()
+            send_msg(pub_socket, [device_id, inputid, "STDIN", msgid, data])
+            statuses = []
+            while len(statuses) < 2:
+                ans = pull_socket.recv_multipart()
+                if ans[1] == msgid:
+                    answers[ans[2]] = ans[3:]
+                else:
+                    self.assertEqual(ans[1], inputid)
+                    statuses.append(ans[2])
+            self.assertEqual(statuses, ['MSGACCEPTED', 'MSGCOMPLETED'])
+        while 'MSGCOMPLETED' not in answers:
+            ans = pull_socket.recv_multipart()
+            self.assertEqual(ans[1], msgid)
+            answers[ans[2]] = ans[3:]
+        self.assertEqual(answers['MSGCMDOUTPUT'][0], 'MACHIN\n')
+    def test_stdin_1(self):
+        # No such task
+        msgid = gen_uuid()
+        send_msg(pub_socket, [device_id, msgid, "STDIN", gen_uuid(), "machin"])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGACCEPTED')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[1], msgid)
+        self.assertEqual(ans[2], 'MSGEXECERROR')
+
+    def test_ring_0(self):
+        msgid = gen_uuid()
+        send_msg(pub_socket, [device_id, msgid, "EXEC", "seq 1 1000", "ring=1"])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGACCEPTED')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGTASK')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[1], msgid)
+        self.assertEqual(ans[2], 'MSGCOMPLETED')
+        tailid = gen_uuid()
+        send_msg(pub_socket, [device_id, tailid, "TAIL", msgid, "0"])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGACCEPTED')
+        data = ""
+        ans = pull_socket.recv_multipart()
+        while ans[2] == 'MSGCHUNK':
+            self.assertEqual(ans[1], msgid)
+            output = "".join("%d\n" % i for i in xrange(1, 1001))
+            self.assertEqual(struct.unpack('<Q', ans[3])[0], len(output) - 1024 + len(data))
+            data += ans[4]
+            ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[1], tailid)
+        self.assertEqual(ans[2], 'MSGCOMPLETED')
+        self.assertEqual(data, output[-1024:])
+    def test_ring_1(self):
+        # Lingering rings count too: 1MB rings are refused before the 17th
+        refused = False
+        for i in xrange(17):
+            msgid = gen_uuid()
+            send_msg(pub_socket, [device_id, msgid, "EXEC", "true", "ring=1024"])
+            ans = pull_socket.recv_multipart()
+            self.assertEqual(ans[2], 'MSGACCEPTED')
+            ans = pull_socket.recv_multipart()
+            if ans[2] == 'MSGEXECERROR':
+                refused = True
+                break
+            self.assertEqual(ans[2], 'MSGTASK')
+            ans = pull_socket.recv_multipart()
+            self.assertEqual(ans[1], msgid)
+            self.assertEqual(ans[2], 'MSGCOMPLETED')
+        self.assertTrue(refused)
+
+    def test_schedule_0(self):
+        msgid = gen_uuid()
+        send_msg(pub_socket, [device_id, msgid, "SCHEDULE", "uptime", "60", "cat /proc/uptime", "jitter=5"])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGACCEPTED')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[1], msgid)
+        self.assertEqual(ans[2], 'MSGCOMPLETED')
+        with open("/tmp/satan.schedule") as f:
+            self.assertEqual(f.read(), "uptime\t60\t5\tcat /proc/uptime\n")
+        msgid = gen_uuid()
+        send_msg(pub_socket, [device_id, msgid, "UNSCHEDULE", "uptime"])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGACCEPTED')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGCOMPLETED')
+        msgid = gen_uuid()
+        send_msg(pub_socket, [device_id, msgid, "UNSCHEDULE", "uptime"])
+        ans = pull_socket.recv_multipart()
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGEXECERROR')
+    def test_schedule_1(self):
+        msgid = gen_uuid()
+        send_msg(pub_socket, [device_id, msgid, "SCHEDULE", "uptime", "often", "cat /proc/uptime"])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[1], msgid)
+        self.assertEqual(ans[2], 'MSGPARSEERROR')
+    def test_schedule_2(self):
+        # Both go by the entry name: the UNSCHEDULE sent right behind always finds it
+        schedid = gen_uuid()
+        unschedid = gen_uuid()
+        send_msg(pub_socket, [device_id, schedid, "SCHEDULE", "ordered", "60", "true"])
+        send_msg(pub_socket, [device_id, unschedid, "UNSCHEDULE", "ordered"])
+        finals = {}
+        while len(finals) < 2:
+            ans = pull_socket.recv_multipart()
+            if ans[2] != 'MSGACCEPTED':
+                finals[ans[1]] = ans[2]
+        self.assertEqual(finals[schedid], 'MSGCOMPLETED')
+        self.assertEqual(finals[unschedid], 'MSGCOMPLETED')
+        with open("/tmp/satan.schedule") as f:
+            self.assertFalse("ordered" in f.read())
+
+    def test_cache_0(self):
+        # The second EXEC comes while the first one runs, the third one after: one run only
+        cmd = "sleep 1; date +%s%N"
+        msgids = [gen_uuid() for i in xrange(3)]
+        outputs = {}
+        for msgid in msgids[:2]:
+            send_msg(pub_socket, [device_id, msgid, "EXEC", cmd, "ttl=60"])
+        while len(outputs) < 2:
+            ans = pull_socket.recv_multipart()
+            if ans[2] == 'MSGCMDOUTPUT':
+                outputs[ans[1]] = ans[3]
+        send_msg(pub_socket, [device_id, msgids[2], "EXEC", cmd, "ttl=60"])
+        while len(outputs) < 3:
+            ans = pull_socket.recv_multipart()
+            if ans[2] == 'MSGCMDOUTPUT':
+                outputs[ans[1]] = ans[3]
+        self.assertEqual(sorted(outputs.keys()), sorted(msgids))
+        self.assertEqual(len(set(outputs.values())), 1)
+
+    def cache_finals(self, cmd):
+        msgids = [gen_uuid() for i in xrange(2)]
+        finals = {}
+        for msgid in msgids:
+            send_msg(pub_socket, [device_id, msgid, "EXEC", cmd, "ttl=60"])
+        while len(finals) < 2:
+            ans = pull_socket.recv_multipart()
+            if ans[1] in msgids and ans[2] in ('MSGCOMPLETED', 'MSGEXECERROR'):
+                finals[ans[1]] = ans
+        return [finals[msgid] for msgid in msgids]
+
+    def test_cache_1(self):
+        # The waiter shares the exit status of the failed run
+        for ans in self.cache_finals("sleep 1; echo failing; exit 3"):
+            self.assertEqual(ans[2], 'MSGCOMPLETED')
+            self.assertEqual(len(ans), 6)
+            self.assertEqual(ord(ans[5][0]) & 0x01, 0x01)
+            self.assertEqual(ord(ans[5][1]), 3)
+
+    def test_cache_2(self):
+        # An output larger than the cache cannot be shared
+        leader, waiter = self.cache_finals("sleep 1; head -c 100000 /dev/zero")
+        self.assertEqual(leader[2], 'MSGCOMPLETED')
+        self.assertEqual(waiter[2], 'MSGEXECERROR')
+
+    def test_pull_0(self):
+        msgid = gen_uuid()
+        if os.path.exists("/tmp/pulled"):
+            os.remove("/tmp/pulled")
+        send_msg(pub_socket, [device_id, msgid, "PUSH", binarydata, "/tmp/pulled"])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGACCEPTED')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGCOMPLETED')
+        msgid = gen_uuid()
+        send_msg(pub_socket, [device_id, msgid, "PULL", "/tmp/pulled"])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGACCEPTED')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGTASK')
+        data = ""
+        ans = pull_socket.recv_multipart()
+        while ans[2] == 'MSGCHUNK':
+            self.assertEqual(struct.unpack('<Q', ans[3])[0], len(data))
+            data += ans[4]
+            ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[1], msgid)
+        self.assertEqual(ans[2], 'MSGCOMPLETED')
+        self.assertEqual(data, binarydata)
+    def test_pull_2(self):
+        shutil.rmtree("/tmp/pulldir", True)
+        os.makedirs("/tmp/pulldir")
+        for name in ["a", "b"]:
+            msgid = gen_uuid()
+            send_msg(pub_socket, [device_id, msgid, "PUSH", binarydata, "/tmp/pulldir/" + name])
+            ans = pull_socket.recv_multipart()
+            ans = pull_socket.recv_multipart()
+        msgid = gen_uuid()
+        send_msg(pub_socket, [device_id, msgid, "PULL", "/tmp/pulldir", "gzip=1"])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGACCEPTED')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGTASK')
+        data = ""
+        ans = pull_socket.recv_multipart()
+        while ans[2] == 'MSGCHUNK':
+            self.assertEqual(struct.unpack('<Q', ans[3])[0], len(data))
+            data += ans[4]
+            ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGCOMPLETED')
+        archive = tarfile.open(fileobj=StringIO.StringIO(data), mode="r:gz")
+        self.assertEqual(archive.extractfile("pulldir/a").read(), binarydata)
+        self.assertEqual(archive.extractfile("pulldir/b").read(), binarydata)
+    def test_pull_3(self):
+        msgid = gen_uuid()
+        send_msg(pub_socket, [device_id, msgid, "PULL", "/tmp", "bzip=1"])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[1], msgid)
+        self.assertEqual(ans[2], 'MSGPARSEERROR')
+    def test_pull_1(self):
+        msgid = gen_uuid()
+        send_msg(pub_socket, [device_id, msgid, "PULL", "/nonexistent"])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGACCEPTED')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[1], msgid)
+        self.assertEqual(ans[2], 'MSGEXECERROR')
+
+    def sync_manifest(self, directory):
+        msgid = gen_uuid()
+        send_msg(pub_socket, [device_id, msgid, "SYNC", directory])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGACCEPTED')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[1], msgid)
+        self.assertEqual(ans[2], 'MSGMANIFEST')
+        manifest = ans[3:]
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGCOMPLETED')
+        return manifest
+    def test_sync_0(self):
+        shutil.rmtree("/tmp/syncdir", True)
+        os.makedirs("/tmp/syncdir/sub")
+        with open("/tmp/syncdir/a", "w") as f:
+            f.write(binarydata)
+        with open("/tmp/syncdir/sub/b", "w") as f:
+            f.write("b")
+        manifest = self.sync_manifest("/tmp/syncdir")
+        _sum = 0
+        for entry in manifest[1:]:
+            _sum = CRC32C(entry, _sum)
+        self.assertEqual(manifest[0], "%08x" % _sum)
+        self.assertEqual([e.split('\t')[0] for e in manifest[1:]], ["a", "sub/b"])
+        self.assertEqual(manifest[1].split('\t')[1], str(len(binarydata)))
+        self.assertEqual(manifest[1].split('\t')[3], "%08x" % CRC32C(binarydata, 0))
+    def test_sync_1(self):
+        shutil.rmtree("/tmp/syncdir", True)
+        os.makedirs("/tmp/syncdir")
+        with open("/tmp/syncdir/old", "w") as f:
+            f.write("old")
+        manifest = self.sync_manifest("/tmp/syncdir")
+        msgid = gen_uuid()
+        send_msg(pub_socket, [device_id, msgid, "SYNCAPPLY", "/tmp/syncdir", manifest[0],
+            "+new/c", binarydata, "-old"])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGACCEPTED')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[1], msgid)
+        self.assertEqual(ans[2], 'MSGCOMPLETED')
+        self.assertEqual(open("/tmp/syncdir/new/c").read(), binarydata)
+        self.assertFalse(os.path.exists("/tmp/syncdir/old"))
+        manifest = self.sync_manifest("/tmp/syncdir")
+        self.assertEqual([e.split('\t')[0] for e in manifest[1:]], ["new/c"])
+    def test_sync_3(self):
+        # A retransmitted SYNC sends its manifest again
+        msgid = gen_uuid()
+        manifests = []
+        for i in xrange(2):
+            send_msg(pub_socket, [device_id, msgid, "SYNC", "/tmp/syncdir"])
+            ans = pull_socket.recv_multipart()
+            self.assertEqual(ans[2], 'MSGACCEPTED')
+            ans = pull_socket.recv_multipart()
+            self.assertEqual(ans[1], msgid)
+            self.assertEqual(ans[2], 'MSGMANIFEST')
+            manifests.append(ans[3:])
+            ans = pull_socket.recv_multipart()
+            self.assertEqual(ans[2], 'MSGCOMPLETED')
+        self.assertEqual(manifests[0], manifests[1])
+    def test_sync_2(self):
+        shutil.rmtree("/tmp/syncdir", True)
+        os.makedirs("/tmp/syncdir")
+        manifest = self.sync_manifest("/tmp/syncdir")
+        # Changed since its manifest: left alone
+        with open("/tmp/syncdir/a", "w") as f:
+            f.write("a")
+        msgid = gen_uuid()
+        send_msg(pub_socket, [device_id, msgid, "SYNCAPPLY", "/tmp/syncdir", manifest[0], "+b", "b"])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGACCEPTED')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGEXECERROR')
+        self.assertFalse(os.path.exists("/tmp/syncdir/b"))
+        # Out of the directory
+        manifest = self.sync_manifest("/tmp/syncdir")
+        msgid = gen_uuid()
+        send_msg(pub_socket, [device_id, msgid, "SYNCAPPLY", "/tmp/syncdir", manifest[0], "+../b", "b"])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGACCEPTED')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGEXECERROR')
+        self.assertFalse(os.path.exists("/tmp/b"))
+
+    def test_burst_0(self):
+        # Messages spread over the validation threads: each one answered, in order for its own id
+        msgids = [gen_uuid() for i in xrange(32)]
+        for i, msgid in enumerate(msgids):
+            send_msg(pub_socket, [device_id, msgid, "EXEC", "echo %d" % i])
+        answers = {}
+        outputs = {}
+        while len(outputs) < len(msgids) or any(len(a) < 4 for a in answers.values()):
+            ans = pull_socket.recv_multipart()
+            answers.setdefault(ans[1], []).append(ans[2])
+            if ans[2] == 'MSGCMDOUTPUT':
+                outputs[ans[1]] = ans[3]
+        for i, msgid in enumerate(msgids):
+            self.assertEqual(answers[msgid], ['MSGACCEPTED', 'MSGTASK', 'MSGCMDOUTPUT', 'MSGCOMPLETED'])
+            self.assertEqual(outputs[msgid], "%d\n" % i)
+
+    def test_address_0(self):
+        # Prefix of the uuid topic only: must be ignored by the device
+        send_msg(pub_socket, [device_id + "_other", gen_uuid(), "EXEC", "echo machin"])
+        msgid = gen_uuid()
+        send_msg(pub_socket, [device_id, msgid, "PUSH"])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[1], msgid)
+        self.assertEqual(ans[2], 'MSGPARSEERROR')
+    def test_group_0(self):
+        msgid = gen_uuid()
+        send_msg(pub_socket, [group_id, msgid, "EXEC", "echo machin"])
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[0], device_id)
+        self.assertEqual(ans[1], msgid)
+        self.assertEqual(ans[2], 'MSGACCEPTED')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[0], device_id)
+        self.assertEqual(ans[2], 'MSGTASK')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[2], 'MSGCMDOUTPUT')
+        ans = pull_socket.recv_multipart()
+        self.assertEqual(ans[0], device_id)
+        self.assertEqual(ans[2], 'MSGCOMPLETED')
+
+
+# libsatan-client, driving a daemon of its own
+client_dir = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "src")
+client_lib = os.path.join(client_dir, ".libs", "libsatan-client.so")
+client_fn = ctypes.CFUNCTYPE(None, ctypes.c_void_p, ctypes.c_char_p, ctypes.c_int, ctypes.c_void_p, ctypes.c_void_p)
+CLIENT_TIMEOUT = 0xFF
+
+@unittest.skipUnless(os.path.exists(client_lib), "libsatan-client is not built")
+class TestClient(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.lib = ctypes.CDLL(client_lib)
+        cls.czmq = ctypes.CDLL(ctypes.util.find_library("czmq"))
+        cls.lib.client_new.restype = ctypes.c_void_p
+        cls.lib.client_new.argtypes = [ctypes.c_char_p, ctypes.c_char_p]
+        cls.lib.client_destroy.argtypes = [ctypes.POINTER(ctypes.c_void_p)]
+        cls.lib.client_set_timeout.argtypes = [ctypes.c_void_p, ctypes.c_int]
+        cls.lib.client_send.restype = ctypes.c_char_p
+        cls.lib.client_send.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_char_p, ctypes.c_void_p,
+                client_fn, ctypes.c_void_p]
+        cls.lib.client_exec.restype = ctypes.c_char_p
+        cls.lib.client_exec.argtypes = [ctypes.c_void_p, ctypes.c_char_p, ctypes.c_char_p, client_fn, ctypes.c_void_p]
+        cls.lib.client_process.argtypes = [ctypes.c_void_p, ctypes.c_int]
+        cls.czmq.zmsg_last.restype = ctypes.c_void_p
+        cls.czmq.zmsg_last.argtypes = [ctypes.c_void_p]
+        cls.czmq.zframe_data.restype = ctypes.c_void_p
+        cls.czmq.zframe_data.argtypes = [ctypes.c_void_p]
+        cls.czmq.zframe_size.restype = ctypes.c_size_t
+        cls.czmq.zframe_size.argtypes = [ctypes.c_void_p]
+
+        cls.client = ctypes.c_void_p(cls.lib.client_new("tcp://*:10084", "tcp://*:10085"))
+        cls.satan = subprocess.Popen([os.path.join(client_dir, "satan"), "-s", "tcp://localhost:10084",
+            "-p", "tcp://localhost:10085", "-u", "client", "-l", "", "-S", "/tmp/client.schedule",
+            "-H", "0"],
+            stdout=open(os.devnull, "w"))
+        # Commands sent before the daemon subscribes are lost
+        cls.lib.client_set_timeout(cls.client, 200)
+        while True:
+            answers = cls.run_commands(lambda cb: cls.lib.client_send(cls.client, "client", "TASKS", None, cb, None))
+            if answers.values()[0][-1][0] == 0x80:
+                break
+        cls.lib.client_set_timeout(cls.client, 30000)
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.satan.terminate()
+        cls.satan.wait()
+        cls.lib.client_destroy(ctypes.byref(cls.client))
+
+    @classmethod
+    def run_commands(cls, *senders):
+        """ Every answer, (status, last frame), by message id """
+        answers = {}
+        def on_answer(client, msgid, status, answer, arg):
+            frame = cls.czmq.zmsg_last(answer) if answer else None
+            data = ctypes.string_at(cls.czmq.zframe_data(frame), cls.czmq.zframe_size(frame)) if frame else None
+            answers.setdefault(msgid, []).append((status, data))
+        callback = client_fn(on_answer)
+        for sender in senders:
+            answers[sender(callback)] = []
+        while cls.lib.client_process(cls.client, 1000) > 0:
+            pass
+        return answers
+
+    def test_client_0(self):
+        # Pipelined commands, each answer handed to its own
+        answers = self.run_commands(
+            lambda cb: self.lib.client_exec(self.client, "client", "echo first", cb, None),
+            lambda cb: self.lib.client_exec(self.client, "client", "sleep 1; echo second", cb, None),
+            lambda cb: self.lib.client_send(self.client, "client", "TASKS", None, cb, None))
+        self.assertEqual(len(answers), 3)
+        outputs = []
+        for msgid, statuses in answers.items():
+            self.assertEqual(statuses[0][0], 0x01) # MSGACCEPTED
+            self.assertEqual(statuses[-1][0], 0x80) # MSGCOMPLETED
+            outputs += [data for status, data in statuses if status == 0x40]
+        self.assertEqual(sorted(outputs), ["first\n", "second\n"])
+
+    def test_client_1(self):
+        # No device to answer: the command times out, once
+        self.lib.client_set_timeout(self.client, 500)
+        start = time()
+        answers = self.run_commands(lambda cb: self.lib.client_send(self.client, "nobody", "TASKS", None, cb, None))
+        self.lib.client_set_timeout(self.client, 30000)
+        self.assertEqual(answers.values(), [[(CLIENT_TIMEOUT, None)]])
+        self.assertTrue(0.4 < time() - start < 2)
+
+    def test_client_2(self):
+        # Waiting without a limit still ends at the nearest timeout
+        timeouts = []
+        callback = client_fn(lambda client, msgid, status, answer, arg: timeouts.append(status))
+        self.lib.client_set_timeout(self.client, 500)
+        start = time()
+        self.lib.client_send(self.client, "nobody", "TASKS", None, callback, None)
+        self.lib.client_set_timeout(self.client, 30000)
+        while self.lib.client_process(self.client, -1) > 0:
+            pass
+        self.assertEqual(timeouts, [CLIENT_TIMEOUT])
+        self.assertTrue(0.4 < time() - start < 2)
+
+
+# Daemons of their own, for the modes the one above does not run in
+satan_binary = os.path.join(client_dir, "satan")
+
+@unittest.skipUnless(os.path.exists(satan_binary), "satan is not built")
+class TestDealer(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.router = context.socket(zmq.ROUTER)
+        cls.router.bind("tcp://*:10086")
+        cls.satan = subprocess.Popen([satan_binary, "-t", "dealer", "-s", "tcp://localhost:10086", "-u", "dealer",
+            "-l", "", "-S", "/tmp/dealer.schedule", "-H", "0"], stdout=open(os.devnull, "w"))
+        # The router drops what it sends before the device connects
+        while True:
+            cls.send(["dealer", gen_uuid(), "TASKS"])
+            if cls.router.poll(200):
+                break
+        while cls.router.poll(200):
+            cls.router.recv_multipart()
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.satan.terminate()
+        cls.satan.wait()
+        cls.router.close()
+
+    @classmethod
+    def send(cls, msg):
+        """ The routing identity is not part of the checksum """
+        msg.append(hash_msg(msg))
+        cls.router.send_multipart(["dealer"] + msg)
+
+    def test_dealer_0(self):
+        msgid = gen_uuid()
+        self.send(["dealer", msgid, "EXEC", "echo machin"])
+        for status in ['MSGACCEPTED', 'MSGTASK', 'MSGCMDOUTPUT', 'MSGCOMPLETED']:
+            ans = self.router.recv_multipart()
+            self.assertEqual(ans[0], "dealer") # routing identity
+            self.assertEqual(ans[1], "dealer")
+            self.assertEqual(ans[2], msgid)
+            self.assertEqual(ans[3], status)
+        self.assertEqual(ans[4], struct.pack('<I', 0))
+
+    def test_dealer_1(self):
+        if os.path.exists("/tmp/dealt"):
+            os.remove("/tmp/dealt")
+        msgid = gen_uuid()
+        self.send(["dealer", msgid, "PUSH", binarydata, "/tmp/dealt"])
+        ans = self.router.recv_multipart()
+        self.assertEqual(ans[3], 'MSGACCEPTED')
+        ans = self.router.recv_multipart()
+        self.assertEqual(ans[2], msgid)
+        self.assertEqual(ans[3], 'MSGCOMPLETED')
+        with open("/tmp/dealt") as f:
+            self.assertEqual(f.read(), binarydata)
+
+
+@unittest.skipUnless(os.path.exists(satan_binary), "satan is not built")
+class TestHeartbeat(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.pull = context.socket(zmq.PULL)
+        cls.pull.bind("tcp://*:10088")
+        cls.pub = context.socket(zmq.PUB)
+        cls.pub.bind("tcp://*:10087")
+        cls.satan = subprocess.Popen([satan_binary, "-s", "tcp://localhost:10087", "-p", "tcp://localhost:10088",
+            "-u", "beating", "-l", "", "-S", "/tmp/beating.schedule", "-H", "1"], stdout=open(os.devnull, "w"))
+
+    @classmethod
+    def tearDownClass(cls):
+        cls.satan.terminate()
+        cls.satan.wait()
+        cls.pull.close()
+        cls.pub.close()
+
+    def test_heartbeat_0(self):
+        # One every second, plus up to 5 of jitter
+        self.assertTrue(self.pull.poll(10000))
+        ans = self.pull.recv_multipart()
+        self.assertEqual(ans[0], "beating")
+        self.assertEqual(ans[1], '')
+        self.assertEqual(ans[2], 'MSGHEARTBEAT')
+        self.assertEqual(len(ans[3]), 32)
+        (version, flags, tasks, uptime, mem_total, mem_free, load1, load5, load15,
+            queued_messages, queued_bytes, queued_commands, queued_files) = struct.unpack('<BBHIIIHHHHIHH', ans[3])
+        self.assertEqual(version, 1)
+        self.assertTrue(flags & 0x01)
+        self.assertEqual(tasks, 0)
+        self.assertTrue(uptime > 0)
+        self.assertTrue(0 < mem_free <= mem_total)
+        self.assertEqual((queued_messages, queued_bytes, queued_files), (0, 0, 0))
+
+
+sys.path.append(os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "bench"))
+import replay
+
+@unittest.skipUnless(os.path.exists(satan_binary), "satan is not built")
+class TestCapture(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.pull = context.socket(zmq.PULL)
+        cls.pull.bind("tcp://*:10093")
+        cls.pub = context.socket(zmq.PUB)
+        cls.pub.bind("tcp://*:10092")
+        if os.path.exists("/tmp/satan.capture"):
+            os.remove("/tmp/satan.capture")
+        cls.satan = subprocess.Popen([satan_binary, "-s", "tcp://localhost:10092", "-p", "tcp://localhost:10093",
+            "-u", "recorded", "-l", "", "-S", "/tmp/recorded.schedule", "-H", "0", "-r", "/tmp/satan.capture"],
+            stdout=open(os.devnull, "w"))
+        # Commands sent before the daemon subscribes are lost
+        while True:
+            send_msg(cls.pub, ["recorded", gen_uuid(), "TASKS"])
+            if cls.pull.poll(200):
+                break
+        while cls.pull.poll(200):
+            cls.pull.recv_multipart()
+
+    @classmethod
+    def tearDownClass(cls):
+        if cls.satan.poll() is None:
+            cls.satan.terminate()
+            cls.satan.wait()
+        cls.pull.close()
+        cls.pub.close()
+
+    def test_capture_0(self):
+        msgid = gen_uuid()
+        command = ["recorded", msgid, "EXEC", "echo machin"]
+        send_msg(self.pub, command) # appends the checksum
+        for status in ['MSGACCEPTED', 'MSGTASK', 'MSGCMDOUTPUT', 'MSGCOMPLETED']:
+            ans = self.pull.recv_multipart()
+            self.assertEqual(ans[2], status)
+        # The capture is complete once the daemon is stopped
+        self.satan.terminate()
+        self.satan.wait()
+        records = replay.read_capture("/tmp/satan.capture")
+        received = [(when, frames) for direction, when, frames in records
+                if direction == replay.CAPTURE_IN and frames == command]
+        self.assertEqual(len(received), 1)
+        stream = replay.recorded_stream(records)
+        self.assertEqual(replay.answer_types(stream.answers[msgid]),
+                ['MSGACCEPTED', 'MSGTASK', 'MSGCMDOUTPUT', 'MSGCOMPLETED'])
+        self.assertEqual(stream.answers[msgid][2][3], "machin\n")
+        self.assertTrue(received[0][0] <= stream.last[msgid])
 
 
 if __name__ == '__main__':